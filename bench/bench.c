@@ -0,0 +1,538 @@
+//----------------------------------------------------------------------------------------------------------------------
+// zximg micro-benchmarks
+// Times the hot functions of the converter on the images and screens in data/.  Every function is warmed up, then
+// timed over a number of samples, each long enough to swamp the timer resolution, and reported as min/median/mean
+// with the spread.  Alternative implementations of the same function go in the same group as the reference one so
+// the speedup is printed next to them.
+//----------------------------------------------------------------------------------------------------------------------
+
+#include "zximg.h"
+
+#include <math.h>
+
+//----------------------------------------------------------------------------------------------------------------------
+// Fixture
+// Everything the benchmarks work on, loaded once up front
+//----------------------------------------------------------------------------------------------------------------------
+
+#define MAX_TARGETS     8
+#define MAX_SCREENS     8
+
+typedef struct
+{
+    char        name[32];
+    Image*      target;
+    Converter   converter;      // Scored once so chooseParent() has something to pick from
+    Converter   hybrid;         // The same in hybrid mode
+    Converter   blur;           // ...and scoring through a blur, with a bred population waiting to be scored
+    Converter   ulaplus;        // ...and in ULAplus mode, likewise
+    Converter   hicolour;       // ...and in hi-colour mode
+    Converter   multicolour;    // ...and in multicolour mode with 8x4 blocks
+    Converter   gigascreen;     // ...and in Gigascreen mode
+}
+Target;
+
+typedef struct
+{
+    Target      targets[MAX_TARGETS];
+    int         numTargets;
+    u8          screens[MAX_SCREENS][6912];
+    char        screenNames[MAX_SCREENS][32];
+    int         numScreens;
+    Image*      image;
+    Image*      bordered;
+    Rng         rng;
+    u8          child[6912];
+}
+Fixture;
+
+Fixture gFixture;
+volatile u64 gSink;             // Results go here so the compiler can't drop the work
+
+void fixtureLoad(const char* dataDir)
+{
+    static const char* images[] = { "img1.jpg", "img2.jpg", "img3.jpg" };
+    static const char* screens[] = { "Wizball.scr", "SabreWulf.scr" };
+    Fixture* f = &gFixture;
+    char path[MAX_PATH];
+
+    for (int i = 0; i < sizeof(images) / sizeof(images[0]); ++i)
+    {
+        Target* t = &f->targets[f->numTargets];
+        snprintf(path, MAX_PATH, "%s\\%s", dataDir, images[i]);
+        t->target = imageCreate(256, 192);
+        if (targetLoad(t->target, path))
+        {
+            printf("Skipping %s\n", path);
+            continue;
+        }
+        strncpy(t->name, images[i], sizeof(t->name) - 1);
+        converterInit(&t->converter, t->target, 1);
+        converterStep(&t->converter);
+        converterInit(&t->hybrid, t->target, 1);
+        converterHybrid(&t->hybrid);
+        converterStep(&t->hybrid);
+        converterInit(&t->blur, t->target, 1);
+        converterBlur(&t->blur, 1.0f);
+        converterStep(&t->blur);
+        converterInit(&t->ulaplus, t->target, 1);
+        converterUlaplus(&t->ulaplus, YES);
+        converterStep(&t->ulaplus);
+        converterInit(&t->hicolour, t->target, 1);
+        converterHicolour(&t->hicolour, 1, NO);
+        converterStep(&t->hicolour);
+        converterInit(&t->multicolour, t->target, 1);
+        converterHicolour(&t->multicolour, 4, NO);
+        converterStep(&t->multicolour);
+        converterInit(&t->gigascreen, t->target, 1);
+        converterGigascreen(&t->gigascreen, YES);
+        converterStep(&t->gigascreen);
+        ++f->numTargets;
+    }
+
+    for (int i = 0; i < sizeof(screens) / sizeof(screens[0]); ++i)
+    {
+        Data d;
+        snprintf(path, MAX_PATH, "%s\\%s", dataDir, screens[i]);
+        d = dataLoad(path);
+        if (d.buffer && d.size >= 6912)
+        {
+            memcpy(f->screens[f->numScreens], d.buffer, 6912);
+            strncpy(f->screenNames[f->numScreens], screens[i], sizeof(f->screenNames[0]) - 1);
+            ++f->numScreens;
+        }
+        else
+        {
+            printf("Skipping %s\n", path);
+        }
+        dataUnload(d);
+    }
+
+    f->image = imageCreate(256, 192);
+    f->bordered = imageCreate(320, 256);
+    rngSeed(&f->rng, 1);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Benchmarks
+// Each runs its operation 'count' times on one input.  Inputs are screens for the decoders and targets for the rest.
+//----------------------------------------------------------------------------------------------------------------------
+
+typedef enum
+{
+    INPUT_SCREENS,
+    INPUT_TARGETS,
+}
+InputKind;
+
+typedef struct
+{
+    const char* group;          // Function being measured
+    const char* variant;        // Implementation; the first one in a group is the reference
+    InputKind   input;
+    const char* unit;           // What one operation is
+    i64         bytesPerOp;     // Screen bytes handled per operation
+    void        (*run)(int input, i64 count);
+}
+Bench;
+
+void benchConvertScalar(int input, i64 count)
+{
+    for (i64 i = 0; i < count; ++i)
+    {
+        imageZxConvertScalar(gFixture.image, gFixture.screens[input]);
+    }
+    gSink += gFixture.image->pixels[0];
+}
+
+void benchConvertSse2(int input, i64 count)
+{
+    for (i64 i = 0; i < count; ++i)
+    {
+        imageZxConvert(gFixture.image, gFixture.screens[input]);
+    }
+    gSink += gFixture.image->pixels[0];
+}
+
+void benchRenderBorderFlash(int input, i64 count)
+{
+    for (i64 i = 0; i < count; ++i)
+    {
+        imageZxRender(gFixture.bordered, gFixture.screens[input], YES, 1);
+    }
+    gSink += gFixture.bordered->pixels[0];
+}
+
+void benchCheckError(int input, i64 count)
+{
+    Converter* cv = &gFixture.targets[input].converter;
+    i64 total = 0;
+    for (i64 i = 0; i < count; ++i)
+    {
+        total += checkError(cv->scratch, cv->target, &cv->future->genomes[(i % POPULATION_SIZE) * 6912]);
+    }
+    gSink += total;
+}
+
+void benchHybridError(int input, i64 count)
+{
+    Converter* cv = &gFixture.targets[input].hybrid;
+    i64 total = 0;
+    for (i64 i = 0; i < count; ++i)
+    {
+        total += hybridError(cv, &cv->future->genomes[(i % POPULATION_SIZE) * 6912]);
+    }
+    gSink += total;
+}
+
+// Every cell of a scrim, as for one without a parent
+void benchBlurFull(int input, i64 count)
+{
+    Converter* cv = &gFixture.targets[input].blur;
+    bool dirty[768];
+    i32 scores[768];
+    memset(dirty, YES, sizeof(dirty));
+    for (i64 i = 0; i < count; ++i)
+    {
+        blurScore(cv->blur, &cv->future->genomes[(i % POPULATION_SIZE) * 6912], dirty, scores);
+    }
+    gSink += scores[0];
+}
+
+// Children of the scored population, re-scoring only what they changed
+void benchBlurIncremental(int input, i64 count)
+{
+    Converter* cv = &gFixture.targets[input].blur;
+    i64 total = 0;
+    for (i64 i = 0; i < count; ++i)
+    {
+        total += blurError(cv, cv->current, (int)(i % POPULATION_SIZE), cv->future);
+    }
+    gSink += total;
+}
+
+// Children of the scored population, re-scoring only the cells whose bytes or palette entries they changed
+void benchUlaplusIncremental(int input, i64 count)
+{
+    Converter* cv = &gFixture.targets[input].ulaplus;
+    i64 total = 0;
+    for (i64 i = 0; i < count; ++i)
+    {
+        total += ulaplusError(cv, cv->current, (int)(i % POPULATION_SIZE), cv->future);
+    }
+    gSink += total;
+}
+
+// Children of the scored population, looking up only the rows they changed
+void benchHicolourIncremental(int input, i64 count)
+{
+    Converter* cv = &gFixture.targets[input].hicolour;
+    i64 total = 0;
+    for (i64 i = 0; i < count; ++i)
+    {
+        total += hicolourError(cv, cv->current, (int)(i % POPULATION_SIZE), cv->future);
+    }
+    gSink += total;
+}
+
+// The same with 8x4 blocks, a quarter as many
+void benchMulticolourIncremental(int input, i64 count)
+{
+    Converter* cv = &gFixture.targets[input].multicolour;
+    i64 total = 0;
+    for (i64 i = 0; i < count; ++i)
+    {
+        total += hicolourError(cv, cv->current, (int)(i % POPULATION_SIZE), cv->future);
+    }
+    gSink += total;
+}
+
+// Children of the scored population, re-scoring only the cells they changed in either frame
+void benchGigascreenIncremental(int input, i64 count)
+{
+    Converter* cv = &gFixture.targets[input].gigascreen;
+    i64 total = 0;
+    for (i64 i = 0; i < count; ++i)
+    {
+        total += gigascreenError(cv, cv->current, (int)(i % POPULATION_SIZE), cv->future);
+    }
+    gSink += total;
+}
+
+void benchHybridBitmap(int input, i64 count)
+{
+    Converter* cv = &gFixture.targets[input].hybrid;
+    for (i64 i = 0; i < count; ++i)
+    {
+        hybridBitmap(cv, cv->best);
+    }
+    gSink += cv->best[0];
+}
+
+void benchChooseParent(int input, i64 count)
+{
+    Converter* cv = &gFixture.targets[input].converter;
+    i64 total = 0;
+    for (i64 i = 0; i < count; ++i)
+    {
+        total += chooseParent(&gFixture.rng, cv->future);
+    }
+    gSink += total;
+}
+
+void benchMutate(int input, i64 count)
+{
+    const u8* genome = gFixture.targets[input].converter.best;
+    u64 total = 0;
+    for (i64 i = 0; i < count; ++i)
+    {
+        total += mutate(&gFixture.rng, genome[i % 6912], MUTATION_CHANCE);
+    }
+    gSink += total;
+}
+
+void benchCrossover(int input, i64 count)
+{
+    Converter* cv = &gFixture.targets[input].converter;
+    for (i64 i = 0; i < count; ++i)
+    {
+        crossover(&gFixture.rng, &cv->future->genomes[(i % POPULATION_SIZE) * 6912],
+            &cv->future->genomes[((i + 1) % POPULATION_SIZE) * 6912], gFixture.child, 6912, MUTATION_CHANCE);
+    }
+    gSink += gFixture.child[0];
+}
+
+void benchGenerateScrim(int input, i64 count)
+{
+    for (i64 i = 0; i < count; ++i)
+    {
+        generateScrim(&gFixture.rng, gFixture.child);
+    }
+    gSink += gFixture.child[0];
+}
+
+void benchGenerate(int input, i64 count)
+{
+    Converter* cv = &gFixture.targets[input].converter;
+    for (i64 i = 0; i < count; ++i)
+    {
+        converterStep(cv);
+    }
+    gSink += cv->bestError;
+}
+
+void benchDither(int input, Dither dither, i64 count)
+{
+    const Image* target = gFixture.targets[input].target;
+    for (i64 i = 0; i < count; ++i)
+    {
+        ditherScreen(target, dither, gFixture.child);
+    }
+    gSink += gFixture.child[0];
+}
+
+void benchDitherFloydSteinberg(int input, i64 count)    { benchDither(input, DITHER_FLOYD_STEINBERG, count); }
+void benchDitherAtkinson(int input, i64 count)          { benchDither(input, DITHER_ATKINSON, count); }
+void benchDitherSierra(int input, i64 count)            { benchDither(input, DITHER_SIERRA, count); }
+void benchDitherBayer(int input, i64 count)             { benchDither(input, DITHER_BAYER, count); }
+void benchDitherBlueNoise(int input, i64 count)         { benchDither(input, DITHER_BLUE_NOISE, count); }
+
+void benchDitherAnalyse(int input, i64 count)
+{
+    const Image* target = gFixture.targets[input].target;
+    for (i64 i = 0; i < count; ++i)
+    {
+        ditherAnalyse(target, gFixture.child + 6144);
+    }
+    gSink += gFixture.child[6144];
+}
+
+Bench gBenches[] =
+{
+    { "imageZxConvert",     "scalar",       INPUT_SCREENS,  "screen",       6912,                       &benchConvertScalar },
+    { "imageZxConvert",     "sse2",         INPUT_SCREENS,  "screen",       6912,                       &benchConvertSse2 },
+    { "imageZxRender",      "border+flash", INPUT_SCREENS,  "screen",       6912,                       &benchRenderBorderFlash },
+    { "checkError",         "default",      INPUT_TARGETS,  "scrim",        6912,                       &benchCheckError },
+    { "checkError",         "hybrid",       INPUT_TARGETS,  "scrim",        6912,                       &benchHybridError },
+    { "checkError",         "blur",         INPUT_TARGETS,  "scrim",        6912,                       &benchBlurFull },
+    { "checkError",         "blur-incr",    INPUT_TARGETS,  "scrim",        6912,                       &benchBlurIncremental },
+    { "checkError",         "ulaplus-incr", INPUT_TARGETS,  "scrim",        6912 + 64,                  &benchUlaplusIncremental },
+    { "checkError",         "8x1-incr",     INPUT_TARGETS,  "scrim",        6144 * 2,                   &benchHicolourIncremental },
+    { "checkError",         "8x4-incr",     INPUT_TARGETS,  "scrim",        6144 + 1536,                &benchMulticolourIncremental },
+    { "checkError",         "giga-incr",    INPUT_TARGETS,  "scrim",        6912 * 2,                   &benchGigascreenIncremental },
+    { "hybridBitmap",       "sse2",         INPUT_TARGETS,  "scrim",        6144,                       &benchHybridBitmap },
+    { "chooseParent",       "roulette",     INPUT_TARGETS,  "parent",       0,                          &benchChooseParent },
+    { "mutate",             "default",      INPUT_TARGETS,  "byte",         1,                          &benchMutate },
+    { "crossover",          "one-point",    INPUT_TARGETS,  "child",        6912,                       &benchCrossover },
+    { "generateScrim",      "xorshift",     INPUT_TARGETS,  "scrim",        6912,                       &benchGenerateScrim },
+    { "generate",           "ga",           INPUT_TARGETS,  "generation",   6912 * POPULATION_SIZE,     &benchGenerate },
+    { "ditherAnalyse",      "segments",     INPUT_TARGETS,  "screen",       768,                        &benchDitherAnalyse },
+    { "ditherScreen",       "fs",           INPUT_TARGETS,  "screen",       6912,                       &benchDitherFloydSteinberg },
+    { "ditherScreen",       "atkinson",     INPUT_TARGETS,  "screen",       6912,                       &benchDitherAtkinson },
+    { "ditherScreen",       "sierra",       INPUT_TARGETS,  "screen",       6912,                       &benchDitherSierra },
+    { "ditherScreen",       "bayer",        INPUT_TARGETS,  "screen",       6912,                       &benchDitherBayer },
+    { "ditherScreen",       "bluenoise",    INPUT_TARGETS,  "screen",       6912,                       &benchDitherBlueNoise },
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+// Runner
+//----------------------------------------------------------------------------------------------------------------------
+
+typedef struct
+{
+    int         samples;
+    f64         sampleTime;     // Seconds each sample should take
+    f64         warmupTime;
+    const char* filter;
+    FILE*       csv;
+}
+RunOptions;
+
+int compareF64(const void* a, const void* b)
+{
+    f64 x = *(const f64 *)a;
+    f64 y = *(const f64 *)b;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+// Times one benchmark on one input and returns the median nanoseconds per operation
+f64 benchMeasure(const Bench* bench, int input, const char* inputName, const RunOptions* options, f64 reference)
+{
+    f64 ns[64];
+    f64 mean = 0, var = 0, median, opsPerSec;
+    i64 count = 1;
+    int samples = options->samples < 64 ? options->samples : 64;
+    f64 start;
+
+    // Warm up while finding how many operations fill one sample
+    start = timeNow();
+    for (;;)
+    {
+        f64 t = timeNow();
+        bench->run(input, count);
+        t = timeNow() - t;
+        if (t >= options->sampleTime && timeNow() - start >= options->warmupTime) break;
+        if (t < options->sampleTime) count *= 2;
+    }
+
+    for (int s = 0; s < samples; ++s)
+    {
+        f64 t = timeNow();
+        bench->run(input, count);
+        ns[s] = (timeNow() - t) * 1e9 / (f64)count;
+        mean += ns[s];
+    }
+    mean /= samples;
+    for (int s = 0; s < samples; ++s)
+    {
+        var += (ns[s] - mean) * (ns[s] - mean);
+    }
+    var /= samples > 1 ? samples - 1 : 1;
+    qsort(ns, samples, sizeof(f64), &compareF64);
+    median = ns[samples / 2];
+    opsPerSec = 1e9 / median;
+
+    printf("%-16s %-14s %-14s %12.1f %12.1f %12.1f %7.1f%% %14.0f %s/s",
+        bench->group, bench->variant, inputName, ns[0], median, mean, 100.0 * sqrt(var) / mean, opsPerSec,
+        bench->unit);
+    if (bench->bytesPerOp)
+    {
+        printf(" %10.1f MB/s", opsPerSec * (f64)bench->bytesPerOp / 1e6);
+    }
+    if (reference > 0)
+    {
+        printf("  x%.2f", reference / median);
+    }
+    printf("\n");
+
+    if (options->csv)
+    {
+        fprintf(options->csv, "%s,%s,%s,%s,%lld,%.3f,%.3f,%.3f,%.3f,%.1f,%.1f\n",
+            bench->group, bench->variant, inputName, bench->unit, count, ns[0], median, mean, sqrt(var),
+            opsPerSec, opsPerSec * (f64)bench->bytesPerOp);
+    }
+
+    return median;
+}
+
+// Usage:
+//
+//      bench [--data <dir>] [--filter <text>] [--samples <n>] [--sample-ms <n>] [--warmup-ms <n>] [--csv <file>]
+//
+int main(int argc, char** argv)
+{
+    RunOptions options = { 15, 0.02, 0.2, 0, 0 };
+    const char* dataDir = ".";
+    const char* csvName = 0;
+    int numBenches = sizeof(gBenches) / sizeof(gBenches[0]);
+    f64 medians[sizeof(gBenches) / sizeof(gBenches[0])][MAX_TARGETS > MAX_SCREENS ? MAX_TARGETS : MAX_SCREENS] = { 0 };
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+        const char* value = (i + 1 < argc) ? argv[i + 1] : 0;
+
+        if (!strcmp(arg, "--data") && value)            dataDir = argv[++i];
+        else if (!strcmp(arg, "--filter") && value)     options.filter = argv[++i];
+        else if (!strcmp(arg, "--samples") && value)    options.samples = atoi(argv[++i]);
+        else if (!strcmp(arg, "--sample-ms") && value)  options.sampleTime = atof(argv[++i]) / 1000.0;
+        else if (!strcmp(arg, "--warmup-ms") && value)  options.warmupTime = atof(argv[++i]) / 1000.0;
+        else if (!strcmp(arg, "--csv") && value)        csvName = argv[++i];
+        else
+        {
+            printf("Usage: bench [--data <dir>] [--filter <text>] [--samples <n>] [--sample-ms <n>] [--warmup-ms <n>]\n"
+                   "             [--csv <file>]\n");
+            return 1;
+        }
+    }
+    if (options.samples < 1) options.samples = 1;
+
+    fixtureLoad(dataDir);
+    if (!gFixture.numTargets && !gFixture.numScreens)
+    {
+        printf("No data found in %s\n", dataDir);
+        return 1;
+    }
+
+    if (csvName)
+    {
+        options.csv = fopen(csvName, "wt");
+        if (options.csv)
+        {
+            fprintf(options.csv, "group,variant,input,unit,ops_per_sample,min_ns,median_ns,mean_ns,stddev_ns,"
+                "ops_per_sec,bytes_per_sec\n");
+        }
+    }
+
+    printf("%-16s %-14s %-14s %12s %12s %12s %8s %14s\n",
+        "function", "variant", "input", "min ns", "median ns", "mean ns", "spread", "throughput");
+
+    for (int b = 0; b < numBenches; ++b)
+    {
+        const Bench* bench = &gBenches[b];
+        int numInputs = bench->input == INPUT_SCREENS ? gFixture.numScreens : gFixture.numTargets;
+
+        if (options.filter && !strstr(bench->group, options.filter) && !strstr(bench->variant, options.filter))
+        {
+            continue;
+        }
+
+        for (int input = 0; input < numInputs; ++input)
+        {
+            const char* inputName = bench->input == INPUT_SCREENS ?
+                gFixture.screenNames[input] : gFixture.targets[input].name;
+            int first = b;
+            while (first > 0 && !strcmp(gBenches[first - 1].group, bench->group)) --first;
+
+            // Later variants are compared with the first one in their group, on the same input
+            medians[b][input] = benchMeasure(bench, input, inputName, &options, first < b ? medians[first][input] : 0);
+        }
+    }
+
+    if (options.csv) fclose(options.csv);
+
+    return 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
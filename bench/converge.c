@@ -0,0 +1,572 @@
+//----------------------------------------------------------------------------------------------------------------------
+// zximg convergence benchmark
+// Runs every engine on a fixed corpus with fixed seeds and records how the best error falls against wall-clock time
+// and evaluations.  The figure of merit is the time to reach a fraction of the first generation's error: a faster
+// generate() that converges worse shows up here even though it wins on generations per second.  Results can be
+// saved as a baseline and later runs checked against it, failing when any time-to-target regresses too far.
+//----------------------------------------------------------------------------------------------------------------------
+
+#include "zximg.h"
+
+#include <math.h>
+
+#define MAX_TARGETS     16
+#define MAX_SEEDS       32
+#define MAX_BASELINE    256
+#define MAX_LEVELS      8
+#define RUN_ARENA_SIZE  (64 << 20)
+
+//----------------------------------------------------------------------------------------------------------------------
+// Engines
+// Anything that can turn a target into a screen one step at a time.  New engines register here.
+//----------------------------------------------------------------------------------------------------------------------
+
+typedef struct
+{
+    const char*     name;
+    void            (*init)(Converter* cv, Image* target, u64 seed);
+    ConverterEvent  (*step)(Converter* cv);
+}
+Engine;
+
+// The GA with half of its first population seeded, taking turns between every method
+void seededInit(Converter* cv, Image* target, u64 seed)
+{
+    Seeding seeding = { 0.5f, 0, 1 };
+    converterInit(cv, target, seed);
+    converterSeed(cv, &seeding);
+}
+
+// The GA evolving attributes only
+void hybridInit(Converter* cv, Image* target, u64 seed)
+{
+    converterInit(cv, target, seed);
+    converterHybrid(cv);
+}
+
+// The GA scoring through a blur of a pixel or so.  Its errors are in other units, so only its times compare.
+void blurInit(Converter* cv, Image* target, u64 seed)
+{
+    converterInit(cv, target, seed);
+    converterBlur(cv, 1.0f);
+}
+
+// The GA evolving a ULAplus palette with every scrim, from the standard colours
+void ulaplusInit(Converter* cv, Image* target, u64 seed)
+{
+    converterInit(cv, target, seed);
+    converterUlaplus(cv, YES);
+}
+
+// The GA evolving hi-colour attributes, half of its first population seeded from standard screens
+void hicolourInit(Converter* cv, Image* target, u64 seed)
+{
+    seededInit(cv, target, seed);
+    converterHicolour(cv, 1, YES);
+}
+
+// The same with an attribute for every 8x4 block, for a multicolour player
+void multicolourInit(Converter* cv, Image* target, u64 seed)
+{
+    seededInit(cv, target, seed);
+    converterHicolour(cv, 4, YES);
+}
+
+// The GA evolving Gigascreen pairs, half of its first population seeded with a screen shown twice
+void gigascreenInit(Converter* cv, Image* target, u64 seed)
+{
+    seededInit(cv, target, seed);
+    converterGigascreen(cv, YES);
+}
+
+// A beam search 8 wide through the same blur, then the GA carrying on from its screen.  The search is the first step,
+// so its time counts.
+ConverterEvent beamStep(Converter* cv)
+{
+    if (!cv->generation) converterBeam(cv, 8, 1);
+    return converterStep(cv);
+}
+
+Engine gEngines[] =
+{
+    { "ga",          &converterInit,     &converterStep },
+    { "ga-seeded",   &seededInit,        &converterStep },
+    { "ga-hybrid",   &hybridInit,        &converterStep },
+    { "ga-blur",     &blurInit,          &converterStep },
+    { "ga-ulaplus",  &ulaplusInit,       &converterStep },
+    { "ga-hicolour", &hicolourInit,      &converterStep },
+    { "ga-8x4",      &multicolourInit,   &converterStep },
+    { "ga-giga",     &gigascreenInit,    &converterStep },
+    { "beam",        &blurInit,          &beamStep },
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+// Corpus
+// The photos in data/ plus the real screens, rendered back into images.  The latter have a known optimum of 0, which
+// makes them the ground truth for the round-trip mode.
+//----------------------------------------------------------------------------------------------------------------------
+
+typedef struct
+{
+    char        name[32];
+    Image*      image;
+    bool        known;          // Rendered from a real screen, so error 0 is reachable and cells can be checked
+}
+Target;
+
+Target gTargets[MAX_TARGETS];
+int gNumTargets;
+
+void corpusLoad(const char* dataDir, bool screensOnly)
+{
+    static const char* images[] = { "img1.jpg", "img2.jpg", "img3.jpg" };
+    static const char* screens[] = { "Wizball.scr", "SabreWulf.scr" };
+    char path[MAX_PATH];
+
+    for (int i = 0; !screensOnly && i < sizeof(images) / sizeof(images[0]); ++i)
+    {
+        Target* t = &gTargets[gNumTargets];
+        snprintf(path, MAX_PATH, "%s\\%s", dataDir, images[i]);
+        t->image = imageCreate(256, 192);
+        if (targetLoad(t->image, path))
+        {
+            printf("Skipping %s\n", path);
+            continue;
+        }
+        strncpy(t->name, images[i], sizeof(t->name) - 1);
+        ++gNumTargets;
+    }
+
+    for (int i = 0; i < sizeof(screens) / sizeof(screens[0]); ++i)
+    {
+        Target* t = &gTargets[gNumTargets];
+        Data d;
+        snprintf(path, MAX_PATH, "%s\\%s", dataDir, screens[i]);
+        d = dataLoad(path);
+        if (d.buffer && d.size >= 6912)
+        {
+            // Rendered exactly as checkError() renders scrims, so the screen itself scores 0
+            t->image = imageZxConvert(imageCreate(256, 192), d.buffer);
+            strncpy(t->name, screens[i], sizeof(t->name) - 1);
+            t->known = YES;
+            ++gNumTargets;
+        }
+        else
+        {
+            printf("Skipping %s\n", path);
+        }
+        dataUnload(d);
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Runs
+//----------------------------------------------------------------------------------------------------------------------
+
+typedef struct
+{
+    i64     timeMs;                 // Budget per run
+    i64     generations;            // ...or 0 for none
+    f64     levels[MAX_LEVELS];     // Targets as fractions of the first generation's best error
+    int     numLevels;
+    int     numSeeds;
+    FILE*   csv;
+}
+RunOptions;
+
+typedef struct
+{
+    f64     initialError;
+    f64     finalError;
+    f64     timeTo[MAX_LEVELS];     // Seconds to reach each level, or -1 if it wasn't reached
+    i64     evalsTo[MAX_LEVELS];
+    i64     evaluations;
+    int     cellsRecovered;         // Known targets only: cells of the best scrim that render exactly as the screen
+    i64     cellFirst[768];         // ...and the evaluation count at which each cell first did, or -1
+    bool    cellFinal[768];         // ...and whether it still did at the end
+}
+RunResult;
+
+// Compares the rendered best scrim with the target one 8x8 cell at a time.  Different bytes can render the same
+// pixels (ink and paper swapped, or equal), so the pixels are compared rather than the screen bytes.
+int cellsCompare(const Image* img, const Image* target, RunResult* result, i64 evaluations)
+{
+    int count = 0;
+
+    for (int cell = 0; cell < 768; ++cell)
+    {
+        const u32* a = &img->pixels[(cell >> 5) * 8 * 256 + (cell & 31) * 8];
+        const u32* b = &target->pixels[(cell >> 5) * 8 * 256 + (cell & 31) * 8];
+        bool same = YES;
+
+        for (int y = 0; same && y < 8; ++y, a += 256, b += 256)
+        {
+            same = !memcmp(a, b, 8 * sizeof(u32));
+        }
+        if (same && result->cellFirst[cell] < 0) result->cellFirst[cell] = evaluations;
+        result->cellFinal[cell] = same;
+        count += same;
+    }
+
+    return count;
+}
+
+void curveWrite(const RunOptions* options, const Engine* engine, const Target* target, u64 seed, f64 time,
+    Converter* cv, int cells)
+{
+    if (options->csv)
+    {
+        fprintf(options->csv, "%s,%s,%llu,%.3f,%lld,%lld,%lld,%d\n", engine->name, target->name, seed, time * 1000.0,
+            cv->evaluations, cv->generation, cv->bestError, cells);
+    }
+}
+
+void runOne(Arena* arena, const Engine* engine, const Target* target, u64 seed, const RunOptions* options,
+    RunResult* result)
+{
+    Converter cv;
+    Image* render;
+    i64 targetErrors[MAX_LEVELS];
+    i64 lastError = -1;
+    int cells = -1;
+    f64 start, elapsed;
+
+    memset(result, 0, sizeof(RunResult));
+    for (int l = 0; l < MAX_LEVELS; ++l) result->timeTo[l] = -1;
+    for (int c = 0; c < 768; ++c) result->cellFirst[c] = -1;
+
+    arenaReset(arena);
+    arenaUse(arena);
+    render = imageCreate(256, 192);
+    engine->init(&cv, target->image, seed);
+
+    start = timeNow();
+    do
+    {
+        engine->step(&cv);
+        elapsed = timeNow() - start;
+
+        if (cv.generation == 1)
+        {
+            result->initialError = (f64)cv.bestError;
+            for (int l = 0; l < options->numLevels; ++l)
+            {
+                targetErrors[l] = (i64)((f64)cv.bestError * options->levels[l]);
+            }
+        }
+        if (cv.bestError != lastError)
+        {
+            // Only on improvements, which keeps the cell check off the timed path most of the time
+            if (target->known)
+            {
+                Image* shown = imageScreenConvert(render, cv.best, converterScreenSize(&cv));
+                cells = cellsCompare(shown, target->image, result, cv.evaluations);
+            }
+            curveWrite(options, engine, target, seed, elapsed, &cv, cells);
+            lastError = cv.bestError;
+        }
+        for (int l = 0; l < options->numLevels; ++l)
+        {
+            if (result->timeTo[l] < 0 && cv.bestError <= targetErrors[l])
+            {
+                result->timeTo[l] = elapsed;
+                result->evalsTo[l] = cv.evaluations;
+            }
+        }
+    }
+    while ((!options->timeMs || elapsed * 1000.0 < (f64)options->timeMs) &&
+           (!options->generations || cv.generation < options->generations) &&
+           cv.bestError > 0);
+
+    curveWrite(options, engine, target, seed, elapsed, &cv, cells);
+    result->finalError = (f64)cv.bestError;
+    result->evaluations = cv.evaluations;
+    result->cellsRecovered = cells;
+    arenaUse(0);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Baselines
+// One line per engine, target and level: <engine>,<target>,<fraction>,<median ms>,<median evaluations>.  Levels that
+// weren't reached are recorded as -1.
+//----------------------------------------------------------------------------------------------------------------------
+
+typedef struct
+{
+    char    engine[32];
+    char    target[32];
+    f64     fraction;
+    f64     ms;
+    f64     evals;
+}
+BaselineEntry;
+
+BaselineEntry gBaseline[MAX_BASELINE];
+int gNumBaseline;
+
+bool baselineLoad(const char* fileName)
+{
+    FILE* f = fopen(fileName, "rt");
+    char line[256];
+
+    if (!f) return NO;
+    while (fgets(line, sizeof(line), f) && gNumBaseline < MAX_BASELINE)
+    {
+        BaselineEntry* e = &gBaseline[gNumBaseline];
+        if (line[0] == '#') continue;
+        if (sscanf(line, "%31[^,],%31[^,],%lf,%lf,%lf", e->engine, e->target, &e->fraction, &e->ms, &e->evals) == 5)
+        {
+            ++gNumBaseline;
+        }
+    }
+    fclose(f);
+    return YES;
+}
+
+const BaselineEntry* baselineFind(const char* engine, const char* target, f64 fraction)
+{
+    for (int i = 0; i < gNumBaseline; ++i)
+    {
+        const BaselineEntry* e = &gBaseline[i];
+        if (!strcmp(e->engine, engine) && !strcmp(e->target, target) && fabs(e->fraction - fraction) < 1e-9) return e;
+    }
+    return 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Main
+//----------------------------------------------------------------------------------------------------------------------
+
+// Unreached levels sort last
+int compareTime(const void* a, const void* b)
+{
+    f64 x = *(const f64 *)a;
+    f64 y = *(const f64 *)b;
+    if (x < 0) x = 1e300;
+    if (y < 0) y = 1e300;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+f64 median(f64* values, int count)
+{
+    qsort(values, count, sizeof(f64), &compareTime);
+    return values[count / 2];
+}
+
+// Parses a comma separated list of percentages
+int levelsParse(f64* levels, const char* text)
+{
+    int count = 0;
+    while (*text && count < MAX_LEVELS)
+    {
+        char* end;
+        levels[count++] = strtod(text, &end) / 100.0;
+        if (end == text) return 0;
+        text = (*end == ',') ? end + 1 : end;
+    }
+    return count;
+}
+
+// Writes, for every cell of a known target, how many seeds ended with it recovered and the median evaluations at
+// which it first was
+void cellsWrite(FILE* f, const Engine* engine, const Target* target, RunResult* results, int numSeeds)
+{
+    for (int cell = 0; cell < 768; ++cell)
+    {
+        f64 first[MAX_SEEDS];
+        int recovered = 0;
+        for (int s = 0; s < numSeeds; ++s)
+        {
+            first[s] = (f64)results[s].cellFirst[cell];
+            recovered += results[s].cellFinal[cell];
+        }
+        fprintf(f, "%s,%s,%d,%d,%.3f,%.0f\n", engine->name, target->name, cell & 31, cell >> 5,
+            (f64)recovered / numSeeds, median(first, numSeeds));
+    }
+}
+
+// Usage:
+//
+//      converge [--data <dir>] [--engine <name>] [--seeds <n>] [--time <ms>] [--generations <n>]
+//               [--target <pct>[,<pct>...]] [--roundtrip] [--csv <file>] [--cells <file>]
+//               [--baseline <file>] [--tolerance <pct>] [--save-baseline <file>]
+//
+// --roundtrip only uses the screens, whose optimum is known, and by default reports how long it takes to get to
+// 50%, 10% and 1% of the initial error and to the exact screen.
+//
+int main(int argc, char** argv)
+{
+    static RunResult results[MAX_SEEDS];
+    RunOptions options = { 10000, 0, { 0.85 }, 1, 3, 0 };
+    const char* dataDir = ".";
+    const char* engineName = 0;
+    const char* csvName = 0;
+    const char* cellsName = 0;
+    const char* baselineName = 0;
+    const char* saveName = 0;
+    bool roundTrip = NO;
+    bool levelsGiven = NO;
+    f64 tolerance = 10.0;
+    FILE* save = 0;
+    FILE* cellsFile = 0;
+    Arena arena;
+    int numRegressions = 0;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+        const char* value = (i + 1 < argc) ? argv[i + 1] : 0;
+
+        if (!strcmp(arg, "--data") && value)                dataDir = argv[++i];
+        else if (!strcmp(arg, "--engine") && value)         engineName = argv[++i];
+        else if (!strcmp(arg, "--seeds") && value)          options.numSeeds = atoi(argv[++i]);
+        else if (!strcmp(arg, "--time") && value)           options.timeMs = _atoi64(argv[++i]);
+        else if (!strcmp(arg, "--generations") && value)    options.generations = _atoi64(argv[++i]);
+        else if (!strcmp(arg, "--roundtrip"))               roundTrip = YES;
+        else if (!strcmp(arg, "--csv") && value)            csvName = argv[++i];
+        else if (!strcmp(arg, "--cells") && value)          cellsName = argv[++i];
+        else if (!strcmp(arg, "--baseline") && value)       baselineName = argv[++i];
+        else if (!strcmp(arg, "--tolerance") && value)      tolerance = atof(argv[++i]);
+        else if (!strcmp(arg, "--save-baseline") && value)  saveName = argv[++i];
+        else if (!strcmp(arg, "--target") && value && (options.numLevels = levelsParse(options.levels, argv[++i])))
+        {
+            levelsGiven = YES;
+        }
+        else
+        {
+            printf("Usage: converge [--data <dir>] [--engine <name>] [--seeds <n>] [--time <ms>] [--generations <n>]\n"
+                   "                [--target <pct>[,<pct>...]] [--roundtrip] [--csv <file>] [--cells <file>]\n"
+                   "                [--baseline <file>] [--tolerance <pct>] [--save-baseline <file>]\n");
+            return 1;
+        }
+    }
+    if (options.numSeeds < 1) options.numSeeds = 1;
+    if (options.numSeeds > MAX_SEEDS) options.numSeeds = MAX_SEEDS;
+    if (!options.timeMs && !options.generations)
+    {
+        printf("Need a --time or --generations budget\n");
+        return 1;
+    }
+    if (roundTrip && !levelsGiven)
+    {
+        options.numLevels = levelsParse(options.levels, "50,10,1,0");
+    }
+
+    corpusLoad(dataDir, roundTrip);
+    if (!gNumTargets)
+    {
+        printf("No data found in %s\n", dataDir);
+        return 1;
+    }
+    if (baselineName && !baselineLoad(baselineName))
+    {
+        printf("Cannot read baseline %s\n", baselineName);
+        return 1;
+    }
+    if (csvName)
+    {
+        options.csv = fopen(csvName, "wt");
+        if (options.csv) fprintf(options.csv, "engine,target,seed,time_ms,evaluations,generation,best_error,cells\n");
+    }
+    if (cellsName)
+    {
+        cellsFile = fopen(cellsName, "wt");
+        if (cellsFile) fprintf(cellsFile, "engine,target,cell_x,cell_y,recovered,median_first_evaluation\n");
+    }
+    if (saveName)
+    {
+        save = fopen(saveName, "wt");
+        if (save) fprintf(save, "# engine,target,fraction,median_ms,median_evaluations\n");
+    }
+
+    arenaInit(&arena, RUN_ARENA_SIZE);
+
+    printf("%-8s %-16s %6s %8s %14s %14s %12s %12s %12s %7s\n",
+        "engine", "target", "level", "reached", "initial", "final", "ms", "baseline", "evals", "cells");
+
+    for (int e = 0; e < sizeof(gEngines) / sizeof(gEngines[0]); ++e)
+    {
+        const Engine* engine = &gEngines[e];
+        if (engineName && strcmp(engine->name, engineName)) continue;
+
+        for (int t = 0; t < gNumTargets; ++t)
+        {
+            const Target* target = &gTargets[t];
+            f64 initial[MAX_SEEDS], final[MAX_SEEDS], cells[MAX_SEEDS];
+            f64 medianInitial, medianFinal, medianCells;
+
+            for (int s = 0; s < options.numSeeds; ++s)
+            {
+                runOne(&arena, engine, target, (u64)(s + 1), &options, &results[s]);
+                initial[s] = results[s].initialError;
+                final[s] = results[s].finalError;
+                cells[s] = (f64)results[s].cellsRecovered;
+            }
+            medianInitial = median(initial, options.numSeeds);
+            medianFinal = median(final, options.numSeeds);
+            medianCells = median(cells, options.numSeeds);
+
+            for (int l = 0; l < options.numLevels; ++l)
+            {
+                f64 times[MAX_SEEDS], evals[MAX_SEEDS];
+                const BaselineEntry* base;
+                bool regressed = NO;
+                int reached = 0;
+                f64 ms, ev;
+
+                for (int s = 0; s < options.numSeeds; ++s)
+                {
+                    bool hit = results[s].timeTo[l] >= 0;
+                    times[s] = hit ? results[s].timeTo[l] * 1000.0 : -1;
+                    evals[s] = hit ? (f64)results[s].evalsTo[l] : -1;
+                    reached += hit;
+                }
+                ms = median(times, options.numSeeds);
+                ev = median(evals, options.numSeeds);
+
+                printf("%-8s %-16s %5g%% %5d/%-2d %14.0f %14.0f ", engine->name, target->name,
+                    options.levels[l] * 100.0, reached, options.numSeeds, medianInitial, medianFinal);
+                if (ms >= 0) printf("%12.1f ", ms); else printf("%12s ", "-");
+
+                base = baselineFind(engine->name, target->name, options.levels[l]);
+                if (base)
+                {
+                    // Reaching the level at all is worth more than any speed; otherwise allow the tolerance
+                    regressed = (ms < 0 && base->ms >= 0) ||
+                                (ms >= 0 && base->ms >= 0 && ms > base->ms * (1.0 + tolerance / 100.0));
+                    if (regressed) ++numRegressions;
+                }
+                if (base && base->ms >= 0) printf("%12.1f ", base->ms); else printf("%12s ", "-");
+                if (ev >= 0) printf("%12.0f ", ev); else printf("%12s ", "-");
+                if (target->known) printf("%6.1f%%", medianCells * 100.0 / 768.0); else printf("%7s", "-");
+                printf("%s\n", regressed ? "  REGRESSED" : "");
+
+                if (save)
+                {
+                    fprintf(save, "%s,%s,%g,%.3f,%.0f\n", engine->name, target->name, options.levels[l], ms, ev);
+                }
+            }
+
+            if (cellsFile && target->known)
+            {
+                cellsWrite(cellsFile, engine, target, results, options.numSeeds);
+            }
+        }
+    }
+
+    arenaDone(&arena);
+    if (options.csv) fclose(options.csv);
+    if (cellsFile) fclose(cellsFile);
+    if (save) fclose(save);
+
+    if (numRegressions)
+    {
+        printf("%d regression%s beyond %.1f%%\n", numRegressions, numRegressions == 1 ? "" : "s", tolerance);
+        return 2;
+    }
+
+    return 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
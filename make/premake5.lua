@@ -2,6 +2,16 @@
 
 rootdir = path.join(path.getdirectory(_SCRIPT), "..")
 
+newoption {
+	trigger = "stats",
+	description = "Build with per-phase timers and counters (ZXIMG_STATS)",
+}
+
+newoption {
+	trigger = "trace",
+	description = "Build with Chrome trace zones (ZXIMG_TRACE)",
+}
+
 filter { "platforms:Win64" }
 	system "Windows"
 	architecture "x64"
@@ -35,6 +45,12 @@ solution "zximg"
 		defines { "NDEBUG" }
 		optimize "full"
 
+	filter "options:stats"
+		defines { "ZXIMG_STATS" }
+
+	filter "options:trace"
+		defines { "ZXIMG_TRACE" }
+
 	-- Projects
 	project "zximg"
 		targetdir "../_bin/%{cfg.platform}/%{cfg.buildcfg}/%{prj.name}"
@@ -62,3 +78,84 @@ solution "zximg"
 				"opengl32",
 				"glu32"
 			}
+
+	-- Bulk .scr -> .png/.ppm decoder
+	project "scr2img"
+		targetdir "../_bin/%{cfg.platform}/%{cfg.buildcfg}/%{prj.name}"
+		objdir "../_obj/%{cfg.platform}/%{cfg.buildcfg}/%{prj.name}"
+		kind "ConsoleApp"
+		files {
+			"../src/**.h",
+			"../src/**.c",
+			"../tools/scr2img.c",
+		}
+		removefiles {
+			"../src/main.c",
+		}
+		includedirs {
+			"../src",
+		}
+
+		configuration "Win*"
+			defines {
+				"WIN32",
+			}
+			flags {
+				"StaticRuntime",
+				"NoMinimalRebuild",
+				"NoIncrementalLink",
+			}
+
+	-- Micro-benchmarks of the hot functions
+	project "bench"
+		targetdir "../_bin/%{cfg.platform}/%{cfg.buildcfg}/%{prj.name}"
+		objdir "../_obj/%{cfg.platform}/%{cfg.buildcfg}/%{prj.name}"
+		kind "ConsoleApp"
+		files {
+			"../src/**.h",
+			"../src/**.c",
+			"../bench/bench.c",
+		}
+		removefiles {
+			"../src/main.c",
+		}
+		includedirs {
+			"../src",
+		}
+
+		configuration "Win*"
+			defines {
+				"WIN32",
+			}
+			flags {
+				"StaticRuntime",
+				"NoMinimalRebuild",
+				"NoIncrementalLink",
+			}
+
+	-- Error against time for every engine, with a baseline check
+	project "converge"
+		targetdir "../_bin/%{cfg.platform}/%{cfg.buildcfg}/%{prj.name}"
+		objdir "../_obj/%{cfg.platform}/%{cfg.buildcfg}/%{prj.name}"
+		kind "ConsoleApp"
+		files {
+			"../src/**.h",
+			"../src/**.c",
+			"../bench/converge.c",
+		}
+		removefiles {
+			"../src/main.c",
+		}
+		includedirs {
+			"../src",
+		}
+
+		configuration "Win*"
+			defines {
+				"WIN32",
+			}
+			flags {
+				"StaticRuntime",
+				"NoMinimalRebuild",
+				"NoIncrementalLink",
+			}
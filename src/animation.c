@@ -0,0 +1,284 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Animation
+// An animated GIF becomes a sequence of screens, one per frame.  Most frames of an animation repeat most of the one
+// before, so starting each from random scrims would spend nearly all the effort finding the same cells again.
+// Instead a frame carries on from the previous frame's population: cells whose target pixels haven't changed keep
+// the previous frame's screen and are frozen, and a genome only holds the cells that have, 9 bytes each (the 8 bitmap
+// bytes, then the attribute).  Breeding, mutation and scoring then all cost in proportion to the changed cells, and
+// a child only re-scores the cells that differ from its parent.  The frozen cells' error is worked out once.
+//----------------------------------------------------------------------------------------------------------------------
+
+#include "zximg.h"
+
+#include <emmintrin.h>
+
+#define ANIMATION_ARENA_SIZE    (64 << 20)
+
+// Copies a cell's 8 bitmap bytes and its attribute out of a screen
+void animationPack(const u8* scr, int cell, u8* bytes)
+{
+    int offset = scrimOffset((cell % 32) * 8, (cell / 32) * 8);
+    for (int line = 0; line < 8; ++line)
+    {
+        bytes[line] = scr[offset + line * 256];
+    }
+    bytes[8] = scr[6144 + cell];
+}
+
+// ...and back into one
+void animationUnpack(const u8* bytes, int cell, u8* scr)
+{
+    int offset = scrimOffset((cell % 32) * 8, (cell / 32) * 8);
+    for (int line = 0; line < 8; ++line)
+    {
+        scr[offset + line * 256] = bytes[line];
+    }
+    scr[6144 + cell] = bytes[8];
+}
+
+// checkError() of one cell, from its 9 genome bytes
+i64 animationCellError(const Image* target, const u8* bytes, int cell)
+{
+    const __m128i bitsLeft = _mm_setr_epi32(0x80, 0x40, 0x20, 0x10);
+    const __m128i bitsRight = _mm_setr_epi32(0x08, 0x04, 0x02, 0x01);
+    const __m128i zero = _mm_setzero_si128();
+    const u32* pixels = &target->pixels[(cell / 32) * 8 * 256 + (cell % 32) * 8];
+    u32 pap = attrPaper(bytes[8]);
+    __m128i paper = _mm_set1_epi32(pap);
+    __m128i diff = _mm_set1_epi32(attrInk(bytes[8]) ^ pap);
+    __m128i sum = zero;
+    i64 total[2];
+
+    for (int line = 0; line < 8; ++line, pixels += 256)
+    {
+        __m128i b = _mm_set1_epi32(bytes[line]);
+        __m128i l = _mm_cmpeq_epi32(_mm_and_si128(b, bitsLeft), bitsLeft);
+        __m128i r = _mm_cmpeq_epi32(_mm_and_si128(b, bitsRight), bitsRight);
+        l = _mm_sub_epi32(_mm_xor_si128(paper, _mm_and_si128(l, diff)), _mm_loadu_si128((const __m128i *)pixels));
+        r = _mm_sub_epi32(_mm_xor_si128(paper, _mm_and_si128(r, diff)), _mm_loadu_si128((const __m128i *)(pixels + 4)));
+
+        // abs() as checkError() takes it, then widened to 64 bits by unpacking with zero
+        l = _mm_sub_epi32(_mm_xor_si128(l, _mm_srai_epi32(l, 31)), _mm_srai_epi32(l, 31));
+        r = _mm_sub_epi32(_mm_xor_si128(r, _mm_srai_epi32(r, 31)), _mm_srai_epi32(r, 31));
+        sum = _mm_add_epi64(sum, _mm_add_epi64(_mm_unpacklo_epi32(l, zero), _mm_unpackhi_epi32(l, zero)));
+        sum = _mm_add_epi64(sum, _mm_add_epi64(_mm_unpacklo_epi32(r, zero), _mm_unpackhi_epi32(r, zero)));
+    }
+    _mm_storeu_si128((__m128i *)total, sum);
+
+    return total[0] + total[1];
+}
+
+// Switches a converter that has just been initialised for the next frame to carry on from prev, the converter of the
+// frame before.  Cells whose target pixels are unchanged are frozen at prev's best screen, and every scrim starts
+// with the remaining cells of the matching scrim of prev's population.  With nothing changed, the converter already
+// has its best screen and needs no steps.  Memory comes from the current arena.
+void converterAnimate(Converter* cv, const Converter* prev)
+{
+    u8 scr[6912];
+
+    TRACE_BEGIN(animate);
+    cv->still = (u8 *)memAlloc(6912);
+    cv->liveCells = (i16 *)memAlloc(768 * sizeof(i16));
+    cv->numLive = 0;
+    cv->stillError = 0;
+    cv->current->cellErrors = (i64 *)populationArray(768 * sizeof(i64));
+    cv->future->cellErrors = (i64 *)populationArray(768 * sizeof(i64));
+    memcpy(cv->still, prev->best, 6912);
+    for (int cell = 0; cell < 768; ++cell)
+    {
+        const u32* a = &cv->target->pixels[(cell / 32) * 8 * 256 + (cell % 32) * 8];
+        const u32* b = &prev->target->pixels[(cell / 32) * 8 * 256 + (cell % 32) * 8];
+        bool changed = NO;
+
+        for (int line = 0; !changed && line < 8; ++line)
+        {
+            changed = MAKE_BOOL(memcmp(a + line * 256, b + line * 256, 8 * sizeof(u32)));
+        }
+        if (changed)
+        {
+            cv->liveCells[cv->numLive++] = (i16)cell;
+        }
+        else
+        {
+            u8 bytes[9];
+            animationPack(cv->still, cell, bytes);
+            cv->stillError += animationCellError(cv->target, bytes, cell);
+        }
+    }
+
+    for (int i = 0; i < POPULATION_SIZE; ++i)
+    {
+        const u8* genome = &prev->current->genomes[i * 6912];
+        u8* next = &cv->current->genomes[i * 6912];
+
+        if (prev->liveCells)
+        {
+            memcpy(scr, prev->still, 6912);
+            for (int k = 0; k < prev->numLive; ++k)
+            {
+                animationUnpack(genome + k * 9, prev->liveCells[k], scr);
+            }
+            genome = scr;
+        }
+        for (int k = 0; k < cv->numLive; ++k)
+        {
+            animationPack(genome, cv->liveCells[k], next + k * 9);
+        }
+        cv->current->parents[i] = -1;
+    }
+
+    memcpy(cv->best, cv->still, 6912);
+    if (!cv->numLive) cv->bestError = cv->stillError;
+    TRACE_END(animate);
+}
+
+// Scores scrim index of pop, re-scoring only the cells that changed since its parent in parents, the population it
+// was bred from.  Scrims without a parent are scored in full.
+i64 animationError(const Converter* cv, Population* pop, int index, const Population* parents)
+{
+    const u8* genome = &pop->genomes[index * 6912];
+    i64* errors = &pop->cellErrors[index * 768];
+    int parent = pop->parents[index];
+    const u8* from = parent < 0 ? 0 : &parents->genomes[parent * 6912];
+    const i64* fromErrors = parent < 0 ? 0 : &parents->cellErrors[parent * 768];
+    i64 total = cv->stillError;
+
+    for (int k = 0; k < cv->numLive; ++k, genome += 9)
+    {
+        if (from && !memcmp(genome, from + k * 9, 9))
+        {
+            errors[k] = fromErrors[k];
+        }
+        else
+        {
+            errors[k] = animationCellError(cv->target, genome, cv->liveCells[k]);
+        }
+        total += errors[k];
+    }
+
+    return total;
+}
+
+// Turns a genome copied to the start of scr into a whole screen: the frozen cells, with the changed ones over them
+void animationScreen(const Converter* cv, u8* scr)
+{
+    u8 genome[6912];
+
+    memcpy(genome, scr, cv->numLive * 9);
+    memcpy(scr, cv->still, 6912);
+    for (int k = 0; k < cv->numLive; ++k)
+    {
+        animationUnpack(genome + k * 9, cv->liveCells[k], scr);
+    }
+}
+
+// Where a frame goes: the output name, or the input's with the format's extension, with the frame number before the
+// extension
+void animationName(char* out, const char* fileName, const BatchOptions* options, int frame)
+{
+    const char* name = options->outDir ? options->outDir : fileName;
+    const char* ext = strrchr(name, '.');
+
+    for (const char* s = name; ext && *s; ++s)
+    {
+        if (s > ext && (*s == '\\' || *s == '/')) ext = 0;
+    }
+    snprintf(out, MAX_PATH, "%.*s%04d%s", ext ? (int)(ext - name) : (int)strlen(name), name, frame,
+        options->outDir && ext ? ext : gFormatExtensions[options->format]);
+}
+
+// Converts every frame of an animated GIF into a screen of its own.  The first frame is converted as a still, seeded
+// as options say; the rest carry on from the frame before, with the time budget cut to their share of changed cells.
+// Two arenas take turns, so the previous frame's converter is still there while the next one starts.  Returns the
+// number of frames that couldn't be written, or 1 if the file can't be read.
+int animationRun(const char* fileName, const BatchOptions* options)
+{
+    FrameReader reader;
+    Arena arenas[2];
+    Converter converters[2];
+    Arena* prevArena = arenaUse(0);
+    const char* error = framesOpen(&reader, fileName);
+    f64 start = timeNow();
+    i64 generations = 0;
+    int numLive = 0;
+    int numFailed = 0;
+
+    if (error)
+    {
+        printf("%s: %s\n", fileName, error);
+        framesClose(&reader);
+        arenaUse(prevArena);
+        return 1;
+    }
+    arenaInit(&arenas[0], ANIMATION_ARENA_SIZE);
+    arenaInit(&arenas[1], ANIMATION_ARENA_SIZE);
+
+    for (;;)
+    {
+        int frame = reader.index;
+        Converter* cv = &converters[frame & 1];
+        Budget budget = options->budget;
+        char outName[MAX_PATH];
+        Image* target;
+        f64 frameStart = timeNow();
+        f64 deadline;
+        f64 stepTime = 0;
+
+        arenaReset(&arenas[frame & 1]);
+        arenaUse(&arenas[frame & 1]);
+        target = imageCreate(256, 192);
+        if (!framesNext(&reader, target)) break;
+
+        converterInit(cv, target, options->seed + frame);
+        cv->stagnation = budget.stagnation;
+        if (!frame)
+        {
+            Seeding seeding = options->seeding;
+            seeding.numThreads = options->numThreads;
+            converterSeed(cv, &seeding);
+        }
+        else
+        {
+            converterAnimate(cv, &converters[(frame - 1) & 1]);
+            if (budget.timeMs) budget.timeMs = (budget.timeMs * cv->numLive + 767) / 768;
+        }
+
+        // A frame stops when another generation would overrun its share of the time, as a video frame does
+        deadline = budgetDeadline(&budget, frameStart, 0);
+        while ((!frame || cv->numLive) && budgetCheck(&budget, cv, deadline, stepTime) == STOP_NONE)
+        {
+            f64 t = timeNow();
+            ConverterEvent event = converterStep(cv);
+            stepTime = budgetStepTime(stepTime, timeNow() - t);
+            converterLog(options->log, fileName, cv, event, timeNow() - start);
+        }
+        generations += cv->generation;
+        numLive += frame ? cv->numLive : 768;
+
+        animationName(outName, fileName, options, frame);
+        if (!exportScreen(outName, cv->best, 6912))
+        {
+            printf("%s: frame %d: FAILED (cannot write %s)\n", fileName, frame, outName);
+            ++numFailed;
+        }
+        else
+        {
+            printf("%s: frame %d -> %s: %d cells changed, error %lld after %lld generations in %.2fs\n", fileName,
+                frame, outName, frame ? cv->numLive : 768, cv->bestError, cv->generation, timeNow() - frameStart);
+        }
+    }
+
+    printf("%d frames, %d failed, %.2fs: %.1f cells re-optimised per frame, %.1f generations/s\n", reader.index,
+        numFailed, timeNow() - start, reader.index ? (f64)numLive / reader.index : 0.0,
+        (f64)generations / (timeNow() - start));
+
+    arenaUse(prevArena);
+    arenaDone(&arenas[0]);
+    arenaDone(&arenas[1]);
+    framesClose(&reader);
+
+    return numFailed;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,532 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Batch conversion
+// Every image goes through decode -> target preparation -> optimisation -> SCR write.  Each stage runs as a task on
+// the thread pool and queues the next one when it finishes, so the stages of different images overlap.  The number
+// of images in flight is bounded by the job slots, and each slot owns an arena that is reset between images.
+//----------------------------------------------------------------------------------------------------------------------
+
+#include "zximg.h"
+
+#include <stb_image.h>
+
+#define BATCH_ARENA_SIZE    (256 << 20)
+
+typedef struct
+{
+    char    input[MAX_PATH];
+    char    output[MAX_PATH];
+    Budget  budget;
+}
+BatchItem;
+
+typedef enum
+{
+    BATCH_DECODE,
+    BATCH_PREPARE,
+    BATCH_OPTIMISE,
+    BATCH_WRITE,
+}
+BatchStage;
+
+typedef struct Batch Batch;
+
+typedef struct
+{
+    Batch*      batch;
+    BatchItem*  item;
+    int         index;
+    Arena       arena;
+    BatchStage  stage;
+    const char* error;
+    u8*         pixels;
+    int         width;
+    int         height;
+    Image*      target;
+    Converter   converter;
+    f64         startTime;
+    f64         optimiseTime;
+    f64         resumed;                // Seconds spent on the image in earlier runs
+    char        stateName[MAX_PATH];    // Empty unless the batch is resumable
+    int         slot;
+}
+BatchJob;
+
+struct Batch
+{
+    BatchItem*          items;
+    int                 numItems;
+    BatchJob*           jobs;
+    int                 numJobs;
+    BatchJob**          freeJobs;
+    int                 numFree;
+    const BatchOptions* options;
+    ThreadPool          pool;
+    Checkpointer        checkpointer;
+    SRWLOCK             lock;
+    CONDITION_VARIABLE  jobFreed;
+    int                 numDone;
+    int                 numFailed;
+    i64                 generations;
+    const char*         scrOnly;        // Option whose screens are always saved as .scr, 0 if there isn't one
+};
+
+void batchDecode(BatchJob* job)
+{
+    Data data = dataLoad(job->item->input);
+    int type;
+
+    if (!data.buffer)
+    {
+        job->error = "cannot open file";
+        return;
+    }
+    {
+        TRACE_BEGIN(decode);
+        job->pixels = stbi_load_from_memory(data.buffer, (int)data.size, &job->width, &job->height, &type, 4);
+        TRACE_END(decode);
+    }
+    dataUnload(data);
+    if (!job->pixels) job->error = stbi_failure_reason();
+}
+
+void batchPrepare(BatchJob* job)
+{
+    job->target = imageCreate(256, 192);
+    imagePrepareTarget(job->target, job->pixels, job->width, job->height);
+
+    // Usually this is arena memory and costs nothing, but an image too big for the arena spills onto the heap
+    stbi_image_free(job->pixels);
+    job->pixels = 0;
+    if (job->batch->options->dither)
+    {
+        memset(&job->converter, 0, sizeof(Converter));
+        job->converter.target = job->target;
+        job->converter.scratch = imageCreate(256, 192);
+        return;
+    }
+
+    // A state that can't be used (say the image has changed since) is simply overwritten by a fresh start
+    job->resumed = 0;
+    job->stateName[0] = 0;
+    if (job->batch->options->beam)
+    {
+        f32 blur = job->batch->options->blur;
+        converterInit(&job->converter, job->target, job->batch->options->seed + job->index);
+        converterBlur(&job->converter, blur > 0 ? blur : 1.0f);
+        return;
+    }
+    if (job->batch->options->resumable)
+    {
+        snprintf(job->stateName, MAX_PATH, "%s.state", job->item->output);
+        if (GetFileAttributesA(job->stateName) != INVALID_FILE_ATTRIBUTES &&
+            !converterResume(&job->converter, job->target, job->stateName, &job->resumed))
+        {
+            return;
+        }
+    }
+
+    converterInit(&job->converter, job->target, job->batch->options->seed + job->index);
+    job->converter.stagnation = job->item->budget.stagnation;
+    {
+        Seeding seeding = job->batch->options->seeding;
+        seeding.numThreads = 1;
+        converterSeed(&job->converter, &seeding);
+    }
+    if (job->batch->options->hybrid) converterHybrid(&job->converter);
+    else if (job->batch->options->hicolour || job->batch->options->multicolour)
+    {
+        converterHicolour(&job->converter, job->batch->options->hicolour ? 1 : job->batch->options->multicolour, YES);
+    }
+    else if (job->batch->options->gigascreen) converterGigascreen(&job->converter, YES);
+    else if (job->batch->options->ulaplus) converterUlaplus(&job->converter, YES);
+    else if (job->batch->options->blur > 0) converterBlur(&job->converter, job->batch->options->blur);
+}
+
+void batchOptimise(BatchJob* job)
+{
+    Converter* cv = &job->converter;
+    const Budget* budget = &job->item->budget;
+    i64 checkpointMs = job->batch->options->checkpointMs;
+    f64 start = timeNow() - job->resumed;
+    f64 deadline = budgetDeadline(budget, start, 0);
+    f64 lastCheckpoint = timeNow();
+    i64 checkpointError = -1;
+
+    if (job->batch->options->dither)
+    {
+        converterDither(cv, job->batch->options->dither);
+        job->optimiseTime = timeNow() - start;
+        return;
+    }
+    if (job->batch->options->beam)
+    {
+        // Images are already converted in parallel
+        converterBeam(cv, job->batch->options->beam, 1);
+        job->optimiseTime = timeNow() - start;
+        return;
+    }
+    if (cv->cellErrors || cv->rowErrors)
+    {
+        converterSolve(cv);
+        job->optimiseTime = timeNow() - start;
+        return;
+    }
+
+    while (budgetCheck(budget, cv, deadline, 0) == STOP_NONE)
+    {
+        ConverterEvent event = converterStep(cv);
+        converterLog(job->batch->options->log, job->item->input, cv, event, timeNow() - start);
+
+        if (checkpointMs && (timeNow() - lastCheckpoint) * 1000.0 >= (f64)checkpointMs)
+        {
+            if (cv->bestError != checkpointError)
+            {
+                checkpointPost(&job->batch->checkpointer, job->slot, job->item->output, cv->best,
+                    converterScreenSize(cv));
+                checkpointError = cv->bestError;
+            }
+            if (job->stateName[0])
+            {
+                checkpointPostState(&job->batch->checkpointer, job->slot, job->stateName, cv, timeNow() - start);
+            }
+            lastCheckpoint = timeNow();
+        }
+    }
+
+    job->optimiseTime = timeNow() - start;
+}
+
+void batchWrite(BatchJob* job)
+{
+    checkpointCancel(&job->batch->checkpointer, job->slot);
+    if (!exportScreen(job->item->output, job->converter.best, converterScreenSize(&job->converter)))
+    {
+        job->error = "cannot write output";
+    }
+    else if (job->stateName[0])
+    {
+        DeleteFileA(job->stateName);
+    }
+}
+
+void batchRunStage(void* arg)
+{
+    BatchJob* job = (BatchJob *)arg;
+    Batch* batch = job->batch;
+    Arena* prev = arenaUse(&job->arena);
+
+    switch (job->stage)
+    {
+    case BATCH_DECODE:      batchDecode(job);       break;
+    case BATCH_PREPARE:     batchPrepare(job);      break;
+    case BATCH_OPTIMISE:    batchOptimise(job);     break;
+    case BATCH_WRITE:       batchWrite(job);        break;
+    }
+    arenaUse(prev);
+
+    if (!job->error && job->stage != BATCH_WRITE)
+    {
+        // Only one task per job is ever queued and there are never more jobs than queue slots, so this won't block.
+        ++job->stage;
+        poolSubmit(&batch->pool, &batchRunStage, job);
+        return;
+    }
+
+    AcquireSRWLockExclusive(&batch->lock);
+    ++batch->numDone;
+    if (job->error)
+    {
+        ++batch->numFailed;
+        printf("[%d/%d] %s: FAILED (%s)\n", batch->numDone, batch->numItems, job->item->input, job->error);
+    }
+    else
+    {
+        batch->generations += job->converter.generation;
+        printf("[%d/%d] %s -> %s: error %lld after %lld generations in %.2fs%s\n",
+            batch->numDone, batch->numItems, job->item->input, job->item->output,
+            job->converter.bestError, job->converter.generation, job->optimiseTime,
+            job->converter.stagnated ? " (stagnated)" : "");
+    }
+    batch->freeJobs[batch->numFree++] = job;
+    WakeConditionVariable(&batch->jobFreed);
+    ReleaseSRWLockExclusive(&batch->lock);
+}
+
+bool isImageFile(const char* fileName)
+{
+    static const char* extensions[] =
+    {
+        ".jpg", ".jpeg", ".png", ".bmp", ".tga", ".gif", ".psd", ".pic", ".ppm", ".pgm", ".hdr",
+    };
+    const char* ext = strrchr(fileName, '.');
+
+    if (!ext) return NO;
+    for (int i = 0; i < sizeof(extensions) / sizeof(extensions[0]); ++i)
+    {
+        if (!_stricmp(ext, extensions[i])) return YES;
+    }
+    return NO;
+}
+
+// Whether one of the first numItems images already writes to the file.  Names are compared as Windows compares
+// them, ignoring case.
+bool batchOutputTaken(const Batch* batch, const char* output, int numItems)
+{
+    for (int i = 0; i < numItems; ++i)
+    {
+        if (!_stricmp(batch->items[i].output, output)) return YES;
+    }
+    return NO;
+}
+
+// Adds an image written to output, or if that is 0 to the input name with the format's extension, in the output
+// directory if there is one.  A name an earlier image already has gets a number before its extension, so images
+// such as a.jpg and a.png don't overwrite each other's screens.
+BatchItem* batchAddItem(Batch* batch, const char* input, const char* output, const char* outDir, const Budget* budget)
+{
+    BatchItem* item;
+    char wanted[MAX_PATH];
+    const char* name = input;
+    const char* ext;
+    const char* s;
+
+    batch->items = (BatchItem *)realloc(batch->items, (batch->numItems + 1) * sizeof(BatchItem));
+    item = &batch->items[batch->numItems++];
+    memset(item, 0, sizeof(BatchItem));
+    strncpy(item->input, input, MAX_PATH - 1);
+    item->budget = *budget;
+
+    if (output)
+    {
+        snprintf(wanted, MAX_PATH, "%s", output);
+        if (batch->scrOnly && formatFromName(wanted) != FORMAT_SCR)
+        {
+            // Every format's extension is the same length, so a tape or snapshot name becomes a .scr one in place
+            memcpy(strrchr(wanted, '.'), gFormatExtensions[FORMAT_SCR], 4);
+        }
+    }
+    else
+    {
+        if (outDir)
+        {
+            for (s = input; *s; ++s)
+            {
+                if (*s == '\\' || *s == '/' || *s == ':') name = s + 1;
+            }
+        }
+        ext = strrchr(name, '.');
+        snprintf(wanted, MAX_PATH, "%s%s%.*s%s",
+            outDir ? outDir : "", outDir ? "\\" : "",
+            ext ? (int)(ext - name) : (int)strlen(name), name,
+            gFormatExtensions[batch->scrOnly ? FORMAT_SCR : batch->options->format]);
+    }
+
+    // The number goes before the extension, if the file name part has one
+    ext = strrchr(wanted, '.');
+    for (s = wanted; ext && *s; ++s)
+    {
+        if (s > ext && (*s == '\\' || *s == '/')) ext = 0;
+    }
+    strcpy(item->output, wanted);
+    for (int n = 2; batchOutputTaken(batch, item->output, batch->numItems - 1); ++n)
+    {
+        snprintf(item->output, MAX_PATH, "%.*s_%d%s", ext ? (int)(ext - wanted) : (int)strlen(wanted), wanted, n,
+            ext ? ext : "");
+    }
+    if (strcmp(item->output, wanted))
+    {
+        printf("%s: %s is another image's output, writing %s instead\n", input, wanted, item->output);
+    }
+
+    return item;
+}
+
+void batchAddDirectory(Batch* batch, const char* dir, const char* outDir, const Budget* budget)
+{
+    WIN32_FIND_DATAA fd;
+    char path[MAX_PATH];
+    HANDLE find;
+
+    snprintf(path, MAX_PATH, "%s\\*", dir);
+    find = FindFirstFileA(path, &fd);
+    if (find == INVALID_HANDLE_VALUE) return;
+
+    do
+    {
+        if (!(fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && isImageFile(fd.cFileName))
+        {
+            snprintf(path, MAX_PATH, "%s\\%s", dir, fd.cFileName);
+            batchAddItem(batch, path, 0, outDir ? outDir : dir, budget);
+        }
+    }
+    while (FindNextFileA(find, &fd));
+    FindClose(find);
+}
+
+// Reads the next whitespace-separated or quoted token from a manifest line.
+char* nextToken(char** line)
+{
+    char* s = *line;
+    char* token;
+
+    while (*s == ' ' || *s == '\t') ++s;
+    if (!*s) return 0;
+    if (*s == '"')
+    {
+        token = ++s;
+        while (*s && *s != '"') ++s;
+    }
+    else
+    {
+        token = s;
+        while (*s && *s != ' ' && *s != '\t') ++s;
+    }
+    if (*s) *s++ = 0;
+    *line = s;
+
+    return token;
+}
+
+// A manifest has one image per line:
+//
+//      <input> [<output>] [time=<ms>] [error=<n>] [gens=<n>] [evals=<n>]
+//
+// Paths with spaces can be quoted, lines starting with # are ignored, and budgets not given fall back to the ones
+// from the command line.
+bool batchAddManifest(Batch* batch, const char* fileName, const char* outDir, const Budget* budget)
+{
+    FILE* f = fopen(fileName, "rt");
+    char line[1024];
+
+    if (!f) return NO;
+    while (fgets(line, sizeof(line), f))
+    {
+        char* s = line;
+        char* token;
+        char* input;
+        char* output = 0;
+        Budget b = *budget;
+
+        line[strcspn(line, "\r\n")] = 0;
+        input = nextToken(&s);
+        if (!input || *input == '#') continue;
+
+        while ((token = nextToken(&s)) != 0)
+        {
+            if (!strncmp(token, "time=", 5))        b.timeMs = _atoi64(token + 5);
+            else if (!strncmp(token, "error=", 6))  b.targetError = _atoi64(token + 6);
+            else if (!strncmp(token, "gens=", 5))   b.generations = _atoi64(token + 5);
+            else if (!strncmp(token, "evals=", 6))  b.evaluations = _atoi64(token + 6);
+            else                                    output = token;
+        }
+
+        batchAddItem(batch, input, output, outDir, &b);
+    }
+    fclose(f);
+
+    return YES;
+}
+
+// The option whose screens have no tape or snapshot form, so they are written as .scr whatever the format, or 0
+const char* batchScrOnly(const BatchOptions* options)
+{
+    if (options->hybrid || options->beam) return 0;
+    if (options->hicolour) return "--hicolour";
+    if (options->gigascreen && !options->multicolour) return "--gigascreen";
+    return 0;
+}
+
+// Converts every image in a directory, or listed in a manifest file.  Returns the number of failed images.
+int batchRun(const char* source, const BatchOptions* options)
+{
+    Batch batch = { 0 };
+    DWORD attr = GetFileAttributesA(source);
+    const char* outDir = options->outDir;
+    int numThreads = options->numThreads;
+    f64 start = timeNow();
+    f64 elapsed;
+
+    batch.options = options;
+    batch.scrOnly = batchScrOnly(options);
+    if (attr == INVALID_FILE_ATTRIBUTES)
+    {
+        printf("Cannot find %s\n", source);
+        return 1;
+    }
+    if (outDir) CreateDirectoryA(outDir, 0);
+    if (attr & FILE_ATTRIBUTE_DIRECTORY)
+    {
+        batchAddDirectory(&batch, source, outDir, &options->budget);
+    }
+    else if (!batchAddManifest(&batch, source, outDir, &options->budget))
+    {
+        printf("Cannot read manifest %s\n", source);
+        return 1;
+    }
+
+    if (batch.scrOnly && options->format != FORMAT_SCR)
+    {
+        printf("%s screens are always saved as .scr, not %s\n", batch.scrOnly, gFormatExtensions[options->format]);
+    }
+    if (numThreads <= 0) numThreads = cpuCount();
+    printf("Converting %d images on %d threads\n", batch.numItems, numThreads);
+
+    // Two jobs per worker so one can decode or write while the other optimises
+    batch.numJobs = numThreads * 2;
+    batch.jobs = (BatchJob *)calloc(batch.numJobs, sizeof(BatchJob));
+    batch.freeJobs = (BatchJob **)malloc(batch.numJobs * sizeof(BatchJob *));
+    for (int i = 0; i < batch.numJobs; ++i)
+    {
+        arenaInit(&batch.jobs[i].arena, BATCH_ARENA_SIZE);
+        batch.jobs[i].batch = &batch;
+        batch.jobs[i].slot = i;
+        batch.freeJobs[batch.numFree++] = &batch.jobs[i];
+    }
+    InitializeSRWLock(&batch.lock);
+    InitializeConditionVariable(&batch.jobFreed);
+    checkpointInit(&batch.checkpointer, batch.numJobs);
+    poolInit(&batch.pool, numThreads, batch.numJobs);
+
+    for (int i = 0; i < batch.numItems; ++i)
+    {
+        BatchJob* job;
+
+        AcquireSRWLockExclusive(&batch.lock);
+        while (!batch.numFree)
+        {
+            SleepConditionVariableSRW(&batch.jobFreed, &batch.lock, INFINITE, 0);
+        }
+        job = batch.freeJobs[--batch.numFree];
+        ReleaseSRWLockExclusive(&batch.lock);
+
+        arenaReset(&job->arena);
+        job->item = &batch.items[i];
+        job->index = i;
+        job->stage = BATCH_DECODE;
+        job->error = 0;
+        job->startTime = timeNow();
+        poolSubmit(&batch.pool, &batchRunStage, job);
+    }
+
+    poolWait(&batch.pool);
+    poolDone(&batch.pool);
+    checkpointDone(&batch.checkpointer);
+
+    elapsed = timeNow() - start;
+    printf("%d images, %d failed, %.2fs: %.2f images/s, %.1f generations/s\n",
+        batch.numItems, batch.numFailed, elapsed,
+        (f64)batch.numItems / elapsed, (f64)batch.generations / elapsed);
+
+    for (int i = 0; i < batch.numJobs; ++i)
+    {
+        arenaDone(&batch.jobs[i].arena);
+    }
+    free(batch.jobs);
+    free(batch.freeJobs);
+    free(batch.items);
+
+    return batch.numFailed;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,370 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Beam search
+// Under the blurred error a cell's score depends on its neighbours, and the GA takes a long time to settle a screen
+// where every change ripples into the cells around it.  This engine instead fills cells in scanline order, one
+// character row after another, keeping the best few partial screens.  Every cell has a short list of candidates:
+// the attributes whose two colours can best mix to its pixels, each with a handful of ordered dithers.  Each partial
+// screen is extended by each candidate and scored by the blurred error of every cell the candidate's blur reaches,
+// which takes in the cells already placed above and to the left.  Cells not yet placed hold their first candidate.
+//
+// The work is the same for every picture: width times the candidates per cell, 768 times over, spread across
+// threads by partial screen.
+//----------------------------------------------------------------------------------------------------------------------
+
+#include "zximg.h"
+
+#define BEAM_ATTRS          4       // Attributes tried per cell
+#define BEAM_PATTERNS       6       // Bitmaps tried per attribute
+#define BEAM_CANDIDATES     (BEAM_ATTRS * BEAM_PATTERNS)
+#define BEAM_REACH          ((BLUR_MAX_RADIUS + 7) / 8)
+#define BEAM_WINDOW         ((2 * BEAM_REACH + 1) * (2 * BEAM_REACH + 1))
+
+// Every way of filling a cell worth trying, as its 8 bitmap bytes then its attribute
+typedef struct
+{
+    int     count;
+    u8      bytes[BEAM_CANDIDATES][9];
+}
+BeamCell;
+
+// A partial screen: cells before the one being placed are final, the rest provisional
+typedef struct
+{
+    u8      genome[6912];
+    i32     scores[768];
+    i64     error;
+}
+BeamState;
+
+// A partial screen extended by one candidate
+typedef struct
+{
+    i64     error;
+    i32     scores[BEAM_WINDOW];    // Of the cells in the candidate's window
+}
+BeamResult;
+
+typedef struct
+{
+    const Blur*         blur;
+    const BeamCell*     cells;
+    BeamState*          states;
+    int                 numStates;
+    int                 cell;                   // Being placed
+    bool                dirty[768];             // Cells whose score it changes...
+    int                 window[BEAM_WINDOW];    // ...and as a list
+    int                 numWindow;
+    BeamResult*         results;                // BEAM_CANDIDATES for every state
+    u8*                 scratch;                // A genome and a set of scores for every state
+}
+BeamSearch;
+
+typedef struct
+{
+    BeamSearch*     search;
+    int             state;
+}
+BeamTask;
+
+// Size of each pattern's matrix, 8 for Bayer, 16 for blue noise or 0 to take the nearer colour, and its offset
+const int gBeamPatterns[BEAM_PATTERNS][3] =
+{
+    { 0, 0, 0 }, { 8, 0, 0 }, { 8, 4, 4 }, { 8, 4, 0 }, { 16, 0, 0 }, { 16, 8, 8 },
+};
+
+void beamWrite(u8* genome, int cell, const u8* bytes)
+{
+    for (int y = 0; y < 8; ++y)
+    {
+        genome[scrimOffset((cell % 32) * 8, (cell / 32) * 8 + y)] = bytes[y];
+    }
+    genome[6144 + cell] = bytes[8];
+}
+
+// Lists the candidates of a cell.  Attributes are ranked by how far the pixels lie from the line between their two
+// colours, which is what a dither between them can't make up.
+void beamCandidates(const Image* target, int cell, BeamCell* out)
+{
+    int cx = cell % 32, cy = cell / 32;
+    f32 pixels[64][3];
+    f32 bestErrors[BEAM_ATTRS];
+    int bestPairs[BEAM_ATTRS];
+    int numBest = 0;
+
+    for (int p = 0; p < 64; ++p)
+    {
+        u32 c = target->pixels[(cy * 8 + p / 8) * 256 + cx * 8 + p % 8];
+        pixels[p][0] = (f32)channelRed(c);
+        pixels[p][1] = (f32)channelGreen(c);
+        pixels[p][2] = (f32)channelBlue(c);
+    }
+
+    // Pairs are bright << 6 | paper << 3 | ink with paper <= ink; the other way round is the same pair inverted
+    for (int bright = 0; bright < 2; ++bright)
+    {
+        for (int paper = 0; paper < 8; ++paper)
+        {
+            for (int ink = paper; ink < 8; ++ink)
+            {
+                u32 from = gZxColours[bright * 8 + paper], to = gZxColours[bright * 8 + ink];
+                f32 a[3] = { (f32)channelRed(from), (f32)channelGreen(from), (f32)channelBlue(from) };
+                f32 axis[3] = { channelRed(to) - a[0], channelGreen(to) - a[1], channelBlue(to) - a[2] };
+                f32 length = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+                f32 error = 0;
+                int pair = (bright << 6) | (paper << 3) | ink;
+                int i;
+
+                for (int p = 0; p < 64; ++p)
+                {
+                    f32 d[3] = { pixels[p][0] - a[0], pixels[p][1] - a[1], pixels[p][2] - a[2] };
+                    f32 t = length > 0 ? (d[0] * axis[0] + d[1] * axis[1] + d[2] * axis[2]) / length : 0;
+                    t = t < 0 ? 0 : (t > 1 ? 1 : t);
+                    for (int k = 0; k < 3; ++k)
+                    {
+                        f32 e = d[k] - t * axis[k];
+                        error += gBlurWeights[k] * e * e;
+                    }
+                }
+
+                // Insertion into the short list
+                for (i = numBest < BEAM_ATTRS ? numBest++ : BEAM_ATTRS; i > 0 && bestErrors[i - 1] > error; --i)
+                {
+                    if (i < BEAM_ATTRS)
+                    {
+                        bestErrors[i] = bestErrors[i - 1];
+                        bestPairs[i] = bestPairs[i - 1];
+                    }
+                }
+                if (i < BEAM_ATTRS)
+                {
+                    bestErrors[i] = error;
+                    bestPairs[i] = pair;
+                }
+            }
+        }
+    }
+
+    out->count = 0;
+    for (int a = 0; a < numBest; ++a)
+    {
+        int pair = bestPairs[a];
+        int bright = pair >> 6, paper = (pair >> 3) & 7, ink = pair & 7;
+        u32 from = gZxColours[bright * 8 + paper], to = gZxColours[bright * 8 + ink];
+        f32 axis[3] = { (f32)channelRed(to) - channelRed(from), (f32)channelGreen(to) - channelGreen(from),
+            (f32)channelBlue(to) - channelBlue(from) };
+        f32 length = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+        f32 along[64];
+
+        // How far each pixel is from paper to ink, in 256ths
+        for (int p = 0; p < 64; ++p)
+        {
+            along[p] = length > 0 ? ((pixels[p][0] - channelRed(from)) * axis[0] +
+                (pixels[p][1] - channelGreen(from)) * axis[1] + (pixels[p][2] - channelBlue(from)) * axis[2]) *
+                256.0f / length : 0;
+        }
+
+        for (int pattern = 0; pattern < BEAM_PATTERNS; ++pattern)
+        {
+            int size = gBeamPatterns[pattern][0];
+            int dx = gBeamPatterns[pattern][1], dy = gBeamPatterns[pattern][2];
+            u8* bytes = out->bytes[out->count];
+            int c;
+
+            for (int y = 0; y < 8; ++y)
+            {
+                int bits = 0;
+                for (int x = 0; x < 8; ++x)
+                {
+                    int sx = cx * 8 + x + dx, sy = cy * 8 + y + dy;
+                    f32 threshold = size == 0 ? 128.0f :
+                        (size == 8 ? gBayer[(sy & 7) * 8 + (sx & 7)] * 4 + 2.0f :
+                         gBlueNoise[(sy & 15) * 16 + (sx & 15)] + 0.5f);
+                    bits = bits << 1 | (along[x + y * 8] > threshold);
+                }
+                bytes[y] = (u8)bits;
+            }
+
+            // A bitmap of all paper or all ink is a solid cell, written as that colour on itself so that duplicates
+            // can be found
+            {
+                int any = 0, every = 0xff;
+                for (int y = 0; y < 8; ++y)
+                {
+                    any |= bytes[y];
+                    every &= bytes[y];
+                }
+                if (!any || every == 0xff)
+                {
+                    int colour = any ? ink : paper;
+                    memset(bytes, 0, 8);
+                    bytes[8] = (u8)((bright << 6) | (colour << 3) | colour);
+                }
+                else
+                {
+                    bytes[8] = (u8)pair;
+                }
+            }
+
+            for (c = 0; c < out->count; ++c)
+            {
+                if (!memcmp(out->bytes[c], bytes, 9)) break;
+            }
+            if (c == out->count) ++out->count;
+        }
+    }
+}
+
+// Extends one partial screen by every candidate of the cell being placed
+void beamExpand(void* arg)
+{
+    BeamTask* task = (BeamTask *)arg;
+    BeamSearch* search = task->search;
+    const BeamState* state = &search->states[task->state];
+    const BeamCell* cell = &search->cells[search->cell];
+    u8* genome = &search->scratch[task->state * (6912 + 768 * sizeof(i32))];
+    i32* scores = (i32 *)(genome + 6912);
+    i64 before = 0;
+
+    memcpy(genome, state->genome, 6912);
+    for (int w = 0; w < search->numWindow; ++w)
+    {
+        before += state->scores[search->window[w]];
+    }
+
+    for (int c = 0; c < cell->count; ++c)
+    {
+        BeamResult* result = &search->results[task->state * BEAM_CANDIDATES + c];
+        i64 after = 0;
+
+        beamWrite(genome, search->cell, cell->bytes[c]);
+        blurScore(search->blur, genome, search->dirty, scores);
+        for (int w = 0; w < search->numWindow; ++w)
+        {
+            result->scores[w] = scores[search->window[w]];
+            after += result->scores[w];
+        }
+        result->error = state->error - before + after;
+    }
+}
+
+// Converts cv->target by beam search, keeping width partial screens (at most BEAM_MAX_WIDTH) and scoring by the blur
+// converterBlur() set up.  The screen and its error are left where a step would leave them, and the screen also
+// replaces the first scrim of the population, so stepping the converter afterwards carries on from it.  numThreads
+// is 0 for one per core.  Memory comes from the current arena.
+void converterBeam(Converter* cv, int width, int numThreads)
+{
+    const Blur* blur = cv->blur;
+    BeamCell* cells = (BeamCell *)memAlloc(768 * sizeof(BeamCell));
+    BeamState* states = (BeamState *)memAlloc(2 * BEAM_MAX_WIDTH * sizeof(BeamState));
+    BeamState* next = states + BEAM_MAX_WIDTH;
+    BeamSearch* search = (BeamSearch *)memAlloc(sizeof(BeamSearch));
+    BeamTask tasks[BEAM_MAX_WIDTH];
+    int reach = (blur->radius + 7) / 8;
+    bool all[768];
+    ThreadPool pool;
+
+    if (width < 1) width = 1;
+    if (width > BEAM_MAX_WIDTH) width = BEAM_MAX_WIDTH;
+    if (numThreads <= 0) numThreads = cpuCount();
+    if (numThreads > width) numThreads = width;
+
+    TRACE_BEGIN(beam);
+    search->blur = blur;
+    search->cells = cells;
+    search->results = (BeamResult *)memAlloc(BEAM_MAX_WIDTH * BEAM_CANDIDATES * sizeof(BeamResult));
+    search->scratch = (u8 *)memAlloc(BEAM_MAX_WIDTH * (6912 + 768 * sizeof(i32)));
+
+    // Every cell starts out as its first candidate
+    for (int cell = 0; cell < 768; ++cell)
+    {
+        beamCandidates(cv->target, cell, &cells[cell]);
+        beamWrite(states[0].genome, cell, cells[cell].bytes[0]);
+    }
+    memset(all, YES, sizeof(all));
+    blurScore(blur, states[0].genome, all, states[0].scores);
+    states[0].error = 0;
+    for (int cell = 0; cell < 768; ++cell)
+    {
+        states[0].error += states[0].scores[cell];
+    }
+    search->numStates = 1;
+    cv->evaluations += 1;
+
+    if (numThreads > 1) poolInit(&pool, numThreads, BEAM_MAX_WIDTH);
+    for (int cell = 0; cell < 768; ++cell)
+    {
+        const BeamCell* candidates = &cells[cell];
+        int chosen[BEAM_MAX_WIDTH];
+        int numChosen = 0;
+        BeamState* swap;
+
+        search->cell = cell;
+        search->states = states;
+        search->numWindow = 0;
+        memset(search->dirty, NO, sizeof(search->dirty));
+        for (int cy = cell / 32 - reach; cy <= cell / 32 + reach; ++cy)
+        {
+            for (int cx = cell % 32 - reach; cx <= cell % 32 + reach; ++cx)
+            {
+                if (cx < 0 || cx >= 32 || cy < 0 || cy >= 24) continue;
+                search->dirty[cy * 32 + cx] = YES;
+                search->window[search->numWindow++] = cy * 32 + cx;
+            }
+        }
+
+        for (int s = 0; s < search->numStates; ++s)
+        {
+            tasks[s].search = search;
+            tasks[s].state = s;
+            if (numThreads > 1) poolSubmit(&pool, &beamExpand, &tasks[s]);
+            else beamExpand(&tasks[s]);
+        }
+        if (numThreads > 1) poolWait(&pool);
+        cv->evaluations += search->numStates * candidates->count;
+
+        // The width best extensions, in order.  Different states never make the same screen, as they already
+        // differ somewhere else.
+        for (int s = 0; s < search->numStates; ++s)
+        {
+            for (int c = 0; c < candidates->count; ++c)
+            {
+                int index = s * BEAM_CANDIDATES + c;
+                i64 error = search->results[index].error;
+                int i = numChosen < width ? numChosen++ : width;
+                for (; i > 0 && search->results[chosen[i - 1]].error > error; --i)
+                {
+                    if (i < width) chosen[i] = chosen[i - 1];
+                }
+                if (i < width) chosen[i] = index;
+            }
+        }
+
+        for (int i = 0; i < numChosen; ++i)
+        {
+            const BeamResult* result = &search->results[chosen[i]];
+            const BeamState* from = &states[chosen[i] / BEAM_CANDIDATES];
+            BeamState* to = &next[i];
+
+            memcpy(to, from, sizeof(BeamState));
+            beamWrite(to->genome, cell, candidates->bytes[chosen[i] % BEAM_CANDIDATES]);
+            for (int w = 0; w < search->numWindow; ++w)
+            {
+                to->scores[search->window[w]] = result->scores[w];
+            }
+            to->error = result->error;
+        }
+        search->numStates = numChosen;
+        swap = states;
+        states = next;
+        next = swap;
+    }
+    if (numThreads > 1) poolDone(&pool);
+
+    memcpy(cv->best, states[0].genome, 6912);
+    memcpy(cv->current->genomes, states[0].genome, 6912);
+    cv->bestError = states[0].error;
+    TRACE_END(beam);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,301 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Perceptual fitness
+// Seen from across the room a dithered cell looks like the colour in between, but checkError() compares pixel by
+// pixel and so punishes every dither.  This mode compares a Gaussian blurred render with the blurred target instead,
+// weighting the channels by how much they contribute to luminance.
+//
+// Blurring a whole screen for every child would be far too slow.  Each scrim keeps its error cell by cell, and a
+// child only re-filters the cells within reach of the blur of any byte it doesn't share with the parent it was bred
+// from; the rest it inherits.  Filtering is separable and in 16 bit fixed point, one cell wide row of one channel to
+// a vector, and the kernel is symmetric so each pair of taps either side of the centre costs one multiply.
+//----------------------------------------------------------------------------------------------------------------------
+
+#include "zximg.h"
+
+#include <emmintrin.h>
+#include <math.h>
+
+#define BLUR_BAND           (8 + 2 * BLUR_MAX_RADIUS)       // Lines a character row needs
+#define BLUR_LINE           (256 + 2 * BLUR_MAX_RADIUS)     // A line with the edges repeated either side
+#define BLUR_SHIFT          6       // Channels are scaled up to make the most of 16 bits; a pair of them still fits
+
+typedef i16 BlurLine[3][BLUR_LINE];
+
+// Luminance weights of red, green and blue, out of 256
+const i16 gBlurWeights[3] = { 77, 150, 29 };
+
+// Repeats the first and last pixel of each channel into the margins
+void blurMargins(BlurLine line)
+{
+    for (int c = 0; c < 3; ++c)
+    {
+        for (int k = 1; k <= BLUR_MAX_RADIUS; ++k)
+        {
+            line[c][BLUR_MAX_RADIUS - k] = line[c][BLUR_MAX_RADIUS];
+            line[c][BLUR_MAX_RADIUS + 255 + k] = line[c][BLUR_MAX_RADIUS + 255];
+        }
+    }
+}
+
+// Bytes [from, to) of one line of a scrim's picture
+void blurRenderLine(const Blur* blur, const u8* genome, int y, int from, int to, BlurLine line)
+{
+    const __m128i bits = _mm_setr_epi16(0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01);
+    const u8* bitmap = &genome[scrimOffset(0, y)];
+    const u8* attrs = &genome[6144 + (y / 8) * 32];
+
+    for (int cx = from; cx < to; ++cx)
+    {
+        u8 attr = attrs[cx];
+        const i16* ink = blur->palette[(attr & 7) + ((attr & 0x40) >> 3)];
+        const i16* paper = blur->palette[(attr & 0x7f) >> 3];
+        __m128i mask = _mm_cmpeq_epi16(_mm_and_si128(_mm_set1_epi16(bitmap[cx]), bits), bits);
+
+        for (int c = 0; c < 3; ++c)
+        {
+            __m128i pixels = _mm_or_si128(_mm_and_si128(mask, _mm_set1_epi16(ink[c])),
+                _mm_andnot_si128(mask, _mm_set1_epi16(paper[c])));
+            _mm_storeu_si128((__m128i *)&line[c][BLUR_MAX_RADIUS + cx * 8], pixels);
+        }
+    }
+    blurMargins(line);
+}
+
+void blurTargetLine(const Image* target, int y, BlurLine line)
+{
+    const u32* pixels = &target->pixels[y * 256];
+
+    for (int x = 0; x < 256; ++x)
+    {
+        line[0][BLUR_MAX_RADIUS + x] = (i16)(channelRed(pixels[x]) << BLUR_SHIFT);
+        line[1][BLUR_MAX_RADIUS + x] = (i16)(channelGreen(pixels[x]) << BLUR_SHIFT);
+        line[2][BLUR_MAX_RADIUS + x] = (i16)(channelBlue(pixels[x]) << BLUR_SHIFT);
+    }
+    blurMargins(line);
+}
+
+// Renders bytes [from, to) of the lines character row cy needs from a scrim, or the whole of them from the target
+// if genome is 0, clamped to the screen
+void blurBand(const Blur* blur, const u8* genome, const Image* target, int cy, int from, int to, BlurLine* lines)
+{
+    for (int y = 0; y < 8 + 2 * blur->radius; ++y)
+    {
+        int sy = cy * 8 + y - blur->radius;
+        sy = sy < 0 ? 0 : (sy > 191 ? 191 : sy);
+        if (genome) blurRenderLine(blur, genome, sy, from, to, lines[y]);
+        else blurTargetLine(target, sy, lines[y]);
+    }
+}
+
+// Filters cell cx of a character row.  lines start radius lines above it, and out is each channel a row at a time,
+// at half the scale of the lines.
+void blurCell(const Blur* blur, BlurLine* lines, int cx, __m128i out[3][8])
+{
+    int radius = blur->radius;
+    __m128i kernel[BLUR_MAX_RADIUS + 1];
+    __m128i rows[3][BLUR_BAND];
+
+    for (int k = 0; k <= radius; ++k) kernel[k] = _mm_set1_epi16(blur->kernel[k]);
+
+    for (int y = 0; y < 8 + 2 * radius; ++y)
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            const i16* p = &lines[y][c][BLUR_MAX_RADIUS + cx * 8];
+            __m128i sum = _mm_mulhi_epi16(_mm_loadu_si128((const __m128i *)p), kernel[0]);
+            for (int k = 1; k <= radius; ++k)
+            {
+                __m128i pair = _mm_add_epi16(_mm_loadu_si128((const __m128i *)(p - k)),
+                    _mm_loadu_si128((const __m128i *)(p + k)));
+                sum = _mm_add_epi16(sum, _mm_mulhi_epi16(pair, kernel[k]));
+            }
+
+            // Back up to the scale of the lines for the second pass
+            rows[c][y] = _mm_slli_epi16(sum, 1);
+        }
+    }
+
+    for (int c = 0; c < 3; ++c)
+    {
+        for (int y = 0; y < 8; ++y)
+        {
+            const __m128i* p = &rows[c][y + radius];
+            __m128i sum = _mm_mulhi_epi16(*p, kernel[0]);
+            for (int k = 1; k <= radius; ++k)
+            {
+                sum = _mm_add_epi16(sum, _mm_mulhi_epi16(_mm_add_epi16(p[-k], p[k]), kernel[k]));
+            }
+            out[c][y] = sum;
+        }
+    }
+}
+
+// Sets the converter up to score by blurred error, with a Gaussian of the given standard deviation in pixels.  Call
+// after converterInit(), before the first step.  Memory comes from the current arena.
+void converterBlur(Converter* cv, f32 sigma)
+{
+    Blur* blur = (Blur *)memAlloc(sizeof(Blur));
+    int radius = (int)ceilf(sigma * 2.5f);
+    f32 weights[BLUR_MAX_RADIUS + 1];
+    f32 total = 0;
+    BlurLine lines[BLUR_BAND];
+
+    if (radius < 1) radius = 1;
+    if (radius > BLUR_MAX_RADIUS) radius = BLUR_MAX_RADIUS;
+    blur->sigma = sigma;
+    blur->radius = radius;
+    for (int k = 0; k <= radius; ++k)
+    {
+        weights[k] = expf(-(f32)(k * k) / (2.0f * sigma * sigma));
+        total += k ? 2 * weights[k] : weights[k];
+    }
+    for (int k = 0; k <= radius; ++k)
+    {
+        int w = (int)(weights[k] / total * 32768.0f + 0.5f);
+        blur->kernel[k] = (i16)(w > 32767 ? 32767 : w);
+    }
+    for (int i = 0; i < 16; ++i)
+    {
+        blur->palette[i][0] = (i16)(channelRed(gZxColours[i]) << BLUR_SHIFT);
+        blur->palette[i][1] = (i16)(channelGreen(gZxColours[i]) << BLUR_SHIFT);
+        blur->palette[i][2] = (i16)(channelBlue(gZxColours[i]) << BLUR_SHIFT);
+    }
+
+    // The target goes through exactly the same filter as the scrims
+    TRACE_BEGIN(blur);
+    blur->target = (i16 *)memAlloc(3 * 256 * 192 * sizeof(i16));
+    for (int cy = 0; cy < 24; ++cy)
+    {
+        blurBand(blur, 0, cv->target, cy, 0, 32, lines);
+        for (int cx = 0; cx < 32; ++cx)
+        {
+            __m128i out[3][8];
+            blurCell(blur, lines, cx, out);
+            for (int c = 0; c < 3; ++c)
+            {
+                for (int y = 0; y < 8; ++y)
+                {
+                    _mm_storeu_si128((__m128i *)&blur->target[(c * 192 + cy * 8 + y) * 256 + cx * 8], out[c][y]);
+                }
+            }
+        }
+    }
+    TRACE_END(blur);
+
+    cv->current->cellScores = (i32 *)populationArray(768 * sizeof(i32));
+    cv->future->cellScores = (i32 *)populationArray(768 * sizeof(i32));
+    cv->blur = blur;
+}
+
+// Re-scores the dirty cells of a scrim.  A cell's score is its absolute error, channel by channel and weighted by
+// luminance, summed over its pixels.
+void blurScore(const Blur* blur, const u8* genome, const bool* dirty, i32* scores)
+{
+    int reach = (blur->radius + 7) / 8;
+    __m128i weights[3];
+    BlurLine lines[BLUR_BAND];
+
+    for (int c = 0; c < 3; ++c) weights[c] = _mm_set1_epi16(gBlurWeights[c]);
+
+    for (int cy = 0; cy < 24; ++cy)
+    {
+        // Only the bytes the blur of a dirty cell reaches need rendering
+        int from = 32, to = 0;
+        for (int cx = 0; cx < 32; ++cx)
+        {
+            if (!dirty[cy * 32 + cx]) continue;
+            if (cx < from) from = cx;
+            to = cx + 1;
+        }
+        if (from >= to) continue;
+        from = from > reach ? from - reach : 0;
+        to = to + reach < 32 ? to + reach : 32;
+
+        blurBand(blur, genome, 0, cy, from, to, lines);
+        for (int cx = 0; cx < 32; ++cx)
+        {
+            __m128i out[3][8];
+            __m128i sum = _mm_setzero_si128();
+            i32 lanes[4];
+
+            if (!dirty[cy * 32 + cx]) continue;
+            blurCell(blur, lines, cx, out);
+            for (int c = 0; c < 3; ++c)
+            {
+                const i16* target = &blur->target[(c * 192 + cy * 8) * 256 + cx * 8];
+                for (int y = 0; y < 8; ++y, target += 256)
+                {
+                    __m128i diff = _mm_sub_epi16(out[c][y], _mm_loadu_si128((const __m128i *)target));
+                    diff = _mm_max_epi16(diff, _mm_sub_epi16(_mm_setzero_si128(), diff));
+                    sum = _mm_add_epi32(sum, _mm_madd_epi16(diff, weights[c]));
+                }
+            }
+            _mm_storeu_si128((__m128i *)lanes, sum);
+            scores[cy * 32 + cx] = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        }
+    }
+}
+
+// Cell of a bitmap or attribute byte
+int blurCellOf(int offset)
+{
+    if (offset >= 6144) return offset - 6144;
+    return (((offset >> 8) & 0x18) | ((offset >> 5) & 7)) * 32 + (offset & 31);
+}
+
+// Scores scrim index of pop, re-scoring only what changed since its parent in parents, the population it was bred
+// from.  Scrims without a parent are scored in full.
+i64 blurError(const Converter* cv, Population* pop, int index, const Population* parents)
+{
+    const Blur* blur = cv->blur;
+    const u8* genome = &pop->genomes[index * 6912];
+    i32* scores = &pop->cellScores[index * 768];
+    int parent = pop->parents[index];
+    int reach = (blur->radius + 7) / 8;     // Cells either side that a changed cell's blur spills into
+    bool changed[768];
+    bool dirty[768];
+    i64 total = 0;
+
+    if (parent < 0)
+    {
+        memset(dirty, YES, sizeof(dirty));
+    }
+    else
+    {
+        const u8* from = &parents->genomes[parent * 6912];
+        memcpy(scores, &parents->cellScores[parent * 768], 768 * sizeof(i32));
+        memset(changed, NO, sizeof(changed));
+        for (int i = 0; i < 6912; i += 8)
+        {
+            if (*(const u64 *)(genome + i) == *(const u64 *)(from + i)) continue;
+            for (int j = i; j < i + 8; ++j)
+            {
+                if (genome[j] != from[j]) changed[blurCellOf(j)] = YES;
+            }
+        }
+
+        memset(dirty, NO, sizeof(dirty));
+        for (int cell = 0; cell < 768; ++cell)
+        {
+            if (!changed[cell]) continue;
+            for (int cy = cell / 32 - reach; cy <= cell / 32 + reach; ++cy)
+            {
+                for (int cx = cell % 32 - reach; cx <= cell % 32 + reach; ++cx)
+                {
+                    if (cx >= 0 && cx < 32 && cy >= 0 && cy < 24) dirty[cy * 32 + cx] = YES;
+                }
+            }
+        }
+    }
+
+    blurScore(blur, genome, dirty, scores);
+    for (int cell = 0; cell < 768; ++cell)
+    {
+        total += scores[cell];
+    }
+
+    return total;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,44 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Budgets
+// A conversion can be stopped after any generation and still has a best screen to show for it.  Every conversion loop
+// runs until the first of a deadline, an evaluation budget, a generation count, a target error or stagnation, by the
+// same rules.
+//----------------------------------------------------------------------------------------------------------------------
+
+#include "zximg.h"
+
+// When a budget's time runs out for a conversion that started at start, or deadline if that comes first.  Both are
+// timeNow() values, and 0 is never.
+f64 budgetDeadline(const Budget* budget, f64 start, f64 deadline)
+{
+    if (budget->timeMs)
+    {
+        f64 end = start + (f64)budget->timeMs / 1000.0;
+        if (deadline <= 0 || end < deadline) deadline = end;
+    }
+    return deadline;
+}
+
+// Decides whether to run another generation, returning why not or STOP_NONE.  The first generation always runs, so
+// there is a scored screen, and none runs that would go over the evaluation budget.  With stepTime, how long a
+// generation is expected to take, it stops when one more would overrun the deadline; with 0, once it has passed.
+StopReason budgetCheck(const Budget* budget, const Converter* cv, f64 deadline, f64 stepTime)
+{
+    if (cv->generation == 0) return STOP_NONE;
+    if (cv->stagnated) return STOP_STAGNATION;
+    if (budget->targetError && cv->bestError >= 0 && cv->bestError <= budget->targetError) return STOP_TARGET;
+    if (budget->generations && cv->generation >= budget->generations) return STOP_GENERATIONS;
+    if (budget->evaluations && cv->evaluations + POPULATION_SIZE > budget->evaluations) return STOP_EVALUATIONS;
+    if (deadline > 0 && timeNow() + stepTime >= deadline) return STOP_DEADLINE;
+    return STOP_NONE;
+}
+
+// The time to expect the next generation to take, after one took t.  Generations cost about the same, but this
+// leaves room for one that is slower than the average so far.
+f64 budgetStepTime(f64 stepTime, f64 t)
+{
+    return t > stepTime ? t : stepTime * 0.9 + t * 0.1;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
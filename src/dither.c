@@ -0,0 +1,312 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Error diffusion
+// A conventional conversion for when a good screen is needed now rather than the best one later.  Each cell's ink,
+// paper and brightness are the pair its pixels lie nearest the segment between, then the error is diffused across the
+// whole screen with every pixel limited to its cell's two colours.  Colours come from gZxColours, so the result is
+// scored and shown exactly as a scrim from the optimiser would be.
+//----------------------------------------------------------------------------------------------------------------------
+
+#include "zximg.h"
+
+#include <emmintrin.h>
+
+const char* gDitherNames[DITHER_COUNT] =
+{
+    "none", "fs", "atkinson", "sierra", "bayer", "bluenoise",
+};
+
+typedef struct
+{
+    int     count;
+    int     shift;                  // The weights add up to at most 1 << shift
+    int     dx[10];
+    int     dy[10];
+    int     weight[10];
+}
+Kernel;
+
+const Kernel gKernels[DITHER_COUNT] =
+{
+    { 0 },
+
+    // Floyd-Steinberg
+    { 4, 4, { 1, -1, 0, 1 }, { 0, 1, 1, 1 }, { 7, 3, 5, 1 } },
+
+    // Atkinson only passes on 6/8 of the error, which keeps highlights and shadows clean
+    { 6, 3, { 1, 2, -1, 0, 1, 0 }, { 0, 0, 1, 1, 1, 2 }, { 1, 1, 1, 1, 1, 1 } },
+
+    // Sierra
+    { 10, 5, { 1, 2, -2, -1, 0, 1, 2, -1, 0, 1 }, { 0, 0, 1, 1, 1, 1, 1, 2, 2, 2 }, { 5, 3, 2, 4, 5, 4, 2, 2, 3, 2 } },
+
+    // Bayer and blue noise don't diffuse
+    { 0 },
+    { 0 },
+};
+
+Dither ditherFromName(const char* name)
+{
+    for (int d = 1; d < DITHER_COUNT; ++d)
+    {
+        if (!_stricmp(name, gDitherNames[d])) return (Dither)d;
+    }
+    return DITHER_NONE;
+}
+
+// Sum of the 32 bit lanes
+int ditherTotal(__m128i v)
+{
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, 0x4e));
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, 0xb1));
+    return _mm_cvtsi128_si32(v);
+}
+
+// Chooses every cell's attribute.  As in beamCandidates(), the ink, paper and brightness are the pair whose segment
+// the pixels lie nearest, since that is what diffusing between the two colours can't make up.  ZX colours are corners
+// of a cube, so once each pixel is clamped to the cube of a brightness its nearest point on any segment is the one on
+// the whole line, and the distance of all 64 follows from their sums and products, taken once per cell and
+// brightness.  What the clamp takes off is added back.  Distances are weighted like the blur's, and ties go to the
+// shorter segment, whose dither is less noisy.
+void ditherAnalyse(const Image* target, u8* attrs)
+{
+    // Pixel moments are kept as red, green and blue squared, then red by green, red by blue and green by blue
+    static const int channels[6][2] = { { 0, 0 }, { 1, 1 }, { 2, 2 }, { 0, 1 }, { 0, 2 }, { 1, 2 } };
+    int weights[3] = { gBlurWeights[0], gBlurWeights[1], gBlurWeights[2] };
+    int level = channelRed(gZxColours[7]);      // Bright's is the top of the range, so only normal clamps
+    int colours[16][3];
+    int terms[8][8][6];                         // What each moment about ink adds to the projection onto the axis
+    int axes[8][8];                             // ...and the axis's squared length over the level's
+    f64 scales[8][8];                           // ...and one over that, or 0 if ink is paper
+
+    for (int i = 0; i < 16; ++i)
+    {
+        colours[i][0] = channelRed(gZxColours[i]);
+        colours[i][1] = channelGreen(gZxColours[i]);
+        colours[i][2] = channelBlue(gZxColours[i]);
+    }
+
+    // The axis from ink to paper is the level times a sign per channel, the same at either brightness, so the level
+    // cancels out of the projection
+    for (int ink = 0; ink < 8; ++ink)
+    {
+        for (int paper = ink; paper < 8; ++paper)
+        {
+            int signs[3];
+            axes[ink][paper] = 0;
+            for (int k = 0; k < 3; ++k)
+            {
+                signs[k] = (colours[paper][k] > colours[ink][k]) - (colours[paper][k] < colours[ink][k]);
+                axes[ink][paper] += signs[k] * signs[k] * weights[k];
+            }
+            scales[ink][paper] = axes[ink][paper] ? 1.0 / axes[ink][paper] : 0;
+            for (int m = 0; m < 6; ++m)
+            {
+                int j = channels[m][0], k = channels[m][1];
+                terms[ink][paper][m] = (j == k ? 1 : 2) * signs[j] * signs[k] * weights[j] * weights[k];
+            }
+        }
+    }
+
+    for (int cell = 0; cell < 768; ++cell)
+    {
+        const u32* pixels = &target->pixels[(cell / 32) * 8 * 256 + (cell % 32) * 8];
+        __m128i sumLanes[2][3], productLanes[2][6], overLanes[3];
+        int sums[2][3], products[2][6], clamped = 0;
+        f64 bestError = -1;
+        int bestLength = 0;
+
+        // A line of the cell is a vector of 8 16 bit lanes per channel, and madd squares and multiplies them
+        for (int k = 0; k < 6; ++k)
+        {
+            if (k < 3) sumLanes[0][k] = sumLanes[1][k] = overLanes[k] = _mm_setzero_si128();
+            productLanes[0][k] = productLanes[1][k] = _mm_setzero_si128();
+        }
+        for (int y = 0; y < 8; ++y, pixels += 256)
+        {
+            __m128i left = _mm_loadu_si128((const __m128i *)pixels);
+            __m128i right = _mm_loadu_si128((const __m128i *)(pixels + 4));
+            __m128i p[2][3];
+
+            for (int k = 0; k < 3; ++k)
+            {
+                __m128i shift = _mm_cvtsi32_si128(16 - k * 8);
+                __m128i over;
+                p[1][k] = _mm_packs_epi32(_mm_and_si128(_mm_srl_epi32(left, shift), _mm_set1_epi32(0xff)),
+                    _mm_and_si128(_mm_srl_epi32(right, shift), _mm_set1_epi32(0xff)));
+                p[0][k] = _mm_min_epi16(p[1][k], _mm_set1_epi16((i16)level));
+                over = _mm_sub_epi16(p[1][k], p[0][k]);
+                overLanes[k] = _mm_add_epi32(overLanes[k], _mm_madd_epi16(over, over));
+            }
+            for (int bright = 0; bright < 2; ++bright)
+            {
+                for (int k = 0; k < 3; ++k) sumLanes[bright][k] = _mm_add_epi16(sumLanes[bright][k], p[bright][k]);
+                for (int m = 0; m < 6; ++m)
+                {
+                    productLanes[bright][m] = _mm_add_epi32(productLanes[bright][m],
+                        _mm_madd_epi16(p[bright][channels[m][0]], p[bright][channels[m][1]]));
+                }
+            }
+        }
+        for (int bright = 0; bright < 2; ++bright)
+        {
+            for (int k = 0; k < 3; ++k)
+            {
+                sums[bright][k] = ditherTotal(_mm_madd_epi16(sumLanes[bright][k], _mm_set1_epi16(1)));
+                if (!bright) clamped += weights[k] * ditherTotal(overLanes[k]);
+            }
+            for (int m = 0; m < 6; ++m) products[bright][m] = ditherTotal(productLanes[bright][m]);
+        }
+
+        for (int bright = 0; bright < 2; ++bright)
+        {
+            int top = bright ? 255 : level;
+
+            for (int ink = 0; ink < 8; ++ink)
+            {
+                const int* a = colours[bright * 8 + ink];
+                i64 moments[6];                             // Of the pixels about ink
+                i64 distance = bright ? 0 : clamped;        // ...and the sum of their squared distances from it
+
+                for (int m = 0; m < 6; ++m)
+                {
+                    int j = channels[m][0], k = channels[m][1];
+                    moments[m] = products[bright][m] - a[j] * sums[bright][k] - a[k] * sums[bright][j] +
+                        64 * a[j] * a[k];
+                    if (m < 3) distance += weights[m] * moments[m];
+                }
+
+                for (int paper = ink; paper < 8; ++paper)
+                {
+                    const int* term = terms[ink][paper];
+                    int length = axes[ink][paper] * top * top;
+                    i64 along = 0;
+                    f64 error;
+
+                    for (int m = 0; m < 6; ++m) along += term[m] * moments[m];
+                    error = (f64)distance - (f64)along * scales[ink][paper];
+
+                    if (bestError < 0 || error < bestError || (error == bestError && length < bestLength))
+                    {
+                        bestError = error;
+                        bestLength = length;
+                        attrs[cell] = (u8)((bright << 6) | (paper << 3) | ink);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Writes the bitmap of scr, diffusing error with the kernel and every pixel limited to the two colours of its cell in
+// attrs.  strength scales the error passed on, out of 256.  A serpentine scan runs odd lines right to left, which
+// breaks up the diagonal patterns of a one-way scan.
+void ditherDiffuse(const Image* target, const u8* attrs, Dither dither, int strength, bool serpentine, u8* scr)
+{
+    const Kernel* kernel = &gKernels[dither];
+    int numTaps = kernel->count;
+    int shift = kernel->shift;
+    int weights[10];
+    int* taps[10];
+    int errors[3][(256 + 4) * 3];           // Three lines of error, two pixels of margin either side
+    int ink[32][3], paper[32][3], axis[32][3], middle[32];
+
+    memcpy(weights, kernel->weight, sizeof(weights));
+    memset(errors, 0, sizeof(errors));
+    for (int y = 0; y < 192; ++y)
+    {
+        bool reverse = serpentine && (y & 1);
+        int step = reverse ? -1 : 1;
+        int lastBit = reverse ? 0 : 7;      // Of each byte, in scan order
+        const u32* pixels = &target->pixels[y * 256];
+        int* line = &errors[y % 3][2 * 3];
+        int bits = 0;
+
+        // Where each tap lands, relative to the pixel being diffused
+        for (int t = 0; t < numTaps; ++t)
+        {
+            taps[t] = &errors[(y + kernel->dy[t]) % 3][(2 + (reverse ? -kernel->dx[t] : kernel->dx[t])) * 3];
+        }
+        memset(errors[(y + 2) % 3], 0, sizeof(errors[0]));
+
+        if (!(y & 7))
+        {
+            // The test for ink is which side of the plane half way between the two colours the pixel lies
+            for (int cx = 0; cx < 32; ++cx)
+            {
+                u8 attr = attrs[(y / 8) * 32 + cx];
+                u32 i = attrInk(attr), p = attrPaper(attr);
+                ink[cx][0] = channelRed(i);     paper[cx][0] = channelRed(p);
+                ink[cx][1] = channelGreen(i);   paper[cx][1] = channelGreen(p);
+                ink[cx][2] = channelBlue(i);    paper[cx][2] = channelBlue(p);
+                middle[cx] = 0;
+                for (int k = 0; k < 3; ++k)
+                {
+                    axis[cx][k] = ink[cx][k] - paper[cx][k];
+                    middle[cx] += (ink[cx][k] + paper[cx][k]) * axis[cx][k];
+                }
+            }
+        }
+
+        for (int i = 0, x = reverse ? 255 : 0; i < 256; ++i, x += step)
+        {
+            int cx = x >> 3;
+            u32 c = pixels[x];
+            int* e = line + x * 3;
+            int r = (int)((c >> 16) & 0xff) + (e[0] >> shift);
+            int g = (int)((c >> 8) & 0xff) + (e[1] >> shift);
+            int b = (int)(c & 0xff) + (e[2] >> shift);
+            int isInk;
+
+            r = r < 0 ? 0 : (r > 255 ? 255 : r);
+            g = g < 0 ? 0 : (g > 255 ? 255 : g);
+            b = b < 0 ? 0 : (b > 255 ? 255 : b);
+
+            // All ones for ink, without a branch: in dithered areas it would be mispredicted half the time
+            isInk = -(2 * (r * axis[cx][0] + g * axis[cx][1] + b * axis[cx][2]) > middle[cx]);
+            bits |= (isInk & 0x80) >> (x & 7);
+            if ((x & 7) == lastBit)
+            {
+                scr[scrimOffset(x, y)] = (u8)bits;
+                bits = 0;
+            }
+
+            r = (r - paper[cx][0] - (axis[cx][0] & isInk)) * strength >> 8;
+            g = (g - paper[cx][1] - (axis[cx][1] & isInk)) * strength >> 8;
+            b = (b - paper[cx][2] - (axis[cx][2] & isInk)) * strength >> 8;
+            for (int t = 0; t < numTaps; ++t)
+            {
+                int* d = taps[t] + x * 3;
+                d[0] += r * weights[t];
+                d[1] += g * weights[t];
+                d[2] += b * weights[t];
+            }
+        }
+    }
+}
+
+// A whole screen from a 256x192 target, attributes included
+void ditherScreen(const Image* target, Dither dither, u8* scr)
+{
+    TRACE_BEGIN(dither);
+    if (dither >= DITHER_BAYER)
+    {
+        orderedScreen(target, dither, 0, 0, scr);
+    }
+    else
+    {
+        ditherAnalyse(target, scr + 6144);
+        ditherDiffuse(target, scr + 6144, dither, 256, YES, scr);
+    }
+    TRACE_END(dither);
+}
+
+// Converts cv->target by error diffusion instead of by generations, leaving the screen and its error where a step
+// would.  Only the converter's target and scratch image are needed.
+void converterDither(Converter* cv, Dither dither)
+{
+    ditherScreen(cv->target, dither, cv->best);
+    cv->bestError = checkError(cv->scratch, cv->target, cv->best);
+    cv->evaluations = 1;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,570 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Export
+// Writing screens and population state to disk, directly or from a background thread
+//----------------------------------------------------------------------------------------------------------------------
+
+#include "zximg.h"
+
+#include <process.h>
+
+//----------------------------------------------------------------------------------------------------------------------
+// Screen export
+// A scrim is already a Spectrum screen ($4000-$5aff), so .scr is a straight copy.  .tap and .tzx wrap it in a
+// standard CODE header and data block that LOAD ""SCREEN$ understands, and .z80 is a 48K snapshot with the screen
+// in place and the CPU parked in a loop.  A ULAplus screen's palette follows it in a 6,976 byte .scr; the other
+// formats leave it out, as LOAD ""SCREEN$ has nowhere to put it.  Hi-colour screens need a Timex, which none of the
+// other formats describe, so they are always written as a 12,288 byte .scr, and Gigascreen pairs need a player, so
+// they are always written one frame after the other as a 13,824 byte .img would hold them.  A multicolour screen is
+// saved in two parts: a standard screen in any format, with the top block of each cell's attribute so it still looks
+// right on any machine, and the attribute stream a player needs, as it would be copied in, beside it in a .atr file.
+// Files are built in memory and written to a temporary name that is renamed over the target, so readers never see a
+// partial file.
+//----------------------------------------------------------------------------------------------------------------------
+
+const char* gFormatExtensions[4] = { ".scr", ".tap", ".tzx", ".z80" };
+
+// Format for an extension, with or without the dot
+ScrFormat formatFromExtension(const char* ext)
+{
+    if (ext && *ext == '.') ++ext;
+    for (int i = 0; ext && i < sizeof(gFormatExtensions) / sizeof(gFormatExtensions[0]); ++i)
+    {
+        if (!_stricmp(ext, gFormatExtensions[i] + 1)) return (ScrFormat)i;
+    }
+    return FORMAT_SCR;
+}
+
+ScrFormat formatFromName(const char* fileName)
+{
+    return formatFromExtension(strrchr(fileName, '.'));
+}
+
+void putWord(u8* out, int w)
+{
+    out[0] = (u8)w;
+    out[1] = (u8)(w >> 8);
+}
+
+// Writes a flag byte, the payload and the XOR checksum.  Returns the block length.
+size_t exportTapeBlock(u8* out, u8 flag, const u8* data, int size)
+{
+    u8 check = flag;
+    out[0] = flag;
+    for (int i = 0; i < size; ++i)
+    {
+        out[1 + i] = data[i];
+        check ^= data[i];
+    }
+    out[1 + size] = check;
+    return size + 2;
+}
+
+// Header and data blocks for "name" CODE 16384,6912.  TAP prefixes each block with its length, TZX wraps each in a
+// standard speed data block (ID $10) with a one second pause.
+size_t exportTape(u8* out, const char* name, const u8* scr, bool tzx)
+{
+    u8 header[17];
+    size_t size = 0;
+
+    header[0] = 3;
+    memset(header + 1, ' ', 10);
+    for (int i = 0; i < 10 && name[i] && name[i] != '.'; ++i)
+    {
+        header[1 + i] = (u8)name[i];
+    }
+    putWord(header + 11, 6912);
+    putWord(header + 13, 16384);
+    putWord(header + 15, 32768);
+
+    if (tzx)
+    {
+        memcpy(out, "ZXTape!\x1a\x01\x14", 10);
+        size = 10;
+    }
+
+    for (int block = 0; block < 2; ++block)
+    {
+        u8* len;
+        size_t blockSize;
+        if (tzx)
+        {
+            out[size++] = 0x10;
+            putWord(out + size, 1000);
+            size += 2;
+        }
+        len = out + size;
+        size += 2;
+        blockSize = block == 0 ? exportTapeBlock(out + size, 0x00, header, 17) : exportTapeBlock(out + size, 0xff, scr, 6912);
+        putWord(len, (int)blockSize);
+        size += blockSize;
+    }
+
+    return size;
+}
+
+// Byte offset of a 48K snapshot's RAM, counting from $4000: the screen, DI : JR $ at $8000, and zeroes elsewhere.
+// Reading RAM through this rather than building it in a buffer keeps the encoder free of state, so any number of
+// threads can export at once.
+u8 exportZ80Byte(const u8* scr, int offset)
+{
+    static const u8 loop[3] = { 0xf3, 0x18, 0xfe };
+
+    if (offset < 6912) return scr[offset];
+    if (offset >= 0x8000 - 0x4000 && offset < 0x8003 - 0x4000) return loop[offset - (0x8000 - 0x4000)];
+    return 0;
+}
+
+// Version 1 snapshot with ED ED run-length compression.  PC points at DI : JR $ in otherwise empty RAM.
+size_t exportZ80(u8* out, const u8* scr)
+{
+    size_t size = 30;
+    int i = 0;
+
+    memset(out, 0, 30);
+    putWord(out + 6, 0x8000);       // PC
+    putWord(out + 8, 0xff00);       // SP
+    out[10] = 0x3f;                 // I
+    out[12] = 0x20;                 // Black border, compressed
+    putWord(out + 23, 0x5c3a);      // IY
+    out[29] = 1;                    // IM 1
+
+    while (i < 49152)
+    {
+        u8 b = exportZ80Byte(scr, i);
+        int run = 1;
+        while (i + run < 49152 && exportZ80Byte(scr, i + run) == b && run < 255) ++run;
+
+        if (run >= 5 || (b == 0xed && run >= 2))
+        {
+            out[size++] = 0xed;
+            out[size++] = 0xed;
+            out[size++] = (u8)run;
+            out[size++] = b;
+            i += run;
+        }
+        else
+        {
+            out[size++] = b;
+            ++i;
+
+            // The byte after a lone ED is never part of a run
+            if (b == 0xed && i < 49152) out[size++] = exportZ80Byte(scr, i++);
+        }
+    }
+
+    out[size++] = 0x00;
+    out[size++] = 0xed;
+    out[size++] = 0xed;
+    out[size++] = 0x00;
+
+    return size;
+}
+
+// Encodes a screen of size bytes, as converterScreenSize() gives, for the given format into out, which must hold
+// EXPORT_MAX_SIZE bytes.  Returns the file size.
+size_t exportEncode(u8* out, ScrFormat format, const char* fileName, const u8* scr, int size)
+{
+    const char* name = fileName;
+    for (const char* s = fileName; *s; ++s)
+    {
+        if (*s == '\\' || *s == '/' || *s == ':') name = s + 1;
+    }
+
+    int height = multicolourHeight(size);
+    u8 standard[6912];
+
+    if (height)
+    {
+        memcpy(standard, scr, 6144);
+        for (int cell = 0; cell < 768; ++cell)
+        {
+            standard[6144 + cell] = scr[6144 + (cell / 32) * (8 / height) * 32 + cell % 32];
+        }
+        scr = standard;
+        size = 6912;
+    }
+
+    switch (size > 6912 + 64 ? FORMAT_SCR : format)
+    {
+    case FORMAT_TAP:    return exportTape(out, name, scr, NO);
+    case FORMAT_TZX:    return exportTape(out, name, scr, YES);
+    case FORMAT_Z80:    return exportZ80(out, scr);
+    default:            memcpy(out, scr, size); return size;
+    }
+}
+
+// Writes a whole file under a temporary name, flushes it to disk, then renames it over the real one.  The rename is
+// only written through once the contents are, so after a crash the file is either the old one or the new one.
+bool fileWriteAtomic(const char* fileName, const void* data, size_t size)
+{
+    char tempName[MAX_PATH + 32];
+    HANDLE f;
+    DWORD written = 0;
+    bool ok;
+
+    snprintf(tempName, sizeof(tempName), "%s.%lu.tmp", fileName, GetCurrentThreadId());
+    f = CreateFileA(tempName, GENERIC_WRITE, 0, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+    if (f == INVALID_HANDLE_VALUE) return NO;
+
+    ok = MAKE_BOOL(WriteFile(f, data, (DWORD)size, &written, 0) && written == size && FlushFileBuffers(f));
+    CloseHandle(f);
+
+    if (ok) ok = MAKE_BOOL(MoveFileExA(tempName, fileName, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH));
+    if (!ok) DeleteFileA(tempName);
+
+    return ok;
+}
+
+// Saves a screen in the format given by the file's extension, .scr if it isn't one we know.  A multicolour screen's
+// attribute stream goes to the same name with .atr added.
+bool exportScreen(const char* fileName, const u8* scr, int size)
+{
+    static __declspec(thread) u8 buffer[EXPORT_MAX_SIZE];
+    TRACE_BEGIN(export);
+    size_t encoded = exportEncode(buffer, formatFromName(fileName), fileName, scr, size);
+    bool ok = fileWriteAtomic(fileName, buffer, encoded);
+    if (ok && multicolourHeight(size))
+    {
+        char streamName[MAX_PATH];
+        snprintf(streamName, MAX_PATH, "%s.atr", fileName);
+        ok = fileWriteAtomic(streamName, scr + 6144, size - 6144);
+    }
+    TRACE_END(export);
+    return ok;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Population state
+// Everything needed to carry on a conversion exactly where it stopped: both populations with their cached errors,
+// the random number generator, counters and settings.  The file is a fixed header followed by the fixed part of the
+// two Population structures as they are in memory, then whichever mode arrays the mode has, in a set order.  The
+// header records the populations' size so a file from a differently built converter is rejected rather than misread,
+// and its flags say which modes, and so which arrays, to expect.  Resuming maps the file and copies straight out of
+// the mapping.
+//----------------------------------------------------------------------------------------------------------------------
+
+#define STATE_VERSION       6
+#define STATE_STAGNATED     1
+#define STATE_HYBRID        2
+#define STATE_BLUR          4
+#define STATE_ULAPLUS       8
+#define STATE_HICOLOUR      16
+#define STATE_GIGASCREEN    32
+#define STATE_SCRIM_ARRAYS  (768 * (sizeof(i32) + sizeof(i64)) + 64 + 6912)     // Every mode array of one scrim
+#define STATE_MAX_SIZE      (sizeof(StateHeader) + 2 * (POPULATION_FIXED_SIZE + STATE_SCRIM_ARRAYS * POPULATION_SIZE))
+
+typedef struct
+{
+    char    magic[4];               // "ZXPS"
+    u32     version;
+    u32     headerSize;
+    u32     populationSize;
+    u32     genomeSize;
+    u32     populationBytes;
+    u32     targetHash;             // So a state isn't resumed against a different image
+    u32     flags;
+    u64     rngState;
+    i64     generation;
+    i64     evaluations;
+    i64     bestError;
+    i64     stagnationError;
+    i64     stagnationGeneration;
+    f64     elapsed;                // Seconds optimised so far, so time budgets carry on rather than restart
+    f64     mutationChance;
+    i64     stagnationWindow;
+    f64     stagnationEpsilon;
+    i32     stagnationAction;
+    i32     stagnationElite;
+    f32     stagnationBoost;
+    f32     blurSigma;
+    i32     blockHeight;            // Lines per attribute in hi-colour and multicolour modes
+    u8      best[SCREEN_MAX_SIZE];
+}
+StateHeader;
+
+// FNV-1a over the target pixels
+u32 targetHash(const Image* target)
+{
+    const u8* p = (const u8 *)target->pixels;
+    size_t size = (size_t)target->width * target->height * sizeof(u32);
+    u32 h = 2166136261u;
+    for (size_t i = 0; i < size; ++i)
+    {
+        h = (h ^ p[i]) * 16777619u;
+    }
+    return h;
+}
+
+// Saves one of a population's mode arrays, if it has it, to a state at offset, or loads it from there, and moves the
+// offset past it.  Without a state only the offset moves.
+void stateArray(void* array, size_t size, u8* state, size_t* offset, bool save)
+{
+    if (!array) return;
+    if (state && save) memcpy(state + *offset, array, size);
+    else if (state) memcpy(array, state + *offset, size);
+    *offset += size;
+}
+
+// ...and all of them.  Returns the offset after them.
+size_t stateArrays(Population* pop, u8* state, size_t offset, bool save)
+{
+    stateArray(pop->cellScores, 768 * POPULATION_SIZE * sizeof(i32), state, &offset, save);
+    stateArray(pop->cellErrors, 768 * POPULATION_SIZE * sizeof(i64), state, &offset, save);
+    stateArray(pop->palettes, 64 * POPULATION_SIZE, state, &offset, save);
+    stateArray(pop->frames, 6912 * POPULATION_SIZE, state, &offset, save);
+    return offset;
+}
+
+// Encodes the converter's state into out, which must hold STATE_MAX_SIZE bytes.  Returns the size.
+size_t stateEncode(u8* out, const Converter* cv, f64 elapsed)
+{
+    StateHeader* h = (StateHeader *)out;
+    size_t size = sizeof(StateHeader) + 2 * POPULATION_FIXED_SIZE;
+
+    memset(h, 0, sizeof(StateHeader));
+    memcpy(h->magic, "ZXPS", 4);
+    h->version = STATE_VERSION;
+    h->headerSize = sizeof(StateHeader);
+    h->populationSize = POPULATION_SIZE;
+    h->genomeSize = 6912;
+    h->populationBytes = POPULATION_FIXED_SIZE;
+    h->targetHash = targetHash(cv->target);
+    h->flags = (cv->stagnated ? STATE_STAGNATED : 0) | (cv->cellErrors ? STATE_HYBRID : 0) |
+        (cv->blur ? STATE_BLUR : 0) | (cv->ulaplus ? STATE_ULAPLUS : 0) | (cv->rowErrors ? STATE_HICOLOUR : 0) |
+        (cv->blends ? STATE_GIGASCREEN : 0);
+    h->rngState = cv->rng.state;
+    h->generation = cv->generation;
+    h->evaluations = cv->evaluations;
+    h->bestError = cv->bestError;
+    h->stagnationError = cv->stagnationError;
+    h->stagnationGeneration = cv->stagnationGeneration;
+    h->elapsed = elapsed;
+    h->mutationChance = cv->mutationChance;
+    h->stagnationWindow = cv->stagnation.window;
+    h->stagnationEpsilon = cv->stagnation.epsilon;
+    h->stagnationAction = cv->stagnation.action;
+    h->stagnationElite = cv->stagnation.elite;
+    h->stagnationBoost = cv->stagnation.boost;
+    h->blurSigma = cv->blur ? cv->blur->sigma : 0;
+    h->blockHeight = cv->rowErrors ? cv->blockHeight : 0;
+    memcpy(h->best, cv->best, SCREEN_MAX_SIZE);
+
+    memcpy(out + sizeof(StateHeader), cv->current, POPULATION_FIXED_SIZE);
+    memcpy(out + sizeof(StateHeader) + POPULATION_FIXED_SIZE, cv->future, POPULATION_FIXED_SIZE);
+    size = stateArrays(cv->current, out, size, YES);
+    size = stateArrays(cv->future, out, size, YES);
+
+    return size;
+}
+
+bool stateSave(const char* fileName, const Converter* cv, f64 elapsed)
+{
+    u8* buffer = (u8 *)malloc(STATE_MAX_SIZE);
+    bool ok = fileWriteAtomic(fileName, buffer, stateEncode(buffer, cv, elapsed));
+    free(buffer);
+    return ok;
+}
+
+// Sets up a converter from a state file instead of converterInit().  Returns 0 on success, with the time already
+// spent in *elapsed, or what is wrong with the file.
+const char* converterResume(Converter* cv, Image* target, const char* fileName, f64* elapsed)
+{
+    Data data = dataLoad(fileName);
+    const StateHeader* h = (const StateHeader *)data.buffer;
+    const char* error = 0;
+
+    if (!data.buffer) return "cannot open file";
+    if (data.size < sizeof(StateHeader) || memcmp(h->magic, "ZXPS", 4))                 error = "not a state file";
+    else if (h->version != STATE_VERSION || h->headerSize != sizeof(StateHeader))       error = "unsupported version";
+    else if (h->populationSize != POPULATION_SIZE || h->genomeSize != 6912 ||
+             h->populationBytes != POPULATION_FIXED_SIZE)                               error = "different population";
+    else if (h->targetHash != targetHash(target))                                       error = "different image";
+
+    if (!error)
+    {
+        size_t offset = sizeof(StateHeader) + 2 * POPULATION_FIXED_SIZE;
+
+        // The modes allocate their arrays, which then say how much more there is to load
+        converterInit(cv, target, 0);
+        if (h->flags & STATE_HYBRID) converterHybrid(cv);
+        if (h->flags & STATE_BLUR) converterBlur(cv, h->blurSigma);
+        if (h->flags & STATE_ULAPLUS) converterUlaplus(cv, NO);
+        if (h->flags & STATE_GIGASCREEN) converterGigascreen(cv, NO);
+        if (data.size < (i64)stateArrays(cv->future, 0, stateArrays(cv->current, 0, offset, NO), NO))
+        {
+            error = "different population";
+        }
+    }
+
+    if (!error)
+    {
+        size_t offset = sizeof(StateHeader) + 2 * POPULATION_FIXED_SIZE;
+
+        memcpy(cv->current, data.buffer + sizeof(StateHeader), POPULATION_FIXED_SIZE);
+        memcpy(cv->future, data.buffer + sizeof(StateHeader) + POPULATION_FIXED_SIZE, POPULATION_FIXED_SIZE);
+        offset = stateArrays(cv->current, data.buffer, offset, NO);
+        stateArrays(cv->future, data.buffer, offset, NO);
+        memcpy(cv->best, h->best, SCREEN_MAX_SIZE);
+        cv->rng.state = h->rngState;
+        cv->generation = h->generation;
+        cv->evaluations = h->evaluations;
+        cv->bestError = h->bestError;
+        cv->stagnationError = h->stagnationError;
+        cv->stagnationGeneration = h->stagnationGeneration;
+        cv->stagnated = MAKE_BOOL(h->flags & STATE_STAGNATED);
+        if (h->flags & STATE_HICOLOUR) converterHicolour(cv, h->blockHeight, NO);
+        cv->mutationChance = (f32)h->mutationChance;
+        cv->stagnation.window = h->stagnationWindow;
+        cv->stagnation.epsilon = h->stagnationEpsilon;
+        cv->stagnation.action = (StagnationAction)h->stagnationAction;
+        cv->stagnation.elite = h->stagnationElite;
+        cv->stagnation.boost = h->stagnationBoost;
+        *elapsed = h->elapsed;
+    }
+
+    dataUnload(data);
+    return error;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Checkpoints
+// Optimisers post their best screen so far, and optionally their whole state, into a slot and carry on; a background
+// thread saves whatever is newest in each slot.  Posting a screen only copies its bytes, 6,912 of them for a standard
+// one, and a slot that is posted to again before it is saved just gets the newer screen.  State is encoded straight
+// into the slot's buffer, which the thread swaps for its own before writing, so a post never waits for the disk.
+//----------------------------------------------------------------------------------------------------------------------
+
+unsigned __stdcall checkpointWorker(void* arg)
+{
+    Checkpointer* cp = (Checkpointer *)arg;
+    char fileName[MAX_PATH];
+    u8 scr[SCREEN_MAX_SIZE];
+    int size = 0;
+    u8* state = 0;
+    size_t stateSize = 0;
+
+    traceThreadName("checkpoint");
+
+    AcquireSRWLockExclusive(&cp->lock);
+    for (;;)
+    {
+        CheckpointSlot* s;
+        int slot = -1;
+        for (int i = 0; i < cp->numSlots && slot < 0; ++i)
+        {
+            if (cp->slots[i].pending || cp->slots[i].statePending) slot = i;
+        }
+        if (slot < 0)
+        {
+            if (cp->quit) break;
+            SleepConditionVariableSRW(&cp->wake, &cp->lock, INFINITE, 0);
+            continue;
+        }
+
+        s = &cp->slots[slot];
+        cp->busySlot = slot;
+        if (s->pending)
+        {
+            memcpy(fileName, s->fileName, MAX_PATH);
+            size = s->size;
+            memcpy(scr, s->scr, size);
+            s->pending = NO;
+            ReleaseSRWLockExclusive(&cp->lock);
+
+            exportScreen(fileName, scr, size);
+        }
+        else
+        {
+            memcpy(fileName, s->stateName, MAX_PATH);
+            state = s->state;
+            stateSize = s->stateSize;
+            s->state = cp->stateBuffer;
+            cp->stateBuffer = state;
+            s->statePending = NO;
+            ReleaseSRWLockExclusive(&cp->lock);
+
+            fileWriteAtomic(fileName, state, stateSize);
+        }
+
+        AcquireSRWLockExclusive(&cp->lock);
+        cp->busySlot = -1;
+        WakeAllConditionVariable(&cp->saved);
+    }
+    ReleaseSRWLockExclusive(&cp->lock);
+
+    return 0;
+}
+
+void checkpointInit(Checkpointer* cp, int numSlots)
+{
+    memset(cp, 0, sizeof(Checkpointer));
+    InitializeSRWLock(&cp->lock);
+    InitializeConditionVariable(&cp->wake);
+    InitializeConditionVariable(&cp->saved);
+    cp->slots = (CheckpointSlot *)calloc(numSlots, sizeof(CheckpointSlot));
+    cp->numSlots = numSlots;
+    cp->busySlot = -1;
+    cp->thread = (HANDLE)_beginthreadex(0, 0, &checkpointWorker, cp, 0, 0);
+}
+
+void checkpointPost(Checkpointer* cp, int slot, const char* fileName, const u8* scr, int size)
+{
+    AcquireSRWLockExclusive(&cp->lock);
+    strncpy(cp->slots[slot].fileName, fileName, MAX_PATH - 1);
+    memcpy(cp->slots[slot].scr, scr, size);
+    cp->slots[slot].size = size;
+    cp->slots[slot].pending = YES;
+    WakeConditionVariable(&cp->wake);
+    ReleaseSRWLockExclusive(&cp->lock);
+}
+
+// Encodes the converter's state into the slot, under the lock so the writer never sees half of it.  The buffers are
+// allocated on first use, so checkpointers that only ever save screens don't pay for them.
+void checkpointPostState(Checkpointer* cp, int slot, const char* fileName, const Converter* cv, f64 elapsed)
+{
+    CheckpointSlot* s = &cp->slots[slot];
+
+    AcquireSRWLockExclusive(&cp->lock);
+    if (!s->state) s->state = (u8 *)malloc(STATE_MAX_SIZE);
+    if (!cp->stateBuffer) cp->stateBuffer = (u8 *)malloc(STATE_MAX_SIZE);
+    strncpy(s->stateName, fileName, MAX_PATH - 1);
+    s->stateSize = stateEncode(s->state, cv, elapsed);
+    s->statePending = YES;
+    WakeConditionVariable(&cp->wake);
+    ReleaseSRWLockExclusive(&cp->lock);
+}
+
+// Drops anything not yet saved for the slot and waits for a save in progress, so the caller can write the final
+// screen without a stale checkpoint landing on top of it.
+void checkpointCancel(Checkpointer* cp, int slot)
+{
+    AcquireSRWLockExclusive(&cp->lock);
+    cp->slots[slot].pending = NO;
+    cp->slots[slot].statePending = NO;
+    while (cp->busySlot == slot)
+    {
+        SleepConditionVariableSRW(&cp->saved, &cp->lock, INFINITE, 0);
+    }
+    ReleaseSRWLockExclusive(&cp->lock);
+}
+
+// Saves whatever is still pending and stops the thread.
+void checkpointDone(Checkpointer* cp)
+{
+    AcquireSRWLockExclusive(&cp->lock);
+    cp->quit = YES;
+    WakeConditionVariable(&cp->wake);
+    ReleaseSRWLockExclusive(&cp->lock);
+
+    WaitForSingleObject(cp->thread, INFINITE);
+    CloseHandle(cp->thread);
+    for (int i = 0; i < cp->numSlots; ++i)
+    {
+        free(cp->slots[i].state);
+    }
+    free(cp->stateBuffer);
+    free(cp->slots);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,505 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Random numbers
+// Every converter owns its own generator so jobs running on different threads neither share state nor produce the
+// same sequence, and a run can be repeated from its seed.
+//----------------------------------------------------------------------------------------------------------------------
+
+#include "zximg.h"
+
+void rngSeed(Rng* rng, u64 seed)
+{
+    // splitmix64 spreads similar seeds (job indices, timestamps) over the whole state space
+    u64 z = seed + 0x9e3779b97f4a7c15ull;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    z ^= z >> 31;
+    rng->state = z ? z : 1;
+}
+
+// xorshift64*
+u64 rngNext64(Rng* rng)
+{
+    u64 x = rng->state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    rng->state = x;
+    return x * 0x2545f4914f6cdd1dull;
+}
+
+u32 rngNext(Rng* rng)
+{
+    return (u32)(rngNext64(rng) >> 32);
+}
+
+// Uniform integer in [0, n)
+u32 rngRange(Rng* rng, u32 n)
+{
+    return (u32)(((u64)rngNext(rng) * n) >> 32);
+}
+
+// Uniform float in [0, 1)
+f32 rngFloat(Rng* rng)
+{
+    return (f32)(rngNext(rng) >> 8) * (1.0f / 16777216.0f);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Genetic Algorithm
+// Our lifeforms, scrims, describe a screen
+//----------------------------------------------------------------------------------------------------------------------
+
+const char* gEventNames[5] =
+{
+    "none", "improved", "stagnated", "restarted", "boosted",
+};
+
+void generateScrim(Rng* rng, u8* bytes)
+{
+    for (int i = 0; i < 6912; i += 8)
+    {
+        u64 r = rngNext64(rng);
+        memcpy(bytes + i, &r, 8);
+    }
+}
+
+Population* populationCreate()
+{
+    Population* pop = (Population *)memAlloc(sizeof(Population));
+    memset(pop, 0, sizeof(Population));
+    return pop;
+}
+
+// A cleared mode array of size bytes for every scrim of a population.  Memory comes from the current arena.
+void* populationArray(size_t size)
+{
+    void* array = memAlloc(size * POPULATION_SIZE);
+    memset(array, 0, size * POPULATION_SIZE);
+    return array;
+}
+
+void populationDestroy(Population* pop)
+{
+    if (pop->cellScores) memFree(pop->cellScores);
+    if (pop->cellErrors) memFree(pop->cellErrors);
+    if (pop->palettes) memFree(pop->palettes);
+    if (pop->frames) memFree(pop->frames);
+    memFree(pop);
+}
+
+void generatePopulation(Rng* rng, Population *pop)
+{
+    int offset = 0;
+    for (int i = 0; i < POPULATION_SIZE; ++i)
+    {
+        generateScrim(rng, &pop->genomes[offset]);
+        offset += 6912;
+        pop->errors[i] = 0;
+        pop->parents[i] = -1;
+    }
+
+    pop->total = 0;
+    pop->indexBest = -1;
+}
+
+i64 checkError(Image* img, Image* targetImg, u8* genome)
+{
+    i64 total = 0;
+
+    imageZxConvert(img, genome);
+
+    for (int i = 0; i < (256 * 192); ++i)
+    {
+        total += abs(img->pixels[i] - targetImg->pixels[i]);
+    }
+
+    return total;
+}
+
+i64 chooseParent(Rng* rng, Population* pop)
+{
+    i64 r = (i64)(rngNext64(rng) % (u64)pop->total);
+    i64 min = 0;
+    i64 max = POPULATION_SIZE - 1;
+
+    // Find the last scrim whose slice of the running total starts at or before r
+    while (min < max)
+    {
+        i64 index = (min + max + 1) / 2;
+
+        if (pop->fitness[index] <= r)
+        {
+            min = index;
+        }
+        else
+        {
+            max = index - 1;
+        }
+    }
+
+    return min;
+}
+
+u8 mutate(Rng* rng, u8 b, f32 chance)
+{
+    f32 r = rngFloat(rng);
+    if (r < chance)
+    {
+        int r = rngRange(rng, 8);
+        b ^= (1 << r);
+    }
+
+    return b;
+}
+
+// Single point cross-over of size bytes, mutating as we copy.  Returns the last byte taken from mum.
+int crossover(Rng* rng, const u8* mum, const u8* dad, u8* child, int size, f32 mutationChance)
+{
+    int r = rngRange(rng, size);
+    int i = 0;
+    for (; i <= r; ++i)
+    {
+        child[i] = mutate(rng, mum[i], mutationChance);
+    }
+    for (; i < size; ++i)
+    {
+        child[i] = mutate(rng, dad[i], mutationChance);
+    }
+    return r;
+}
+
+void generate(Converter* cv, Population* curPop, Population* futurePop)
+{
+    Rng* rng = &cv->rng;
+    int start = cv->cellErrors ? 6144 : 0;                    // Only the attributes evolve in hybrid mode
+    int end = cv->rowErrors ? 6144 / cv->blockHeight : 6912;  // ...and in hi-colour modes they are all there is
+    if (cv->liveCells) end = cv->numLive * 9;                 // Animation genomes only hold the cells that changed
+
+    // First calculate the errors of the current population
+    TRACE_BEGIN(evaluate);
+    STATS_BEGIN(PHASE_SCORE);
+    curPop->worseScore = 0;
+    curPop->indexBest = -1;
+    for (int i = 0, offset = 0; i < POPULATION_SIZE; ++i, offset += 6912)
+    {
+        i64 t = cv->liveCells ? animationError(cv, curPop, i, futurePop) :
+            cv->cellErrors ? hybridError(cv, &curPop->genomes[offset]) :
+            cv->rowErrors ? hicolourError(cv, curPop, i, futurePop) :
+            cv->ulaplus ? ulaplusError(cv, curPop, i, futurePop) :
+            cv->blends ? gigascreenError(cv, curPop, i, futurePop) :
+            cv->blur ? blurError(cv, curPop, i, futurePop) :
+            checkError(cv->scratch, cv->target, &curPop->genomes[offset]);
+        if (curPop->indexBest == -1 || t < curPop->bestScore)
+        {
+            curPop->bestScore = t;
+            curPop->indexBest = i;
+        }
+        if (t > curPop->worseScore)
+        {
+            curPop->worseScore = t;
+        }
+        curPop->errors[i] = t;
+    }
+    cv->evaluations += POPULATION_SIZE;
+    STATS_END(PHASE_SCORE);
+    TRACE_END(evaluate);
+
+    // Now convert the errors so that the smallest are the largest, and vice versa.  The +1 keeps the worst scrim
+    // selectable and the total non-zero when they are all equal.
+    TRACE_BEGIN(reproduce);
+    {
+        STATS_BEGIN(PHASE_SELECT);
+        curPop->total = 0;
+        for (int i = 0; i < POPULATION_SIZE; ++i)
+        {
+            curPop->fitness[i] = curPop->total;
+            curPop->total += curPop->worseScore - curPop->errors[i] + 1;
+        }
+        STATS_END(PHASE_SELECT);
+    }
+
+    // Now we generate next population
+    for (int i = 0, offset = 0; i < POPULATION_SIZE; ++i, offset += 6912)
+    {
+        i64 parents[2];
+        i64 palette = 0;            // Scrim the child's ULAplus palette comes from
+        {
+            STATS_BEGIN(PHASE_SELECT);
+            for (int p = 0; p < 2; ++p)
+            {
+                parents[p] = chooseParent(rng, curPop);
+            }
+            STATS_END(PHASE_SELECT);
+        }
+
+        // Decide whether to do cross-over or not
+        {
+            f32 chance = rngFloat(rng);
+            if (chance < CROSSOVER_CHANCE)
+            {
+                int r;
+                STATS_BEGIN(PHASE_CROSSOVER);
+                r = crossover(rng, &curPop->genomes[parents[0] * 6912 + start],
+                    &curPop->genomes[parents[1] * 6912 + start], &futurePop->genomes[offset + start], end - start,
+                    cv->mutationChance);
+
+                // Blur mode re-scores whatever differs from this parent, so it's whichever gave the child more
+                futurePop->parents[i] = (i32)parents[2 * r < end - start ? 1 : 0];
+                palette = parents[1];
+
+                // Both Gigascreen frames are cut in the same place, so every cell keeps a matching pair
+                for (int i = 0; cv->blends && i < 6912; ++i)
+                {
+                    futurePop->frames[offset + i] =
+                        mutate(rng, curPop->frames[parents[i <= r ? 0 : 1] * 6912 + i], cv->mutationChance);
+                }
+                STATS_END(PHASE_CROSSOVER);
+            }
+            else
+            {
+                int r = rngRange(rng, 2);
+                STATS_BEGIN(PHASE_MUTATE);
+                for (int i = start; i < end; ++i)
+                {
+                    futurePop->genomes[offset + i] =
+                        mutate(rng, curPop->genomes[parents[r] * 6912 + i], cv->mutationChance);
+                }
+                futurePop->parents[i] = (i32)parents[r];
+                palette = parents[r];
+                for (int i = 0; cv->blends && i < 6912; ++i)
+                {
+                    futurePop->frames[offset + i] =
+                        mutate(rng, curPop->frames[parents[r] * 6912 + i], cv->mutationChance);
+                }
+                STATS_END(PHASE_MUTATE);
+            }
+        }
+
+        // A ULAplus palette comes after the attributes, so it goes with the end of the genome
+        if (cv->ulaplus)
+        {
+            for (int e = 0; e < 64; ++e)
+            {
+                futurePop->palettes[i * 64 + e] = mutate(rng, curPop->palettes[palette * 64 + e], cv->mutationChance);
+            }
+        }
+    }
+    TRACE_END(reproduce);
+}
+
+// Sets up a converter for a 256x192 target.  All memory comes from the current arena.
+void converterInit(Converter* cv, Image* target, u64 seed)
+{
+    cv->target = target;
+    cv->scratch = imageCreate(256, 192);
+    cv->current = populationCreate();
+    cv->future = populationCreate();
+    cv->generation = 0;
+    cv->evaluations = 0;
+    cv->bestError = -1;
+    cv->mutationChance = MUTATION_CHANCE;
+    memset(&cv->stagnation, 0, sizeof(Stagnation));
+    cv->stagnationError = -1;
+    cv->stagnationGeneration = 0;
+    cv->stagnated = NO;
+    cv->cellErrors = 0;
+    cv->blur = 0;
+    cv->ulaplus = NO;
+    cv->rowErrors = 0;
+    cv->blockHeight = 0;
+    cv->blends = 0;
+    cv->still = 0;
+    cv->liveCells = 0;
+    cv->numLive = 0;
+    cv->stillError = 0;
+    rngSeed(&cv->rng, seed);
+    generatePopulation(&cv->rng, cv->current);
+}
+
+// Bytes in the converter's screens: a standard screen, followed by its palette in ULAplus mode or by its second
+// frame in Gigascreen mode, or a hi-colour one, or a bitmap followed by a multicolour attribute stream
+int converterScreenSize(const Converter* cv)
+{
+    return cv->blends ? 6912 * 2 : cv->rowErrors ? 6144 + 6144 / cv->blockHeight : cv->ulaplus ? 6912 + 64 : 6912;
+}
+
+// Runs one generation.  Afterwards cv->current holds the new, not yet scored, population and cv->future the one
+// that was just scored.  Returns what happened as far as stagnation detection is concerned.
+ConverterEvent converterStep(Converter* cv)
+{
+    Population* pop = cv->current;
+    Stagnation* st = &cv->stagnation;
+    ConverterEvent event = EVENT_NONE;
+
+    if (cv->stagnated) return EVENT_NONE;
+
+    generate(cv, cv->current, cv->future);
+    if (cv->bestError < 0 || pop->bestScore < cv->bestError)
+    {
+        cv->bestError = pop->bestScore;
+        memcpy(cv->best, &pop->genomes[pop->indexBest * 6912], 6912);
+        if (cv->cellErrors) hybridBitmap(cv, cv->best);
+        if (cv->ulaplus) memcpy(cv->best + 6912, &pop->palettes[pop->indexBest * 64], 64);
+        if (cv->rowErrors) hicolourBitmap(cv, cv->best);
+        if (cv->blends) memcpy(cv->best + 6912, &pop->frames[pop->indexBest * 6912], 6912);
+        if (cv->liveCells) animationScreen(cv, cv->best);
+    }
+
+    cv->current = cv->future;
+    cv->future = pop;
+    ++cv->generation;
+
+    if (cv->stagnationError < 0)
+    {
+        cv->stagnationError = cv->bestError;
+        cv->stagnationGeneration = cv->generation;
+    }
+    else if (cv->bestError < cv->stagnationError &&
+             (f64)cv->bestError <= (f64)cv->stagnationError * (1.0 - st->epsilon))
+    {
+        cv->stagnationError = cv->bestError;
+        cv->stagnationGeneration = cv->generation;
+        cv->mutationChance = MUTATION_CHANCE;
+        event = EVENT_IMPROVED;
+    }
+    else if (st->window && cv->generation - cv->stagnationGeneration >= st->window)
+    {
+        switch (st->action)
+        {
+        case STAGNATION_STOP:
+            cv->stagnated = YES;
+            event = EVENT_STAGNATED;
+            break;
+
+        case STAGNATION_RESTART:
+            converterRestart(cv);
+            event = EVENT_RESTARTED;
+            break;
+
+        case STAGNATION_BOOST:
+            cv->mutationChance *= st->boost > 1 ? st->boost : 2;
+            if (cv->mutationChance > 0.5f) cv->mutationChance = 0.5f;
+            event = EVENT_BOOSTED;
+            break;
+        }
+        cv->stagnationGeneration = cv->generation;
+    }
+
+    return event;
+}
+
+// Replaces the population about to be scored with the elite of the last scored one plus fresh random scrims.
+void converterRestart(Converter* cv)
+{
+    const Population* scored = cv->future;
+    Population* next = cv->current;
+    bool taken[POPULATION_SIZE] = { 0 };
+    u8 palette[64];
+    int elite = cv->stagnation.elite < POPULATION_SIZE ? cv->stagnation.elite : POPULATION_SIZE;
+    int i = 0;
+
+    // Selection by repeated minimum; the population is small and restarts are rare
+    for (; i < elite; ++i)
+    {
+        int best = -1;
+        for (int j = 0; j < POPULATION_SIZE; ++j)
+        {
+            if (!taken[j] && (best < 0 || scored->errors[j] < scored->errors[best])) best = j;
+        }
+        taken[best] = YES;
+        memcpy(&next->genomes[i * 6912], &scored->genomes[best * 6912], 6912);
+        if (cv->ulaplus) memcpy(&next->palettes[i * 64], &scored->palettes[best * 64], 64);
+        if (cv->blends) memcpy(&next->frames[i * 6912], &scored->frames[best * 6912], 6912);
+        next->parents[i] = best;
+    }
+    if (cv->ulaplus) ulaplusDefault(palette);
+    for (; i < POPULATION_SIZE; ++i)
+    {
+        generateScrim(&cv->rng, &next->genomes[i * 6912]);
+        if (cv->ulaplus) memcpy(&next->palettes[i * 64], palette, 64);
+        if (cv->blends) generateScrim(&cv->rng, &next->frames[i * 6912]);
+        next->parents[i] = -1;
+    }
+    cv->mutationChance = MUTATION_CHANCE;
+}
+
+// Appends one CSV line per event: name,time,generation,evaluations,error,event
+void converterLog(FILE* f, const char* name, const Converter* cv, ConverterEvent event, f64 time)
+{
+    if (!f || event == EVENT_NONE) return;
+    fprintf(f, "%s,%.3f,%lld,%lld,%lld,%s\n", name, time, cv->generation, cv->evaluations, cv->bestError,
+        gEventNames[event]);
+}
+
+// Gives back the converter's memory.  Only needed when it didn't come from an arena that is about to be reset.
+void converterDone(Converter* cv)
+{
+    if (cv->blur)
+    {
+        memFree(cv->blur->target);
+        memFree(cv->blur);
+    }
+    if (cv->cellErrors) memFree(cv->cellErrors);
+    if (cv->rowErrors) memFree(cv->rowErrors);
+    if (cv->blends) memFree(cv->blends);
+    if (cv->liveCells)
+    {
+        memFree(cv->liveCells);
+        memFree(cv->still);
+    }
+    populationDestroy(cv->future);
+    populationDestroy(cv->current);
+    memFree(cv->scratch);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Snapshots
+// A sequence lock around the best scrim.  Publishing only happens when the best error improves, so readers rarely
+// have to retry, and the converter's thread never waits for them.
+//----------------------------------------------------------------------------------------------------------------------
+
+void snapshotInit(Snapshot* snap)
+{
+    memset(snap, 0, sizeof(Snapshot));
+    snap->error = -1;
+}
+
+// Only ever called from one thread
+void snapshotPublish(Snapshot* snap, const Converter* cv)
+{
+    InterlockedIncrement(&snap->sequence);
+    snap->error = cv->bestError;
+    snap->evaluations = cv->evaluations;
+    memcpy(snap->best, cv->best, SCREEN_MAX_SIZE);
+    InterlockedIncrement(&snap->sequence);
+}
+
+// Copies the newest screen, SCREEN_MAX_SIZE bytes whatever its size, if it has changed since *lastSequence and returns
+// YES, or returns NO without copying.
+bool snapshotRead(Snapshot* snap, LONG* lastSequence, u8* best, i64* error)
+{
+    for (;;)
+    {
+        LONG sequence = snap->sequence;
+        if (sequence == *lastSequence) return NO;
+        if (sequence & 1)
+        {
+            YieldProcessor();
+            continue;
+        }
+
+        MemoryBarrier();
+        memcpy(best, snap->best, SCREEN_MAX_SIZE);
+        *error = snap->error;
+        MemoryBarrier();
+
+        if (snap->sequence == sequence)
+        {
+            *lastSequence = sequence;
+            return YES;
+        }
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
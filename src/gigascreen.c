@@ -0,0 +1,179 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Gigascreen
+// Two screens shown on alternate frames, which the eye averages into one with far more colours.  In Gigascreen mode
+// a scrim is a pair of screens: the usual 6,912 bytes and a second frame kept alongside, which breeds with it.  Every
+// pixel is the average of one of 16 colours from each frame, so the 256 averages are worked out once, and a cell is
+// scored by picking its four blends of ink and paper and selecting between them a row at a time.  As in ULAplus mode
+// a child starts from its parent's cell errors and only re-scores the cells that differ in either frame.
+//----------------------------------------------------------------------------------------------------------------------
+
+#include "zximg.h"
+
+#include <emmintrin.h>
+
+// The average of every pair of colours, indexed by the first frame's colour then the second's
+void gigascreenBlends(u32* blends)
+{
+    for (int i = 0; i < 16; ++i)
+    {
+        for (int j = 0; j < 16; ++j)
+        {
+            u32 a = gZxColours[i], b = gZxColours[j];
+            blends[i * 16 + j] = (u32)((((channelRed(a) + channelRed(b) + 1) >> 1) << 16) |
+                (((channelGreen(a) + channelGreen(b) + 1) >> 1) << 8) | ((channelBlue(a) + channelBlue(b) + 1) >> 1));
+        }
+    }
+}
+
+// Blends of a cell's ink and paper in each frame, as paper in both and what ink in the first, the second and both
+// change about it
+void gigascreenCellColours(const u32* blends, u8 attr, u8 attr2, __m128i colours[4])
+{
+    int ink = (attr & 7) + ((attr & 0x40) >> 3), paper = (attr & 0x7f) >> 3;
+    int ink2 = (attr2 & 7) + ((attr2 & 0x40) >> 3), paper2 = (attr2 & 0x7f) >> 3;
+    u32 both = blends[paper * 16 + paper2];
+    u32 first = blends[ink * 16 + paper2] ^ both;
+    u32 second = blends[paper * 16 + ink2] ^ both;
+
+    colours[0] = _mm_set1_epi32((int)both);
+    colours[1] = _mm_set1_epi32((int)first);
+    colours[2] = _mm_set1_epi32((int)second);
+    colours[3] = _mm_set1_epi32((int)(blends[ink * 16 + ink2] ^ both ^ first ^ second));
+}
+
+// Four pixels of a row from their bits in each frame
+__m128i gigascreenPixels(const __m128i colours[4], __m128i bits, __m128i b, __m128i b2)
+{
+    __m128i ink = _mm_cmpeq_epi32(_mm_and_si128(b, bits), bits);
+    __m128i ink2 = _mm_cmpeq_epi32(_mm_and_si128(b2, bits), bits);
+    __m128i c = _mm_xor_si128(colours[0], _mm_and_si128(ink, colours[1]));
+    c = _mm_xor_si128(c, _mm_and_si128(ink2, colours[2]));
+    return _mm_xor_si128(c, _mm_and_si128(_mm_and_si128(ink, ink2), colours[3]));
+}
+
+// Turns a pair of screens, one after the other, into the 256x192 image the eye sees
+Image* gigascreenConvert(Image* img, const u8* bytes)
+{
+    const __m128i bitsLeft = _mm_setr_epi32(0x80, 0x40, 0x20, 0x10);
+    const __m128i bitsRight = _mm_setr_epi32(0x08, 0x04, 0x02, 0x01);
+    u32 blends[256];
+
+    gigascreenBlends(blends);
+
+    for (int cell = 0; cell < 768; ++cell)
+    {
+        const u8* src = bytes + scrimOffset((cell % 32) * 8, (cell / 32) * 8);
+        __m128i* dst = (__m128i *)(img->pixels + (cell / 32) * 8 * 256 + (cell % 32) * 8);
+        __m128i colours[4];
+
+        gigascreenCellColours(blends, bytes[6144 + cell], bytes[6912 + 6144 + cell], colours);
+        for (int line = 0; line < 8; ++line, src += 256, dst += 64)
+        {
+            __m128i b = _mm_set1_epi32(src[0]);
+            __m128i b2 = _mm_set1_epi32(src[6912]);
+            _mm_storeu_si128(dst, gigascreenPixels(colours, bitsLeft, b, b2));
+            _mm_storeu_si128(dst + 1, gigascreenPixels(colours, bitsRight, b, b2));
+        }
+    }
+
+    return img;
+}
+
+// checkError() of one cell of a pair of screens
+i64 gigascreenCellError(const Converter* cv, const u8* genome, const u8* frame, int cell)
+{
+    const __m128i bitsLeft = _mm_setr_epi32(0x80, 0x40, 0x20, 0x10);
+    const __m128i bitsRight = _mm_setr_epi32(0x08, 0x04, 0x02, 0x01);
+    const __m128i zero = _mm_setzero_si128();
+    const u32* pixels = &cv->target->pixels[(cell / 32) * 8 * 256 + (cell % 32) * 8];
+    int offset = scrimOffset((cell % 32) * 8, (cell / 32) * 8);
+    __m128i colours[4];
+    __m128i sum = zero;
+    i64 total[2];
+
+    gigascreenCellColours(cv->blends, genome[6144 + cell], frame[6144 + cell], colours);
+    for (int line = 0; line < 8; ++line, offset += 256, pixels += 256)
+    {
+        __m128i b = _mm_set1_epi32(genome[offset]);
+        __m128i b2 = _mm_set1_epi32(frame[offset]);
+        __m128i l = _mm_sub_epi32(gigascreenPixels(colours, bitsLeft, b, b2),
+            _mm_loadu_si128((const __m128i *)pixels));
+        __m128i r = _mm_sub_epi32(gigascreenPixels(colours, bitsRight, b, b2),
+            _mm_loadu_si128((const __m128i *)(pixels + 4)));
+
+        // abs() as checkError() takes it, then widened to 64 bits by unpacking with zero
+        l = _mm_sub_epi32(_mm_xor_si128(l, _mm_srai_epi32(l, 31)), _mm_srai_epi32(l, 31));
+        r = _mm_sub_epi32(_mm_xor_si128(r, _mm_srai_epi32(r, 31)), _mm_srai_epi32(r, 31));
+        sum = _mm_add_epi64(sum, _mm_add_epi64(_mm_unpacklo_epi32(l, zero), _mm_unpackhi_epi32(l, zero)));
+        sum = _mm_add_epi64(sum, _mm_add_epi64(_mm_unpacklo_epi32(r, zero), _mm_unpackhi_epi32(r, zero)));
+    }
+    _mm_storeu_si128((__m128i *)total, sum);
+
+    return total[0] + total[1];
+}
+
+// Switches a converter that has just been initialised or resumed to Gigascreen, working out the blends.  A fresh
+// converter's second frames start as copies of the first, so seeded screens look as they did; a resumed one's are
+// loaded afterwards.  Memory comes from the current arena.
+void converterGigascreen(Converter* cv, bool fresh)
+{
+    cv->blends = (u32 *)memAlloc(256 * sizeof(u32));
+    gigascreenBlends(cv->blends);
+    cv->current->cellErrors = (i64 *)populationArray(768 * sizeof(i64));
+    cv->future->cellErrors = (i64 *)populationArray(768 * sizeof(i64));
+    cv->current->frames = (u8 *)populationArray(6912);
+    cv->future->frames = (u8 *)populationArray(6912);
+    if (fresh)
+    {
+        memcpy(cv->current->frames, cv->current->genomes, 6912 * POPULATION_SIZE);
+        memcpy(cv->best + 6912, cv->best, 6912);
+    }
+}
+
+// Scores scrim index of pop, re-scoring only the cells that changed in either frame since its parent in parents, the
+// population it was bred from.  Scrims without a parent are scored in full.
+i64 gigascreenError(const Converter* cv, Population* pop, int index, const Population* parents)
+{
+    const u8* genome = &pop->genomes[index * 6912];
+    const u8* frame = &pop->frames[index * 6912];
+    i64* errors = &pop->cellErrors[index * 768];
+    int parent = pop->parents[index];
+    bool dirty[768];
+    i64 total = 0;
+
+    if (parent < 0)
+    {
+        memset(dirty, YES, sizeof(dirty));
+    }
+    else
+    {
+        const u8* from = &parents->genomes[parent * 6912];
+        const u8* fromFrame = &parents->frames[parent * 6912];
+
+        memcpy(errors, &parents->cellErrors[parent * 768], 768 * sizeof(i64));
+        memset(dirty, NO, sizeof(dirty));
+        for (int i = 0; i < 6912; i += 8)
+        {
+            if (*(const u64 *)(genome + i) == *(const u64 *)(from + i) &&
+                *(const u64 *)(frame + i) == *(const u64 *)(fromFrame + i))
+            {
+                continue;
+            }
+            for (int j = i; j < i + 8; ++j)
+            {
+                if (genome[j] != from[j] || frame[j] != fromFrame[j]) dirty[blurCellOf(j)] = YES;
+            }
+        }
+    }
+
+    for (int cell = 0; cell < 768; ++cell)
+    {
+        if (dirty[cell]) errors[cell] = gigascreenCellError(cv, genome, frame, cell);
+        total += errors[cell];
+    }
+
+    return total;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
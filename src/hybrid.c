@@ -0,0 +1,289 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Hybrid genomes
+// Once a cell's ink and paper are fixed, so is the bitmap with the least error: every pixel takes whichever of the
+// two is closer.  In hybrid mode only the 768 attribute bytes of a scrim evolve.  The error of every attribute in
+// every cell is worked out once, so scoring a scrim is a table lookup per cell, and the bitmap is only filled in for
+// scrims that are going to be shown or saved.
+//----------------------------------------------------------------------------------------------------------------------
+
+#include "zximg.h"
+
+#include <emmintrin.h>
+
+#define HYBRID_ATTRS        128         // Flash doesn't change the picture
+
+// abs() of each lane, as checkError() takes it
+__m128i hybridAbs(__m128i v)
+{
+    __m128i sign = _mm_srai_epi32(v, 31);
+    return _mm_sub_epi32(_mm_xor_si128(v, sign), sign);
+}
+
+// Per-pixel errors of one cell against every palette colour, 8 pixels to a pair of vectors
+void hybridCellErrors(const Image* target, int cell, __m128i errors[16][16])
+{
+    const u32* pixels = &target->pixels[(cell / 32) * 8 * 256 + (cell % 32) * 8];
+
+    for (int y = 0; y < 8; ++y, pixels += 256)
+    {
+        __m128i left = _mm_loadu_si128((const __m128i *)pixels);
+        __m128i right = _mm_loadu_si128((const __m128i *)(pixels + 4));
+        for (int c = 0; c < 16; ++c)
+        {
+            __m128i colour = _mm_set1_epi32((int)gZxColours[c]);
+            errors[c][y * 2] = hybridAbs(_mm_sub_epi32(colour, left));
+            errors[c][y * 2 + 1] = hybridAbs(_mm_sub_epi32(colour, right));
+        }
+    }
+}
+
+// Error of count vectors of pixels, each taking the closer of ink and paper
+i64 hybridSum(const __m128i* ink, const __m128i* paper, int count)
+{
+    __m128i sum = _mm_setzero_si128();
+    i64 total[2];
+
+    // Errors are never negative, so they widen to 64 bits by unpacking with zero
+    for (int i = 0; i < count; ++i)
+    {
+        __m128i closer = _mm_cmplt_epi32(ink[i], paper[i]);
+        __m128i best = _mm_or_si128(_mm_and_si128(closer, ink[i]), _mm_andnot_si128(closer, paper[i]));
+        sum = _mm_add_epi64(sum, _mm_unpacklo_epi32(best, _mm_setzero_si128()));
+        sum = _mm_add_epi64(sum, _mm_unpackhi_epi32(best, _mm_setzero_si128()));
+    }
+    _mm_storeu_si128((__m128i *)total, sum);
+
+    return total[0] + total[1];
+}
+
+// Bitmap byte with the least error for 8 pixels.  Ties go to paper.
+u8 hybridByte(__m128i ink, __m128i paper, const u32* pixels)
+{
+    // movemask puts the leftmost pixel in bit 0, the screen wants it in bit 7
+    static const u8 reverse[16] = { 0, 8, 4, 12, 2, 10, 6, 14, 1, 9, 5, 13, 3, 11, 7, 15 };
+    __m128i left = _mm_loadu_si128((const __m128i *)pixels);
+    __m128i right = _mm_loadu_si128((const __m128i *)(pixels + 4));
+    __m128i inkLeft = hybridAbs(_mm_sub_epi32(ink, left));
+    __m128i inkRight = hybridAbs(_mm_sub_epi32(ink, right));
+    __m128i paperLeft = hybridAbs(_mm_sub_epi32(paper, left));
+    __m128i paperRight = hybridAbs(_mm_sub_epi32(paper, right));
+    int l = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(inkLeft, paperLeft)));
+    int r = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(inkRight, paperRight)));
+
+    return (u8)(reverse[l] << 4 | reverse[r]);
+}
+
+// Switches a converter that has just been initialised or resumed to evolving attributes only, building the error
+// table.  Memory comes from the current arena.
+void converterHybrid(Converter* cv)
+{
+    __m128i errors[16][16];
+
+    TRACE_BEGIN(hybrid);
+    cv->cellErrors = (i64 *)memAlloc(768 * HYBRID_ATTRS * sizeof(i64));
+    for (int cell = 0; cell < 768; ++cell)
+    {
+        i64* out = &cv->cellErrors[cell * HYBRID_ATTRS];
+
+        hybridCellErrors(cv->target, cell, errors);
+        for (int attr = 0; attr < HYBRID_ATTRS; ++attr)
+        {
+            out[attr] = hybridSum(errors[(attr & 7) + ((attr & 0x40) >> 3)], errors[attr >> 3], 16);
+        }
+    }
+    TRACE_END(hybrid);
+}
+
+// The error the scrim will have once its bitmap is filled in
+i64 hybridError(const Converter* cv, const u8* genome)
+{
+    const u8* attrs = genome + 6144;
+    const i64* table = cv->cellErrors;
+    i64 total = 0;
+
+    for (int cell = 0; cell < 768; ++cell, table += HYBRID_ATTRS)
+    {
+        total += table[attrs[cell] & (HYBRID_ATTRS - 1)];
+    }
+
+    return total;
+}
+
+// Fills in the bitmap that goes with the scrim's attributes
+void hybridBitmap(const Converter* cv, u8* scrim)
+{
+    for (int cell = 0; cell < 768; ++cell)
+    {
+        u8 attr = scrim[6144 + cell];
+        __m128i ink = _mm_set1_epi32((int)gZxColours[(attr & 7) + ((attr & 0x40) >> 3)]);
+        __m128i paper = _mm_set1_epi32((int)gZxColours[(attr & 0x7f) >> 3]);
+        const u32* pixels = &cv->target->pixels[(cell / 32) * 8 * 256 + (cell % 32) * 8];
+        u8* out = &scrim[scrimOffset((cell % 32) * 8, (cell / 32) * 8)];
+
+        for (int y = 0; y < 8; ++y, pixels += 256, out += 256)
+        {
+            *out = hybridByte(ink, paper, pixels);
+        }
+    }
+}
+
+// Cells, and hi-colour and multicolour blocks, are scored independently, so the attribute with the least error in each
+// makes the best screen there is and generations can't improve on it.  Converts cv->target that way once
+// converterHybrid() or converterHicolour() has built the table, leaving the screen and its error where a step would
+// and the first scrim holding it.
+void converterSolve(Converter* cv)
+{
+    u8* genome = cv->current->genomes;
+    const i64* table = cv->rowErrors ? cv->rowErrors : cv->cellErrors;
+    int blocks = cv->rowErrors ? 6144 / cv->blockHeight : 768;
+    u8* attrs = cv->rowErrors ? genome : genome + 6144;
+    i64 total = 0;
+
+    for (int block = 0; block < blocks; ++block, table += HYBRID_ATTRS)
+    {
+        int best = 0;
+        for (int attr = 1; attr < HYBRID_ATTRS; ++attr)
+        {
+            if (table[attr] < table[best]) best = attr;
+        }
+        attrs[block] = (u8)best;
+        total += table[best];
+    }
+
+    memcpy(cv->best, genome, 6912);
+    if (cv->rowErrors) hicolourBitmap(cv, cv->best);
+    else hybridBitmap(cv, cv->best);
+    cv->current->errors[0] = total;
+    cv->current->indexBest = 0;
+    cv->bestError = total;
+    ++cv->evaluations;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Hi-colour and multicolour
+// A Timex hi-colour screen has an attribute for every 8x1 row of a cell, stored like a second bitmap after the first,
+// 12,288 bytes in all.  Multicolour engines get the same effect on a standard machine by rewriting the attributes as
+// the beam passes, every 2 or 4 lines.  Both are the same problem with a different block height, and hybrid mode's
+// reasoning holds a block at a time: only the attributes evolve, one byte per block from the start of a scrim, left to
+// right and top to bottom, every block takes the bitmap with the least error for its attribute, and a scrim's error
+// is a lookup per block.  A child starts from its parent's error and only looks up the blocks whose attribute differs,
+// so the smaller the blocks, the more there are, but each costs no more.  Crossover and mutation work on whole bytes,
+// so they never split a block.
+//
+// A multicolour screen is the bitmap followed by the attribute stream: 32 bytes for every block row, top to bottom,
+// the order a player copies them in.  It is 7,680 bytes for 8x4 blocks and 9,216 for 8x2.
+//----------------------------------------------------------------------------------------------------------------------
+
+// Lines per attribute of a multicolour screen of size bytes, or 0 if it isn't one
+int multicolourHeight(int size)
+{
+    return size == 6144 + 6144 / 2 ? 2 : size == 6144 + 6144 / 4 ? 4 : 0;
+}
+
+// Switches a converter that has just been initialised or resumed to hi-colour, for a height of 1, or to multicolour,
+// for 2 or 4, building the error of every attribute on every block.  A fresh converter's scrims are taken as standard
+// screens, seeded ones say, with each block starting from its cell's attribute.  Memory comes from the current arena.
+void converterHicolour(Converter* cv, int height, bool fresh)
+{
+    int blocks = 6144 / height;
+
+    TRACE_BEGIN(hicolour);
+    cv->blockHeight = height;
+    cv->rowErrors = (i64 *)memAlloc(blocks * HYBRID_ATTRS * sizeof(i64));
+    for (int block = 0; block < blocks; ++block)
+    {
+        const u32* pixels = &cv->target->pixels[(block / 32) * height * 256 + (block % 32) * 8];
+        __m128i errors[16][16];     // Two vectors a line, up to 8 lines
+        i64* out = &cv->rowErrors[block * HYBRID_ATTRS];
+
+        for (int c = 0; c < 16; ++c)
+        {
+            __m128i colour = _mm_set1_epi32((int)gZxColours[c]);
+            for (int line = 0; line < height; ++line)
+            {
+                const __m128i* row = (const __m128i *)(pixels + line * 256);
+                errors[c][line * 2] = hybridAbs(_mm_sub_epi32(colour, _mm_loadu_si128(row)));
+                errors[c][line * 2 + 1] = hybridAbs(_mm_sub_epi32(colour, _mm_loadu_si128(row + 1)));
+            }
+        }
+        for (int attr = 0; attr < HYBRID_ATTRS; ++attr)
+        {
+            out[attr] = hybridSum(errors[(attr & 7) + ((attr & 0x40) >> 3)], errors[attr >> 3], height * 2);
+        }
+    }
+
+    for (int i = 0; fresh && i < POPULATION_SIZE; ++i)
+    {
+        u8* genome = &cv->current->genomes[i * 6912];
+        u8 attrs[768];
+
+        memcpy(attrs, genome + 6144, 768);
+        for (int block = 0; block < blocks; ++block)
+        {
+            genome[block] = attrs[((block / 32) * height / 8) * 32 + block % 32];
+        }
+    }
+    TRACE_END(hicolour);
+}
+
+// Scores scrim index of pop.  A scrim with a parent in parents, the population it was bred from, only costs the
+// blocks it changed.
+i64 hicolourError(const Converter* cv, Population* pop, int index, const Population* parents)
+{
+    const u8* genome = &pop->genomes[index * 6912];
+    const i64* table = cv->rowErrors;
+    int blocks = 6144 / cv->blockHeight;
+    int parent = pop->parents[index];
+    i64 total = 0;
+
+    if (parent < 0)
+    {
+        for (int block = 0; block < blocks; ++block, table += HYBRID_ATTRS)
+        {
+            total += table[genome[block] & (HYBRID_ATTRS - 1)];
+        }
+    }
+    else
+    {
+        const u8* from = &parents->genomes[parent * 6912];
+        total = parents->errors[parent];
+        for (int i = 0; i < blocks; i += 8)
+        {
+            if (*(const u64 *)(genome + i) == *(const u64 *)(from + i)) continue;
+            for (int j = i; j < i + 8; ++j)
+            {
+                const i64* row = &table[j * HYBRID_ATTRS];
+                total += row[genome[j] & (HYBRID_ATTRS - 1)] - row[from[j] & (HYBRID_ATTRS - 1)];
+            }
+        }
+    }
+
+    return total;
+}
+
+// Turns a genome copied to the start of scr into a whole hi-colour or multicolour screen: the attributes move after
+// the bitmap, which is filled in for them.
+void hicolourBitmap(const Converter* cv, u8* scr)
+{
+    int height = cv->blockHeight;
+    int blocks = 6144 / height;
+    u8 attrs[6144];
+
+    memcpy(attrs, scr, blocks);
+    for (int block = 0; block < blocks; ++block)
+    {
+        u8 attr = attrs[block];
+        __m128i ink = _mm_set1_epi32((int)attrInk(attr));
+        __m128i paper = _mm_set1_epi32((int)attrPaper(attr));
+        int x = (block % 32) * 8, y = (block / 32) * height;
+
+        scr[6144 + (height == 1 ? scrimOffset(x, y) : block)] = attr;
+        for (int line = y; line < y + height; ++line)
+        {
+            scr[scrimOffset(x, line)] = hybridByte(ink, paper, &cv->target->pixels[line * 256 + x]);
+        }
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,360 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Image handling
+//----------------------------------------------------------------------------------------------------------------------
+
+#include "zximg.h"
+
+#include <emmintrin.h>
+
+#define STBI_MALLOC(sz)                     memAlloc(sz)
+#define STBI_REALLOC_SIZED(p, oldsz, newsz) memRealloc(p, oldsz, newsz)
+#define STBI_FREE(p)                        memFree(p)
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+const u32 gZxColours[16] =
+{
+    0x000000, 0x0000d7, 0xd70000, 0xd700d7, 0x00d700, 0x00d7d7, 0xd7d700, 0xd7d7d7,
+    0x000000, 0x0000ff, 0xff0000, 0xff00ff, 0x00ff00, 0x00ffff, 0xffff00, 0xffffff,
+};
+
+int channelRed(u32 c)       { return (c >> 16) & 0xff; }
+int channelGreen(u32 c)     { return (c >> 8) & 0xff; }
+int channelBlue(u32 c)      { return c & 0xff; }
+
+int colourDistance(int r, int g, int b, u32 c)
+{
+    int dr = r - channelRed(c);
+    int dg = g - channelGreen(c);
+    int db = b - channelBlue(c);
+    return dr * dr + dg * dg + db * db;
+}
+
+// Offset of the bitmap byte holding pixel (x, y)
+int scrimOffset(int x, int y)
+{
+    return ((y & 0xc0) << 5) | ((y & 7) << 8) | ((y & 0x38) << 2) | (x >> 3);
+}
+
+void scrimSetPixel(u8* scrim, int x, int y, bool ink)
+{
+    u8 mask = (u8)(0x80 >> (x & 7));
+    int offset = scrimOffset(x, y);
+    scrim[offset] = ink ? (scrim[offset] | mask) : (scrim[offset] & ~mask);
+}
+
+u32 attrInk(u8 attr)        { return gZxColours[(attr & 7) + ((attr & 0x40) >> 3)]; }
+u32 attrPaper(u8 attr)      { return gZxColours[(attr & 0x7f) >> 3]; }
+
+Image* imageCreate(int width, int height)
+{
+    size_t sz = sizeof(Image) + (width * height * sizeof(u32));
+    Image* img = (Image *)memAlloc(sz);
+    img->width = width;
+    img->height = height;
+    for (int i = 0; i < (width * height); ++i)
+    {
+        img->pixels[i] = 0xff0000ff;
+    }
+
+    return img;
+}
+
+void imageDestroy(Image* img)
+{
+    memFree(img);
+}
+
+// Fills a target image from decoded RGBA pixels of any size.  Each target pixel is the average of the source pixels
+// it covers, so same-sized images are copied as they are.  The result is in the 00RRGGBB layout of imageZxConvert(),
+// with alpha dropped, so a pixel's error against a rendered one is in its colour alone.
+void imagePrepareTarget(Image* target, const u8* rgba, int width, int height)
+{
+    u32* out = target->pixels;
+    TRACE_BEGIN(prepare);
+
+    for (int y = 0; y < target->height; ++y)
+    {
+        int y0 = y * height / target->height;
+        int y1 = (y + 1) * height / target->height;
+        if (y1 <= y0) y1 = y0 + 1;
+
+        for (int x = 0; x < target->width; ++x)
+        {
+            int x0 = x * width / target->width;
+            int x1 = (x + 1) * width / target->width;
+            u32 sum[3] = { 0 };
+            u32 count = 0;
+            if (x1 <= x0) x1 = x0 + 1;
+
+            for (int sy = y0; sy < y1; ++sy)
+            {
+                const u8* src = rgba + ((size_t)sy * width + x0) * 4;
+                for (int sx = x0; sx < x1; ++sx, src += 4)
+                {
+                    sum[0] += src[0];
+                    sum[1] += src[1];
+                    sum[2] += src[2];
+                }
+                count += x1 - x0;
+            }
+
+            *out++ =
+                ((sum[0] / count) << 16) |
+                ((sum[1] / count) << 8) |
+                (sum[2] / count);
+        }
+    }
+    TRACE_END(prepare);
+}
+
+// Reference version, one pixel at a time.  Kept to check and benchmark imageZxRender() against.
+Image* imageZxConvertScalar(Image* img, const u8* bytes)
+{
+    const u32* colours = gZxColours;
+    const u8* pixels = bytes;
+    const u8* attr = bytes + 6144;
+    int p = 0;
+
+    for (int section = 0; section < 3; ++section)
+    {
+        int ppp = p;
+        for (int pixRow = 0; pixRow < 8; ++pixRow)
+        {
+            int pp = p;
+
+            for (int row = 0; row < 8; ++row)
+            {
+                for (int x = 0; x < 32; ++x)
+                {
+                    int b = *pixels++;
+                    int i;
+                    u8 colour = attr[(section * 8 + row) * 32 + x];
+                    u32 ink = colours[(colour & 7) + ((colour & 0x40) >> 3)];
+                    u32 paper = colours[(colour & 0x7f) >> 3];
+
+                    for (i = 7; i >= 0; --i)
+                    {
+                        img->pixels[p + i] = (b & 1) ? ink : paper;
+                        b >>= 1;
+                    }
+                    p += 8;
+                } // end of pixel row
+                p += (7 * 256);
+            } // end of section
+            p = pp + 256;
+        } // all intermediate rows
+        p = ppp + (8 * 8 * 256);
+    } // whole screen
+
+    return img;
+}
+
+// Draws a screen into an image at least 256x192 in size, centred, with whatever is left around it filled with the
+// border colour (0-7), or left alone if border is negative.  With flashPhase set, cells with FLASH have ink and paper
+// swapped as in the second half of the flash cycle.
+//
+// Each bitmap byte is broadcast to 8 lanes and tested against one bit per lane, and the resulting masks select
+// between paper and ink, so a byte turns into 8 pixels with no branches.
+Image* imageZxRender(Image* img, const u8* bytes, bool flashPhase, int border)
+{
+    const __m128i bitsLeft = _mm_setr_epi32(0x80, 0x40, 0x20, 0x10);
+    const __m128i bitsRight = _mm_setr_epi32(0x08, 0x04, 0x02, 0x01);
+    const u8 flashMask = flashPhase ? 0x80 : 0;
+    const int left = (img->width - 256) / 2;
+    const int top = (img->height - 192) / 2;
+    __m128i paper[32];
+    __m128i diff[32];
+
+    if (border >= 0 && (left || top))
+    {
+        u32 c = gZxColours[border & 7];
+        for (int y = 0; y < img->height; ++y)
+        {
+            u32* row = img->pixels + y * img->width;
+            bool inside = MAKE_BOOL(y >= top && y < top + 192);
+            for (int x = 0; x < img->width; ++x)
+            {
+                if (inside && x == left) x += 256;
+                if (x < img->width) row[x] = c;
+            }
+        }
+    }
+
+    for (int row = 0; row < 24; ++row)
+    {
+        const u8* attr = bytes + 6144 + row * 32;
+
+        // Colours are the same for the 8 lines of a character row
+        for (int x = 0; x < 32; ++x)
+        {
+            u8 colour = attr[x];
+            u32 bright = (colour & 0x40) >> 3;
+            u32 ink = gZxColours[(colour & 7) + bright];
+            u32 pap = gZxColours[((colour >> 3) & 7) + bright];
+            if (colour & flashMask)
+            {
+                u32 t = ink;
+                ink = pap;
+                pap = t;
+            }
+            paper[x] = _mm_set1_epi32(pap);
+            diff[x] = _mm_set1_epi32(ink ^ pap);
+        }
+
+        for (int line = 0; line < 8; ++line)
+        {
+            int y = row * 8 + line;
+            const u8* src = bytes + ((y & 0xc0) << 5) + ((y & 7) << 8) + ((y & 0x38) << 2);
+            __m128i* dst = (__m128i *)(img->pixels + (top + y) * img->width + left);
+
+            for (int x = 0; x < 32; ++x)
+            {
+                __m128i b = _mm_set1_epi32(src[x]);
+                __m128i l = _mm_cmpeq_epi32(_mm_and_si128(b, bitsLeft), bitsLeft);
+                __m128i r = _mm_cmpeq_epi32(_mm_and_si128(b, bitsRight), bitsRight);
+                _mm_storeu_si128(dst++, _mm_xor_si128(paper[x], _mm_and_si128(l, diff[x])));
+                _mm_storeu_si128(dst++, _mm_xor_si128(paper[x], _mm_and_si128(r, diff[x])));
+            }
+        }
+    }
+
+    return img;
+}
+
+// Turns a scrim into a 256x192 image, ignoring FLASH
+Image* imageZxConvert(Image* img, const u8* bytes)
+{
+    return imageZxRender(img, bytes, NO, -1);
+}
+
+// Turns a screen with an attribute for every 8xheight block into a 256x192 image.  A 12,288 byte hi-colour screen,
+// with a height of 1, has the attribute of each row where its bitmap byte would be, 6,144 bytes further on; a
+// multicolour screen has its attribute stream after the bitmap, 32 bytes a block row.
+Image* imageHicolourConvert(Image* img, const u8* bytes, int height)
+{
+    const __m128i bitsLeft = _mm_setr_epi32(0x80, 0x40, 0x20, 0x10);
+    const __m128i bitsRight = _mm_setr_epi32(0x08, 0x04, 0x02, 0x01);
+
+    for (int y = 0; y < 192; ++y)
+    {
+        const u8* src = bytes + scrimOffset(0, y);
+        const u8* attrs = bytes + 6144 + (height == 1 ? scrimOffset(0, y) : (y / height) * 32);
+        __m128i* dst = (__m128i *)(img->pixels + y * 256);
+
+        for (int x = 0; x < 32; ++x)
+        {
+            u8 attr = attrs[x];
+            u32 pap = attrPaper(attr);
+            __m128i paper = _mm_set1_epi32(pap);
+            __m128i diff = _mm_set1_epi32(attrInk(attr) ^ pap);
+            __m128i b = _mm_set1_epi32(src[x]);
+            __m128i l = _mm_cmpeq_epi32(_mm_and_si128(b, bitsLeft), bitsLeft);
+            __m128i r = _mm_cmpeq_epi32(_mm_and_si128(b, bitsRight), bitsRight);
+            _mm_storeu_si128(dst++, _mm_xor_si128(paper, _mm_and_si128(l, diff)));
+            _mm_storeu_si128(dst++, _mm_xor_si128(paper, _mm_and_si128(r, diff)));
+        }
+    }
+
+    return img;
+}
+
+// Turns a screen of any size converterScreenSize() gives into a 256x192 image
+Image* imageScreenConvert(Image* img, const u8* bytes, int size)
+{
+    if (size == 6912 * 2) return gigascreenConvert(img, bytes);
+    if (size == 6144 * 2) return imageHicolourConvert(img, bytes, 1);
+    if (multicolourHeight(size)) return imageHicolourConvert(img, bytes, multicolourHeight(size));
+    if (size == 6912 + 64) return ulaplusConvert(img, bytes);
+    return imageZxConvert(img, bytes);
+}
+
+// Decodes an image file into a 256x192 target.  Returns a reason on failure, 0 on success.
+const char* targetLoad(Image* target, const char* fileName)
+{
+    Data img = dataLoad(fileName);
+    int width, height, type;
+    u8* imgData;
+
+    if (!img.buffer) return "cannot open file";
+    {
+        TRACE_BEGIN(decode);
+        imgData = stbi_load_from_memory(img.buffer, (int)img.size, &width, &height, &type, 4);
+        TRACE_END(decode);
+    }
+    dataUnload(img);
+    if (!imgData) return stbi_failure_reason();
+
+    imagePrepareTarget(target, imgData, width, height);
+    stbi_image_free(imgData);
+
+    return 0;
+}
+
+// stb_image only gives the first frame of a GIF through its public interface, so reading them all drives its decoder
+// directly.  Every frame is decoded into a new buffer and the one before is only kept if a later frame may be
+// disposed back to it, so the decoder works on the heap rather than the current arena.
+typedef struct
+{
+    stbi__context   context;
+    stbi__gif       gif;
+}
+FrameDecoder;
+
+// Starts reading the frames of a GIF.  Returns a reason on failure, 0 on success.
+const char* framesOpen(FrameReader* reader, const char* fileName)
+{
+    FrameDecoder* d;
+
+    reader->file = dataLoad(fileName);
+    reader->decoder = 0;
+    reader->index = 0;
+    if (!reader->file.buffer) return "cannot open file";
+
+    d = (FrameDecoder *)calloc(1, sizeof(FrameDecoder));
+    stbi__start_mem(&d->context, reader->file.buffer, (int)reader->file.size);
+    reader->decoder = d;
+    if (!stbi__gif_test(&d->context)) return "not a GIF";
+
+    return 0;
+}
+
+// Decodes the next frame into a 256x192 target.  Returns NO after the last frame or on a corrupt one.
+bool framesNext(FrameReader* reader, Image* target)
+{
+    FrameDecoder* d = (FrameDecoder *)reader->decoder;
+    Arena* prev = arenaUse(0);
+    u8* last = d->gif.out;
+    u8* lastOld = d->gif.old_out;
+    int comp;
+    u8* pixels;
+
+    TRACE_BEGIN(decode);
+    pixels = stbi__gif_load_next(&d->context, &d->gif, &comp, 4);
+    TRACE_END(decode);
+    if (last && last != d->gif.out && last != d->gif.old_out) stbi_image_free(last);
+    if (lastOld && lastOld != d->gif.old_out && lastOld != last) stbi_image_free(lastOld);
+    arenaUse(prev);
+
+    if (!pixels || pixels == (u8 *)&d->context) return NO;
+    imagePrepareTarget(target, pixels, d->gif.w, d->gif.h);
+    ++reader->index;
+
+    return YES;
+}
+
+void framesClose(FrameReader* reader)
+{
+    FrameDecoder* d = (FrameDecoder *)reader->decoder;
+
+    if (d)
+    {
+        if (d->gif.old_out != d->gif.out) stbi_image_free(d->gif.old_out);
+        stbi_image_free(d->gif.out);
+        free(d);
+    }
+    if (reader->file.buffer) dataUnload(reader->file);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
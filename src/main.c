@@ -2,344 +2,10 @@
 // GA-based image->ZX scr converter
 //----------------------------------------------------------------------------------------------------------------------
 
-#define WIN32_LEAN_AND_MEAN
-#include <Windows.h>
-
-#define STB_IMAGE_IMPLEMENTATION
-#include <stb_image.h>
+#include "zximg.h"
 
+#include <process.h>
 #include <time.h>
-#include <stdint.h>
-
-#define POPULATION_SIZE     100
-#define CROSSOVER_CHANCE    0.7
-#define MUTATION_CHANCE     0.01
-
-//----------------------------------------------------------------------------------------------------------------------
-// Basic typedefs
-//----------------------------------------------------------------------------------------------------------------------
-
-typedef INT8    i8;
-typedef INT16   i16;
-typedef INT32   i32;
-typedef INT64   i64;
-
-typedef UINT8   u8;
-typedef UINT16  u16;
-typedef UINT32  u32;
-typedef UINT64  u64;
-
-typedef float   f32;
-typedef double  f64;
-
-typedef char    bool;
-
-#define YES 1
-#define NO 0
-#define MAKE_BOOL(x) ((x) ? YES : NO)
-
-//----------------------------------------------------------------------------------------------------------------------
-// Image handling
-//----------------------------------------------------------------------------------------------------------------------
-
-typedef struct
-{
-    int     width;
-    int     height;
-    u32     pixels[0];
-}
-Image;
-
-Image* imageCreate(int width, int height)
-{
-    size_t sz = sizeof(Image) + (width * height * sizeof(u32));
-    Image* img = (Image *)malloc(sz);
-    img->width = width;
-    img->height = height;
-    for (int i = 0; i < (width * height); ++i)
-    {
-        img->pixels[i] = 0xff0000ff;
-    }
-
-    return img;
-}
-
-void imageDestroy(Image* img)
-{
-    free(img);
-}
-
-Image* imageZxConvert(Image* img, u8* bytes)
-{
-    static const u32 colours[16] =
-    {
-        0x000000, 0x0000d7, 0xd70000, 0xd700d7, 0x00d700, 0x00d7d7, 0xd7d700, 0xd7d7d7,
-        0x000000, 0x0000ff, 0xff0000, 0xff00ff, 0x00ff00, 0x00ffff, 0xffff00, 0xffffff,
-    };
-
-    u8* pixels = bytes;
-    u8* attr = bytes + 6144;
-    int p = 0;
-
-    for (int section = 0; section < 3; ++section)
-    {
-        int ppp = p;
-        for (int pixRow = 0; pixRow < 8; ++pixRow)
-        {
-            int pp = p;
-
-            for (int row = 0; row < 8; ++row)
-            {
-                for (int x = 0; x < 32; ++x)
-                {
-                    int b = *pixels++;
-                    int i;
-                    u8 colour = attr[(section * 8 + row) * 32 + x];
-                    u32 ink = colours[(colour & 7) + ((colour & 0x40) >> 3)];
-                    u32 paper = colours[(colour & 0x7f) >> 3];
-
-                    for (i = 7; i >= 0; --i)
-                    {
-                        img->pixels[p + i] = (b & 1) ? ink : paper;
-                        b >>= 1;
-                    }
-                    p += 8;
-                } // end of pixel row
-                p += (7 * 256);
-            } // end of section
-            p = pp + 256;
-        } // all intermediate rows
-        p = ppp + (8 * 8 * 256);
-    } // whole screen
-
-    return img;
-}
-
-//----------------------------------------------------------------------------------------------------------------------
-// Genetic Algorithm
-// Our lifeforms, scrims, describe a screen
-//----------------------------------------------------------------------------------------------------------------------
-
-Image* gTargetImage = 0;
-
-typedef struct
-{
-    u8      genomes[6912 * POPULATION_SIZE];
-    i64     errors[POPULATION_SIZE];
-    i64     total;
-    i64     bestScore;
-    i64     worseScore;
-    i64     indexBest;
-}
-Population;
-
-Population gPopA, gPopB;
-Population* gCurrentPop;
-Population* gFuturePop;
-
-void generateScrim(u8* bytes)
-{
-    static bool seeded = NO;
-    if (!seeded)
-    {
-        // Ensure we seed the random number generator only once.
-        srand((unsigned int)time(NULL));
-        seeded = YES;
-    }
-    for (int i = 0; i < 6912; ++i)
-    {
-        *bytes++ = (u8)rand();
-    }
-}
-
-void generatePopulation(Population *pop)
-{
-    int offset = 0;
-    for (int i = 0; i < POPULATION_SIZE; ++i)
-    {
-        generateScrim(&pop->genomes[offset]);
-        offset += 6912;
-        pop->errors[i] = 0;
-    }
-
-    pop->total = 0;
-    pop->indexBest = -1;
-}
-
-i64 checkError(Image* targetImg, u8* genome)
-{
-    static Image* img = 0;
-    i64 total = 0;
-
-    if (!img)
-    {
-        img = imageCreate(256, 192);
-    }
-
-    imageZxConvert(img, genome);
-
-    for (int i = 0; i < (256 * 192); ++i)
-    {
-        total += abs(img->pixels[i] - targetImg->pixels[i]);
-    }
-
-    return total;
-}
-
-i64 chooseParent(Population* pop)
-{
-    i64 r = ((i64)rand() << 32 ^ (i64)rand()) % pop->total;
-    i64 min = 0;
-    i64 max = POPULATION_SIZE - 1;
-    i64 index = -1;
-
-    for(;;)
-    {
-        index = ((min + max) / 2);
-
-        if (pop->errors[index] < r)
-        {
-            if ((index == POPULATION_SIZE - 1) || (pop->errors[index + 1] > r))
-            {
-                return index;
-            }
-            min = index + 1;
-            if (min >= POPULATION_SIZE) min = POPULATION_SIZE;
-        }
-        else
-        {
-            max = index - 1;
-            if (max < 0) max = 0;
-        }
-    }
-}
-
-u8 mutate(u8 b)
-{
-    f32 r = (f32)rand() / (f32)RAND_MAX;
-    if (r < MUTATION_CHANCE)
-    {
-        int r = rand() % 8;
-        b ^= (1 << r);
-    }
-
-    return b;
-}
-
-void generate(Population* curPop, Population* futurePop)
-{
-    // First calculate the errors of the current population
-    curPop->total = 0;
-    curPop->worseScore = 0;
-    for (int i = 0, offset = 0; i < POPULATION_SIZE; ++i, offset += 6912)
-    {
-        i64 t = checkError(gTargetImage, &curPop->genomes[offset]);
-        if (curPop->indexBest == -1 || t < curPop->bestScore)
-        {
-            curPop->bestScore = t;
-            curPop->indexBest = i;
-        }
-        if (t > curPop->worseScore)
-        {
-            curPop->worseScore = t;
-        }
-        curPop->errors[i] = curPop->total;
-        curPop->total += t;
-    }
-    curPop->total = 0;
-
-    // Now convert the errors so that the smallest are the largest, and vice versa
-    for (int i = 0; i < POPULATION_SIZE; ++i)
-    {
-        curPop->errors[i] = curPop->worseScore - curPop->errors[i];
-        curPop->total += curPop->errors[i];
-    }
-
-    // Now we generate next population
-    for (int i = 0, offset = 0; i < POPULATION_SIZE; ++i, offset += 6912)
-    {
-        i64 parents[2];
-        for (int p = 0; p < 2; ++p)
-        {
-            parents[p] = chooseParent(curPop);
-        }
-
-        // Decide whether to do cross-over or not
-        {
-            f32 chance = (f32)rand() / (f32)RAND_MAX;
-            if (chance < CROSSOVER_CHANCE)
-            {
-                int r = rand() % 6912;
-                int i = 0;
-                for (; i <= r; ++i)
-                {
-                    u8 b = mutate(curPop->genomes[parents[0] * 6912 + i]);
-                    futurePop->genomes[offset + i] = b;
-                }
-                for (; i < 6912; ++i)
-                {
-                    u8 b = mutate(curPop->genomes[parents[1] * 6912 + i]);
-                    futurePop->genomes[offset + i] = b;
-                }
-            }
-            else
-            {
-                int r = rand() % 2;
-                for (int i = 0; i < 6912; ++i)
-                {
-                    futurePop->genomes[offset + i] = mutate(curPop->genomes[parents[r] * 6912 + i]);
-                }
-            }
-        }
-    }
-}
-
-//----------------------------------------------------------------------------------------------------------------------
-// Data loading
-//----------------------------------------------------------------------------------------------------------------------
-
-typedef struct Data
-{
-    u8*     buffer;
-    i64     size;
-    HANDLE  file;
-    HANDLE  fileMap;
-}
-Data;
-
-void dataUnload(Data);
-
-Data dataLoad(const char* fileName)
-{
-    Data d = { 0 };
-
-    d.file = CreateFileA(fileName, GENERIC_READ, 0, 0, OPEN_EXISTING, 0, 0);
-    if (d.file)
-    {
-        DWORD fileSizeHigh, fileSizeLow;
-        fileSizeLow = GetFileSize(d.file, &fileSizeHigh);
-        d.fileMap = CreateFileMappingA(d.file, 0, PAGE_READONLY, fileSizeHigh, fileSizeLow, 0);
-
-        if (d.fileMap)
-        {
-            d.buffer = MapViewOfFile(d.fileMap, FILE_MAP_READ, 0, 0, 0);
-            d.size = ((i64)fileSizeHigh << 32) | fileSizeLow;
-        }
-        else
-        {
-            dataUnload(d);
-        }
-    }
-
-    return d;
-}
-
-void dataUnload(Data data)
-{
-    if (data.buffer)    UnmapViewOfFile(data.buffer);
-    if (data.fileMap)   CloseHandle(data.fileMap);
-    if (data.file)      CloseHandle(data.file);
-}
 
 //----------------------------------------------------------------------------------------------------------------------
 // Windows rendering
@@ -411,6 +77,24 @@ void displayBuffer(Win32OffscreenBuffer* buffer, HDC dc, int windowWidth, int wi
 // Window handling
 //----------------------------------------------------------------------------------------------------------------------
 
+Arena gArena;
+Converter gConverter;
+Snapshot gSnapshot;
+Budget gBudget;
+volatile bool gQuit = NO;
+Checkpointer gCheckpointer;
+const char* gOutput = 0;
+i64 gCheckpointMs = 0;
+const char* gStateName = 0;
+f64 gResumed = 0;                   // Seconds already spent on the conversion before it was resumed
+Dither gDither = DITHER_NONE;
+int gBeam = 0;                     // Width of the beam search, 0 for none
+bool gSolved = NO;                 // Converted outright by converterSolve()
+StatsWriter gStats;
+i64 gStatsMs = 1000;
+int gFps = 30;
+FILE* gLog = 0;
+const char* gImageName = 0;
 HWND gWnd;
 Win32OffscreenBuffer gScreen;
 Image* gImage = 0;
@@ -479,18 +163,79 @@ void createWindow(HINSTANCE inst)
         0, 0, inst, 0);
 }
 
+// The optimiser runs on its own thread so the window never slows it down.  It publishes the best scrim whenever it
+// improves and owns everything that reads the converter: checkpoints, state and stats.
+unsigned __stdcall optimiserWorker(void* arg)
+{
+    f64 start = timeNow() - gResumed;
+    f64 deadline = budgetDeadline(&gBudget, start, 0);
+    f64 lastCheckpoint = timeNow();
+    f64 lastStats = lastCheckpoint;
+    i64 checkpointError = -1;
+
+    traceThreadName("optimiser");
+    if (gDither || gBeam || gSolved)
+    {
+        // Already converted; there is nothing to optimise
+        snapshotPublish(&gSnapshot, &gConverter);
+        return 0;
+    }
+
+    while (!gQuit && budgetCheck(&gBudget, &gConverter, deadline, 0) == STOP_NONE)
+    {
+        ConverterEvent event = converterStep(&gConverter);
+        converterLog(gLog, gImageName, &gConverter, event, timeNow() - start);
+        gSnapshot.generation = gConverter.generation;
+        if (gConverter.bestError != gSnapshot.error)
+        {
+            snapshotPublish(&gSnapshot, &gConverter);
+        }
+
+        if (gStats.file && (timeNow() - lastStats) * 1000.0 >= (f64)gStatsMs)
+        {
+            statsWrite(&gStats, &gConverter);
+            lastStats = timeNow();
+        }
+
+        if ((gOutput || gStateName) && gCheckpointMs && (timeNow() - lastCheckpoint) * 1000.0 >= (f64)gCheckpointMs)
+        {
+            if (gOutput && gConverter.bestError != checkpointError)
+            {
+                checkpointPost(&gCheckpointer, 0, gOutput, gConverter.best, converterScreenSize(&gConverter));
+                checkpointError = gConverter.bestError;
+            }
+            if (gStateName)
+            {
+                checkpointPostState(&gCheckpointer, 0, gStateName, &gConverter, timeNow() - start);
+            }
+            lastCheckpoint = timeNow();
+        }
+    }
+
+    return 0;
+}
+
+// Pumps messages and redraws at most gFps times a second, and only when there is a new best scrim to show.
 int run()
 {
-    MSG msg;
-    int generation = 0;
+    MSG msg = { 0 };
     bool quit = NO;
-
-    while(!quit)
+    DWORD frameMs = gFps > 0 ? 1000 / gFps : 1000;
+    f64 lastFrame = 0;
+    LONG shown = 0;
+    i64 shownGeneration = -1;
+    u8 best[SCREEN_MAX_SIZE];
+    i64 error = -1;
+
+    while (!quit)
     {
+        MsgWaitForMultipleObjects(0, 0, FALSE, frameMs, QS_ALLINPUT);
+
         // Flush windows queue
-        while (PeekMessageA(&msg, 0, 0, 0, PM_NOREMOVE))
+        STATS_BEGIN(PHASE_MESSAGES);
+        while (PeekMessageA(&msg, 0, 0, 0, PM_REMOVE))
         {
-            if (!GetMessageA(&msg, 0, 0, 0))
+            if (msg.message == WM_QUIT)
             {
                 quit = YES;
                 break;
@@ -498,29 +243,31 @@ int run()
             TranslateMessage(&msg);
             DispatchMessageA(&msg);
         }
+        STATS_END(PHASE_MESSAGES);
 
-        // Do one generation
+        if (!quit && (timeNow() - lastFrame) * 1000.0 >= (f64)frameMs)
         {
-            char buffer[32];
-            snprintf(buffer, 32, "Generation: %d", generation);
-            SetWindowTextA(gWnd, buffer);
-        }
-        generate(gCurrentPop, gFuturePop);
+            i64 generation = gSnapshot.generation;
+            lastFrame = timeNow();
 
-        //if (generation % 50 == 0)
-        {
-            imageZxConvert(gImage, &gCurrentPop->genomes[gCurrentPop->indexBest * 6912]);
-            InvalidateRect(gWnd, 0, FALSE);
-        }
+            if (snapshotRead(&gSnapshot, &shown, best, &error))
+            {
+                TRACE_BEGIN(render);
+                STATS_BEGIN(PHASE_DISPLAY);
+                imageScreenConvert(gImage, best, converterScreenSize(&gConverter));
+                InvalidateRect(gWnd, 0, FALSE);
+                STATS_END(PHASE_DISPLAY);
+                TRACE_END(render);
+            }
 
-        {
-            Population* t = gCurrentPop;
-            gCurrentPop = gFuturePop;
-            gFuturePop = t;
+            if (generation != shownGeneration)
+            {
+                char buffer[64];
+                snprintf(buffer, 64, "Generation: %d  Error: %lld", (int)generation, error);
+                SetWindowTextA(gWnd, buffer);
+                shownGeneration = generation;
+            }
         }
-
-        ++generation;
-
     }
 
     return (int)msg.wParam;
@@ -530,38 +277,363 @@ int run()
 // WinMain
 //----------------------------------------------------------------------------------------------------------------------
 
+StagnationAction stagnationFromName(const char* name)
+{
+    if (!_stricmp(name, "restart")) return STAGNATION_RESTART;
+    if (!_stricmp(name, "boost")) return STAGNATION_BOOST;
+    return STAGNATION_STOP;
+}
+
+// Batch mode prints to the console it was started from
+void consoleAttach()
+{
+    if (AttachConsole(ATTACH_PARENT_PROCESS) || AllocConsole())
+    {
+        freopen("CONOUT$", "w", stdout);
+        freopen("CONOUT$", "w", stderr);
+    }
+}
+
+// Usage:
+//
+//      zximg [<image>] [--out <file>] [--checkpoint <ms>] [--seed <n>] [--stats <file>] [--stats-ms <ms>]
+//            [--trace <file>] [--trace-flush-ms <ms>] [--fps <n>] [--headless] [--state <file>]
+//            [--init <methods>] [--init-fraction <fraction>] [--dither fs|atkinson|sierra|bayer|bluenoise]
+//            [--hybrid] [--blur <sigma>] [--beam <width>] [--ulaplus] [--hicolour] [--multicolour 2|4]
+//            [--gigascreen] [--time <ms>] [--error <n>] [--generations <n>] [--evaluations <n>]
+//            <stagnation options>
+//      zximg --batch <directory|manifest> [--out <dir>] [--format scr|tap|tzx|z80] [--checkpoint <ms>]
+//            [--threads <n>] [--seed <n>] [--time <ms>] [--error <n>] [--generations <n>] [--evaluations <n>]
+//            [--trace <file>] [--trace-flush-ms <ms>] [--resumable] [--init <methods>]
+//            [--init-fraction <fraction>] [--dither fs|atkinson|sierra|bayer|bluenoise] [--hybrid]
+//            [--blur <sigma>] [--beam <width>] [--ulaplus] [--hicolour] [--multicolour 2|4] [--gigascreen]
+//            <stagnation options>
+//      zximg <gif> --animation [--out <file>] [--format scr|tap|tzx|z80] [--threads <n>] [--seed <n>] [--time <ms>]
+//            [--error <n>] [--generations <n>] [--evaluations <n>] [--init <methods>] [--init-fraction <fraction>]
+//            [--trace <file>] [--trace-flush-ms <ms>] <stagnation options>
+//      zximg --video <y4m|-> [--out <file|->] [--threads <n>] [--seed <n>] [--time <ms>] [--error <n>]
+//            [--generations <n>] [--evaluations <n>] [--init <methods>] [--init-fraction <fraction>]
+//            [--trace <file>] [--trace-flush-ms <ms>] <stagnation options>
+//
+// Stagnation options:
+//
+//      [--stagnation <generations>] [--on-stagnation stop|restart|boost] [--epsilon <fraction>] [--elite <n>]
+//      [--boost <factor>] [--log <file>]
+//
+// When the best error hasn't improved by --epsilon of itself (default 0.0001) for --stagnation generations, the
+// optimiser stops, restarts all but the --elite best scrims (default 10), or multiplies the mutation rate by
+// --boost (default 2) until it improves again.  --log writes every improvement and stagnation event as CSV.
+//
+// Interactively, --out saves the best screen when the window is closed, in the format given by its extension.  The
+// window redraws at most --fps times a second; --headless has no window at all and stops when the budget is used,
+// 10 seconds unless given.  The optimiser also stops at the budget in a window, which stays open.
+// --stats appends a snapshot every --stats-ms milliseconds, as CSV if the file name ends in .csv and as JSON lines
+// otherwise.  Phase timings are only included in builds with ZXIMG_STATS defined.
+//
+// --state saves the whole population every --checkpoint milliseconds and on exit, and if the file already exists the
+// conversion carries on from it instead of starting again, budget included.  In batch mode --resumable does the same
+// for every image with a <output>.state file, deleted once the image's screen has been written.
+//
+// --init seeds --init-fraction of the first population (default 0.5) from quick conversions instead of random
+// bytes, taking turns between a comma separated list of methods: nearest, ordered, diffusion, threshold and
+// bluenoise, or all.  Any other name is an error.
+// Interactively the seeding uses --threads threads.
+//
+// --dither converts by error diffusion with the given kernel, fs in about 2ms a screen on one core, instead of
+// optimising.  bayer and bluenoise are ordered dithers instead, at about a tenth of a millisecond a screen.
+// --hybrid gives every cell the attribute and bitmap with the least error, which makes the best screen there is, so it
+// is worked out directly instead of optimising and ignores the budget.
+// --blur scores scrims by how they compare with the target through a Gaussian blur of the given standard deviation
+// in pixels (1 is about right for a screen seen from a sofa), which rewards dithering.  Errors are then in a different
+// unit, so --error needs to change with it.  It has no effect with --hybrid.
+// --beam converts by a beam search keeping --beam partial screens (up to 32; 8 takes a second or so on one core),
+// scored through the --blur blur or a 1 pixel one, instead of optimising.  It uses --threads threads and ignores the
+// budget.
+// --ulaplus evolves a 64 entry ULAplus palette along with every scrim, starting from the standard colours, and saves
+// it after the screen in a 6,976 byte .scr; the other formats get the screen alone.  It has no effect with --hybrid,
+// --dither or --beam, and --blur has none with it.
+// --hicolour converts to a Timex hi-colour screen, with an attribute for every 8x1 row, working out the best one as
+// --hybrid does, ignoring the budget, and saving a 12,288 byte .scr whatever the format, so --batch names its outputs
+// .scr.  It has no effect with --hybrid, --dither or --beam, and --ulaplus and --blur have none with it.
+// --multicolour does the same with an attribute for every 8x2 or 8x4 block, for a multicolour engine on a standard
+// machine.  The screen is saved in the chosen format with each cell's top attribute, and the stream of every block's
+// attribute, 32 bytes a block row from top to bottom, goes beside it with .atr added to the name.  It has no effect
+// with --hicolour.
+// --gigascreen evolves pairs of screens shown on alternate frames, scored by their average, and saves both frames
+// one after the other whatever the format, so --batch names its outputs .scr.  Each pair starts as two copies of one
+// screen, so --init still helps.  It has no effect with --hybrid, --hicolour, --multicolour, --dither or --beam, and
+// --ulaplus and --blur have none with it.
+//
+// --animation converts every frame of an animated GIF to a screen of its own, named after --out, or the GIF in the
+// --format format, with a 4 digit frame number before the extension.  Each frame after the first carries on from
+// the one before and only evolves the cells whose pixels changed, so the budget applies to a frame whose cells all
+// changed and the time budget shrinks with the number that did; unchanged frames cost nothing.  Frames are standard
+// screens, so none of the modes above apply, but --init seeds the first.
+//
+// --video converts a YUV4MPEG2 stream, read from a file or from stdin if it is -, and writes a 6,912 byte screen for
+// every frame, one after the other, to --out or to stdout if there is none or it is -.  Frames are resampled to
+// 256x192 and converted as --animation converts them, carrying on from the one before, with the budget applying to
+// every frame: 100ms unless given.  Reading, converting and writing overlap, with at most 4 frames in flight.
+//
+// --trace writes a Chrome trace of both modes, flushed every --trace-flush-ms milliseconds, in builds with
+// ZXIMG_TRACE defined.
+//
 int WinMain(HINSTANCE inst, HINSTANCE prev, LPSTR cmdLine, int cmdShow)
 {
+    const char* imageName = "img1.jpg";
+    const char* batchSource = 0;
+    const char* videoSource = 0;
+    const char* statsName = 0;
+    const char* traceName = 0;
+    i64 traceFlushMs = 1000;
+    bool headless = NO;
+    bool animation = NO;
+    BatchOptions options = { 0 };
+    Budget* budget = &options.budget;
+    Stagnation* stagnation = &budget->stagnation;
+    const char* logName = 0;
+    const char* initMethods = 0;
+    f64 ditherTime = 0;
+    f64 beamTime = 0;
+    f64 solveTime = 0;
+
+    options.seed = (u64)time(NULL);
+    stagnation->epsilon = 0.0001;
+    stagnation->elite = 10;
+    stagnation->boost = 2;
+    for (int i = 1; i < __argc; ++i)
+    {
+        const char* arg = __argv[i];
+        const char* value = (i + 1 < __argc) ? __argv[i + 1] : 0;
+
+        if (!strcmp(arg, "--batch") && value)               batchSource = __argv[++i];
+        else if (!strcmp(arg, "--out") && value)            options.outDir = __argv[++i];
+        else if (!strcmp(arg, "--format") && value)         options.format = formatFromExtension(__argv[++i]);
+        else if (!strcmp(arg, "--checkpoint") && value)     options.checkpointMs = _atoi64(__argv[++i]);
+        else if (!strcmp(arg, "--threads") && value)        options.numThreads = atoi(__argv[++i]);
+        else if (!strcmp(arg, "--seed") && value)           options.seed = _strtoui64(__argv[++i], 0, 10);
+        else if (!strcmp(arg, "--time") && value)           budget->timeMs = _atoi64(__argv[++i]);
+        else if (!strcmp(arg, "--error") && value)          budget->targetError = _atoi64(__argv[++i]);
+        else if (!strcmp(arg, "--generations") && value)    budget->generations = _atoi64(__argv[++i]);
+        else if (!strcmp(arg, "--evaluations") && value)    budget->evaluations = _atoi64(__argv[++i]);
+        else if (!strcmp(arg, "--stats") && value)          statsName = __argv[++i];
+        else if (!strcmp(arg, "--stats-ms") && value)       gStatsMs = _atoi64(__argv[++i]);
+        else if (!strcmp(arg, "--trace") && value)          traceName = __argv[++i];
+        else if (!strcmp(arg, "--trace-flush-ms") && value) traceFlushMs = _atoi64(__argv[++i]);
+        else if (!strcmp(arg, "--fps") && value)            gFps = atoi(__argv[++i]);
+        else if (!strcmp(arg, "--headless"))                headless = YES;
+        else if (!strcmp(arg, "--stagnation") && value)     stagnation->window = _atoi64(__argv[++i]);
+        else if (!strcmp(arg, "--on-stagnation") && value)  stagnation->action = stagnationFromName(__argv[++i]);
+        else if (!strcmp(arg, "--epsilon") && value)        stagnation->epsilon = atof(__argv[++i]);
+        else if (!strcmp(arg, "--elite") && value)          stagnation->elite = atoi(__argv[++i]);
+        else if (!strcmp(arg, "--boost") && value)          stagnation->boost = (f32)atof(__argv[++i]);
+        else if (!strcmp(arg, "--log") && value)            logName = __argv[++i];
+        else if (!strcmp(arg, "--state") && value)          gStateName = __argv[++i];
+        else if (!strcmp(arg, "--resumable"))               options.resumable = YES;
+        else if (!strcmp(arg, "--init") && value)           initMethods = __argv[++i];
+        else if (!strcmp(arg, "--init-fraction") && value)  options.seeding.fraction = (f32)atof(__argv[++i]);
+        else if (!strcmp(arg, "--dither") && value)         options.dither = ditherFromName(__argv[++i]);
+        else if (!strcmp(arg, "--hybrid"))                  options.hybrid = YES;
+        else if (!strcmp(arg, "--blur") && value)           options.blur = (f32)atof(__argv[++i]);
+        else if (!strcmp(arg, "--beam") && value)           options.beam = atoi(__argv[++i]);
+        else if (!strcmp(arg, "--ulaplus"))                 options.ulaplus = YES;
+        else if (!strcmp(arg, "--hicolour"))                options.hicolour = YES;
+        else if (!strcmp(arg, "--multicolour") && value)    options.multicolour = atoi(__argv[++i]);
+        else if (!strcmp(arg, "--gigascreen"))              options.gigascreen = YES;
+        else if (!strcmp(arg, "--animation"))               animation = YES;
+        else if (!strcmp(arg, "--video") && value)          videoSource = __argv[++i];
+        else                                                imageName = arg;
+    }
+
+    if (options.multicolour != 2 && options.multicolour != 4) options.multicolour = 0;
+    if (initMethods)
+    {
+        // 0 is every method, so it only comes from "all", never from a name that isn't one
+        options.seeding.methods = _stricmp(initMethods, "all") ? seedMethodsFromNames(initMethods) : 0;
+        if (!options.seeding.methods && _stricmp(initMethods, "all"))
+        {
+            consoleAttach();
+            fprintf(stderr, "--init %s: methods are all, or a comma separated list of", initMethods);
+            for (int m = 0; m < SEED_COUNT; ++m)
+            {
+                fprintf(stderr, " %s", gSeedMethodNames[m]);
+            }
+            fprintf(stderr, "\n");
+            return 1;
+        }
+        if (!options.seeding.fraction) options.seeding.fraction = 0.5f;
+    }
+
+    traceThreadName("main");
+    if (traceName) traceInit(traceName, traceFlushMs);
+    if (logName)
+    {
+        gLog = options.log = fopen(logName, "wt");
+        if (gLog) fprintf(gLog, "image,time,generation,evaluations,error,event\n");
+    }
+
+    if (videoSource)
+    {
+        // The streams may be the standard handles, which attaching the console can replace
+        HANDLE stdIn = GetStdHandle(STD_INPUT_HANDLE);
+        HANDLE stdOut = GetStdHandle(STD_OUTPUT_HANDLE);
+        int result;
+
+        consoleAttach();
+        if (!budget->timeMs && !budget->targetError && !budget->generations && !budget->evaluations)
+        {
+            budget->timeMs = 100;
+        }
+        result = videoRun(videoSource, &options, stdIn, stdOut);
+        if (gLog) fclose(gLog);
+        traceDone();
+        return result;
+    }
+
+    if (batchSource || headless || animation)
+    {
+        consoleAttach();
+        if (!budget->timeMs && !budget->targetError && !budget->generations && !budget->evaluations)
+        {
+            budget->timeMs = 10000;
+        }
+    }
+
+    if (batchSource || animation)
+    {
+        int result;
+        result = (batchSource ? batchRun(batchSource, &options) : animationRun(imageName, &options)) ? 1 : 0;
+        if (gLog) fclose(gLog);
+        traceDone();
+        return result;
+    }
+
+    // Everything the conversion needs lives in one arena
+    arenaInit(&gArena, 64 << 20);
+    arenaUse(&gArena);
+
     // Load target image
     {
-        Data img = dataLoad("img1.jpg");
-        int width, height, type;
-        u8* imgData = 0;
+        Image* target = imageCreate(256, 192);
+        const char* error = targetLoad(target, imageName);
+        if (error)
+        {
+            if (headless) printf("%s: %s\n", imageName, error);
+            traceDone();
+            return 1;
+        }
 
         gImage = imageCreate(256, 192);
-        gTargetImage = imageCreate(256, 192);
-        imgData = stbi_load_from_memory(img.buffer, (int)img.size, &width, &height, &type, 4);
-        if (width != 256 || height != 192) return 1;
-        memcpy(gTargetImage->pixels, imgData, width*height * sizeof(u32));
-        for (int i = 0; i < width*height; ++i)
+        if (gStateName && GetFileAttributesA(gStateName) != INVALID_FILE_ATTRIBUTES)
         {
-            u32 p = gTargetImage->pixels[i];
-            p = (p & 0xff00ff00) | ((p & 0x00ff0000) >> 16) | ((p & 0x000000ff) << 16);
-            gTargetImage->pixels[i] = p;
+            error = converterResume(&gConverter, target, gStateName, &gResumed);
+            if (error)
+            {
+                if (headless) printf("%s: %s\n", gStateName, error);
+                traceDone();
+                return 1;
+            }
+        }
+        else
+        {
+            converterInit(&gConverter, target, options.seed);
+            gConverter.stagnation = *stagnation;
+            if (options.dither)
+            {
+                f64 t = timeNow();
+                converterDither(&gConverter, options.dither);
+                ditherTime = timeNow() - t;
+            }
+            else if (options.beam)
+            {
+                f64 t = timeNow();
+                converterBlur(&gConverter, options.blur > 0 ? options.blur : 1.0f);
+                converterBeam(&gConverter, options.beam, options.numThreads);
+                beamTime = timeNow() - t;
+            }
+            else
+            {
+                options.seeding.numThreads = options.numThreads;
+                converterSeed(&gConverter, &options.seeding);
+                if (options.hybrid) converterHybrid(&gConverter);
+                else if (options.hicolour || options.multicolour)
+                {
+                    converterHicolour(&gConverter, options.hicolour ? 1 : options.multicolour, YES);
+                }
+                else if (options.gigascreen) converterGigascreen(&gConverter, YES);
+                else if (options.ulaplus) converterUlaplus(&gConverter, YES);
+                else if (options.blur > 0) converterBlur(&gConverter, options.blur);
+            }
+        }
+        if (gConverter.cellErrors || gConverter.rowErrors)
+        {
+            f64 t = timeNow();
+            converterSolve(&gConverter);
+            solveTime = timeNow() - t;
+            gSolved = YES;
         }
-        STBI_FREE(imgData);
-        dataUnload(img);
+        gImageName = imageName;
     }
 
-    gCurrentPop = &gPopA;
-    gFuturePop = &gPopB;
-    generatePopulation(gCurrentPop);
+    gOutput = options.outDir;
+    gDither = options.dither;
+    gBeam = options.beam;
+    gCheckpointMs = options.checkpointMs;
+    gBudget = options.budget;
+    snapshotInit(&gSnapshot);
+    checkpointInit(&gCheckpointer, 1);
+    if (statsName)
+    {
+        const char* ext = strrchr(statsName, '.');
+        statsWriterInit(&gStats, fopen(statsName, "wt"), !ext || _stricmp(ext, ".csv"));
+    }
 
-    //imageZxConvert(gImage, &gCurrentPop->genomes[0]);
+    {
+        int result = 0;
+        f64 start = timeNow();
+        HANDLE optimiser;
 
-    createWindow(inst);
+        if (!headless) createWindow(inst);
+        optimiser = (HANDLE)_beginthreadex(0, 0, &optimiserWorker, 0, 0, 0);
+        if (!headless)
+        {
+            result = run();
+            gQuit = YES;
+        }
+        WaitForSingleObject(optimiser, INFINITE);
+        CloseHandle(optimiser);
 
-    return run();
+        if (headless && gDither)
+        {
+            printf("%s: error %lld by %s error diffusion in %.3fms\n", imageName, gConverter.bestError,
+                gDitherNames[gDither], ditherTime * 1000.0);
+        }
+        else if (headless && gBeam)
+        {
+            printf("%s: error %lld by beam search %d wide in %.2fs (%lld evaluations)\n", imageName,
+                gConverter.bestError, gBeam, beamTime, gConverter.evaluations);
+        }
+        else if (headless && gSolved)
+        {
+            printf("%s: error %lld solved exactly in %.3fms\n", imageName, gConverter.bestError, solveTime * 1000.0);
+        }
+        else if (headless)
+        {
+            f64 elapsed = gResumed + timeNow() - start;
+            printf("%s: error %lld after %lld generations in %.2fs (%.0f evaluations/s)%s\n", imageName,
+                gConverter.bestError, gConverter.generation, elapsed, (f64)gConverter.evaluations / elapsed,
+                gConverter.stagnated ? " (stagnated)" : "");
+        }
+        checkpointCancel(&gCheckpointer, 0);
+        if (gOutput) exportScreen(gOutput, gConverter.best, converterScreenSize(&gConverter));
+        if (gStateName) stateSave(gStateName, &gConverter, gResumed + timeNow() - start);
+
+        checkpointDone(&gCheckpointer);
+        if (gStats.file) fclose(gStats.file);
+        if (gLog) fclose(gLog);
+        traceDone();
+        return result;
+    }
 }
 
 //----------------------------------------------------------------------------------------------------------------------
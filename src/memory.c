@@ -0,0 +1,136 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Memory arenas
+// A job takes all its memory (decode buffers, images, populations) linearly from one arena and gives it back in one
+// go with arenaReset().  The address range is reserved up front and pages are committed on demand and never
+// decommitted, so once an arena has seen its largest job it never touches the OS or the heap again.
+//----------------------------------------------------------------------------------------------------------------------
+
+#include "zximg.h"
+
+#define ARENA_ALIGN         16
+#define ARENA_COMMIT_SIZE   (1 << 20)
+
+// The arena that memAlloc() and friends use on this thread.  0 means the CRT heap.
+__declspec(thread) Arena* tArena = 0;
+
+void arenaInit(Arena* arena, size_t reserveSize)
+{
+    arena->reserved = (reserveSize + ARENA_COMMIT_SIZE - 1) & ~((size_t)ARENA_COMMIT_SIZE - 1);
+    arena->base = (u8 *)VirtualAlloc(0, arena->reserved, MEM_RESERVE, PAGE_READWRITE);
+    arena->committed = 0;
+    arena->used = 0;
+    arena->last = 0;
+    arena->peak = 0;
+    if (!arena->base) arena->reserved = 0;
+}
+
+void arenaDone(Arena* arena)
+{
+    if (arena->base) VirtualFree(arena->base, 0, MEM_RELEASE);
+    arena->base = 0;
+    arena->reserved = arena->committed = arena->used = arena->last = 0;
+}
+
+// Makes sure the first 'end' bytes of the arena are backed by committed pages.
+bool arenaCommit(Arena* arena, size_t end)
+{
+    size_t commit;
+
+    if (end <= arena->committed) return YES;
+    if (end > arena->reserved) return NO;
+
+    commit = (end + ARENA_COMMIT_SIZE - 1) & ~((size_t)ARENA_COMMIT_SIZE - 1);
+    if (commit > arena->reserved) commit = arena->reserved;
+    if (!VirtualAlloc(arena->base + arena->committed, commit - arena->committed, MEM_COMMIT, PAGE_READWRITE))
+    {
+        return NO;
+    }
+    arena->committed = commit;
+
+    return YES;
+}
+
+void* arenaAlloc(Arena* arena, size_t size)
+{
+    size_t start = (arena->used + (ARENA_ALIGN - 1)) & ~((size_t)ARENA_ALIGN - 1);
+    size_t end = start + size;
+
+    if (!arenaCommit(arena, end)) return 0;
+
+    arena->last = start;
+    arena->used = end;
+    if (end > arena->peak) arena->peak = end;
+
+    return arena->base + start;
+}
+
+bool arenaOwns(Arena* arena, void* ptr)
+{
+    return MAKE_BOOL((u8 *)ptr >= arena->base && (u8 *)ptr < arena->base + arena->reserved);
+}
+
+void* arenaRealloc(Arena* arena, void* ptr, size_t oldSize, size_t newSize)
+{
+    u8* p;
+
+    if (!ptr) return arenaAlloc(arena, newSize);
+
+    // The last allocation can simply move the top of the arena.
+    if ((u8 *)ptr == arena->base + arena->last)
+    {
+        size_t end = arena->last + newSize;
+        if (!arenaCommit(arena, end)) return 0;
+        arena->used = end;
+        if (end > arena->peak) arena->peak = end;
+        return ptr;
+    }
+
+    p = (u8 *)arenaAlloc(arena, newSize);
+    if (p) memcpy(p, ptr, oldSize < newSize ? oldSize : newSize);
+    return p;
+}
+
+// Releases everything allocated from the arena.  The committed pages are kept for the next job.
+void arenaReset(Arena* arena)
+{
+    arena->used = 0;
+    arena->last = 0;
+}
+
+// Makes the arena current for this thread and returns the previous one.
+Arena* arenaUse(Arena* arena)
+{
+    Arena* prev = tArena;
+    tArena = arena;
+    return prev;
+}
+
+// General allocation entry points.  They go to the current arena if there is one, and fall back to the heap when
+// there isn't or it is full.  Freeing arena memory is a no-op; it goes away with the next arenaReset().
+void* memAlloc(size_t size)
+{
+    void* p = tArena ? arenaAlloc(tArena, size) : 0;
+    return p ? p : malloc(size);
+}
+
+void* memRealloc(void* ptr, size_t oldSize, size_t newSize)
+{
+    if (tArena && (!ptr || arenaOwns(tArena, ptr)))
+    {
+        void* p = arenaRealloc(tArena, ptr, oldSize, newSize);
+        if (p) return p;
+        p = malloc(newSize);
+        if (p && ptr) memcpy(p, ptr, oldSize < newSize ? oldSize : newSize);
+        return p;
+    }
+    return realloc(ptr, newSize);
+}
+
+void memFree(void* ptr)
+{
+    if (tArena && arenaOwns(tArena, ptr)) return;
+    free(ptr);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
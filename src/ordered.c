@@ -0,0 +1,223 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Ordered dithering
+// The quickest conversion there is, for thumbnails, previews and seeding.  Each cell's ink and paper are the two ZX
+// colours its pixels vote for most.  Pixels vote in a checkerboard, half for the colour they would round down to and
+// half for the one they would round up to, channel by channel, so a cell of one flat colour between two ZX colours
+// votes for both.  Each pixel is then placed along the line from paper to ink and compared with a Bayer or blue noise
+// matrix.  Every ZX colour pair differs by the same level in each channel it differs in, so the projection needs no
+// division.  There isn't a branch per pixel anywhere: a cell row of 8 pixels is one vector, and its bitmap byte comes
+// straight out of a movemask.
+//----------------------------------------------------------------------------------------------------------------------
+
+#include "zximg.h"
+
+#include <emmintrin.h>
+
+#define ORDERED_DOWN        0xab    // A channel at least this bright rounds down to on...
+#define ORDERED_UP          0x40    // ...and one at least this bright rounds up to on
+#define ORDERED_BRIGHT      0xeb    // Half way between the normal and bright levels
+
+// 16x16 blue noise, made by void and cluster
+const u8 gBlueNoise[256] =
+{
+     16, 159, 220,  57, 150,  91, 135, 105,  12, 224, 112,  27, 218,  10, 246,  44,
+    232, 133,  26, 117, 248,   2, 192, 215,  58, 180, 146, 203,  95,  59, 151,  85,
+    110,  67, 181, 198,  76, 168,  39, 126,  83, 252,  41,  72, 233, 169, 123, 200,
+    172,  40, 236,  98,  47, 142, 231, 178,  17, 157, 119,   3, 138,  29, 241,  14,
+    222, 147,   8, 161, 210,  25,  92,  66, 204,  99, 219, 176, 196, 107,  77,  54,
+     93, 121,  74, 253, 130, 111, 244, 148,  33, 239,  60,  86,  46, 211, 153, 185,
+     22, 213, 191,  30,  61, 183,   5, 193, 124, 162,  24, 134, 237,   7, 131, 245,
+    170,  50, 101, 165, 141,  82, 221,  51,  75, 216, 104, 189, 164,  97,  37,  68,
+    145, 223,   1, 205, 230,  19, 154, 115, 177,   9, 255,  43,  70, 226, 206, 109,
+    250,  79, 129,  55, 114,  94, 249,  31, 207,  90, 152, 120,  15, 140, 179,  13,
+     42, 197, 158, 242,  35, 173, 195,  65, 136, 228,  53, 199, 240,  87,  56, 118,
+    149,  28,  88, 184,  69, 144,   6, 102, 167,  23,  81, 175,  36, 160, 217, 188,
+    235, 106, 209,  11, 127, 238, 212,  45, 247, 128, 214, 108, 132,  20, 100,  71,
+    171,  49, 137, 225,  52,  84, 155, 116,  73, 187,   0,  62, 251, 194, 227,   4,
+    125, 254,  21, 166, 113, 182,  18, 201,  34, 139, 234, 156,  80,  38, 143,  63,
+    186,  78,  96, 202,  32, 229,  64, 243, 163,  89,  48, 190, 122, 174, 103, 208,
+};
+
+// What the second pass needs to know about a cell, every lane the same
+typedef struct
+{
+    __m128i     signs[2];       // Of ink minus paper in units of the level: blue and red, then green and alpha's 0
+    __m128i     offset;         // Where paper lies along that axis
+    __m128i     length;         // ...and how far it is to ink
+}
+OrderedCell;
+
+// Corner of the colour cube each pixel's channel masks pick, in 32 bit lanes
+__m128i orderedCorners(__m128i masks)
+{
+    // Blue, green and red weigh 1, 4 and 2, as in a ZX colour, all times 64 so that green's byte can be shifted down
+    // into place after the 16 bit halves are added; alpha is ignored
+    __m128i x = _mm_and_si128(masks, _mm_set1_epi32(0x00800140));
+    return _mm_srli_epi32(_mm_madd_epi16(x, _mm_set1_epi16(1)), 6);
+}
+
+// Chooses the attribute of cell cx of character row cy and the constants that go with it
+u8 orderedAnalyse(const Image* target, int cx, int cy, OrderedCell* cell)
+{
+    const __m128i flip = _mm_set1_epi8((char)0x80);
+    const __m128i bright = _mm_set1_epi8((char)((ORDERED_BRIGHT - 1) ^ 0x80));
+    const u32* pixels = &target->pixels[cy * 8 * 256 + cx * 8];
+    __m128i thresholds[2], downs[2];
+    __m128i votes[4], sums[2];
+    __m128i on[2] = { _mm_setzero_si128(), _mm_setzero_si128() };
+    __m128i high[2] = { _mm_setzero_si128(), _mm_setzero_si128() };
+    __m128i counts = _mm_setzero_si128(), best;
+    int first, second;
+    int paper, ink, level, rise, fall, red, green, blue, numOn, numHigh;
+    bool isBright;
+
+    // Pixels take turns to round down and up, in a checkerboard.  Bytes compare as signed, so they are flipped to
+    // compare as unsigned.
+    for (int odd = 0; odd < 2; ++odd)
+    {
+        u32 down = ((ORDERED_DOWN - 1) ^ 0x80) * 0x01010101u;
+        u32 up = ((ORDERED_UP - 1) ^ 0x80) * 0x01010101u;
+        thresholds[odd] = odd ? _mm_setr_epi32(up, down, up, down) : _mm_setr_epi32(down, up, down, up);
+        downs[odd] = odd ? _mm_setr_epi32(0, 0xffffff, 0, 0xffffff) : _mm_setr_epi32(0xffffff, 0, 0xffffff, 0);
+    }
+
+    for (int y = 0; y < 8; y += 2, pixels += 512)
+    {
+        __m128i corners[4];
+        for (int i = 0; i < 4; ++i)
+        {
+            __m128i p = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(pixels + (i >> 1) * 256 + (i & 1) * 4)), flip);
+            __m128i masks = _mm_cmpgt_epi8(p, thresholds[i >> 1]);
+            corners[i] = orderedCorners(masks);
+
+            on[i >> 1] = _mm_sub_epi8(on[i >> 1], masks);
+            high[i >> 1] = _mm_sub_epi8(high[i >> 1], _mm_cmpgt_epi8(p, bright));
+        }
+        votes[y >> 1] = _mm_packus_epi16(_mm_packs_epi32(corners[0], corners[1]),
+            _mm_packs_epi32(corners[2], corners[3]));
+    }
+
+    // Each colour's count goes in a 16 bit lane above its number, reversed so the lower colour wins a tie, and the two
+    // largest keys are found across the lanes.  Paper has the most votes and ink the next, or is paper too if no other
+    // colour has any.
+    for (int c = 0; c < 8; c += 2)
+    {
+        __m128i pair[2];
+        for (int k = 0; k < 2; ++k)
+        {
+            __m128i key = _mm_set1_epi8((char)(c + k));
+            pair[k] = _mm_sub_epi8(_mm_setzero_si128(),
+                _mm_add_epi8(_mm_add_epi8(_mm_cmpeq_epi8(votes[0], key), _mm_cmpeq_epi8(votes[1], key)),
+                    _mm_add_epi8(_mm_cmpeq_epi8(votes[2], key), _mm_cmpeq_epi8(votes[3], key))));
+        }
+        // Colour c's count lands in lane c / 2 and colour c + 1's in lane 4 + c / 2
+        pair[0] = _mm_add_epi8(_mm_unpacklo_epi64(pair[0], pair[1]), _mm_unpackhi_epi64(pair[0], pair[1]));
+        pair[0] = _mm_sad_epu8(pair[0], _mm_setzero_si128());
+        counts = _mm_or_si128(counts, _mm_sll_epi64(pair[0], _mm_cvtsi32_si128(c * 8)));
+    }
+    counts = _mm_or_si128(_mm_slli_epi16(counts, 3), _mm_setr_epi16(7, 5, 3, 1, 6, 4, 2, 0));
+    best = _mm_max_epi16(counts, _mm_shuffle_epi32(counts, 0x4e));
+    best = _mm_max_epi16(best, _mm_shuffle_epi32(best, 0xb1));
+    best = _mm_max_epi16(best, _mm_shufflelo_epi16(best, 0xb1));
+    first = _mm_cvtsi128_si32(best) & 0xffff;
+    counts = _mm_andnot_si128(_mm_cmpeq_epi16(counts, _mm_shuffle_epi32(_mm_shufflelo_epi16(best, 0), 0)), counts);
+    counts = _mm_max_epi16(counts, _mm_shuffle_epi32(counts, 0x4e));
+    counts = _mm_max_epi16(counts, _mm_shuffle_epi32(counts, 0xb1));
+    counts = _mm_max_epi16(counts, _mm_shufflelo_epi16(counts, 0xb1));
+    second = _mm_cvtsi128_si32(counts) & 0xffff;
+    paper = 7 - (first & 7);
+    ink = second >> 3 ? 7 - (second & 7) : paper;
+
+    // Bright if most of the channels that are on are nearer the bright level, judged by the pixels that round down
+    sums[0] = _mm_sad_epu8(_mm_or_si128(_mm_and_si128(on[0], downs[0]), _mm_and_si128(on[1], downs[1])),
+        _mm_setzero_si128());
+    sums[1] = _mm_sad_epu8(_mm_or_si128(_mm_and_si128(high[0], downs[0]), _mm_and_si128(high[1], downs[1])),
+        _mm_setzero_si128());
+    numOn = _mm_cvtsi128_si32(_mm_add_epi32(sums[0], _mm_srli_si128(sums[0], 8)));
+    numHigh = _mm_cvtsi128_si32(_mm_add_epi32(sums[1], _mm_srli_si128(sums[1], 8)));
+    isBright = numHigh * 2 > numOn;
+    level = (int)(gZxColours[isBright ? 15 : 7] & 0xff);
+
+    // Colour bits are green, red, blue.  Going from paper to ink, the channels only ink has rise by the level and
+    // those only paper has fall by it.
+    rise = ink & ~paper;
+    fall = paper & ~ink;
+    red = ((rise >> 1) & 1) - ((fall >> 1) & 1);
+    green = (rise >> 2) - (fall >> 2);
+    blue = (rise & 1) - (fall & 1);
+    cell->signs[0] = _mm_set1_epi32((int)((u32)red << 16 | (u16)blue));
+    cell->signs[1] = _mm_set1_epi32((int)(u16)green);
+    cell->offset = _mm_set1_epi16((i16)(-level * ((fall & 1) + ((fall >> 1) & 1) + (fall >> 2))));
+    cell->length = _mm_set1_epi16((i16)(level * ((rise | fall) & 1) + level * (((rise | fall) >> 1) & 1) +
+        level * ((rise | fall) >> 2)));
+
+    return (u8)((isBright ? 0x40 : 0) | (paper << 3) | ink);
+}
+
+// Sum of each pixel's channels times the cell's signs.  Lanes are in reverse, so the movemask comes out with the
+// leftmost pixel in bit 7.
+__m128i orderedProject(const u32* pixels, const OrderedCell* cell)
+{
+    const __m128i even = _mm_set1_epi16(0xff);
+    __m128i left = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)(pixels + 4)), 0x1b);
+    __m128i right = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)pixels), 0x1b);
+
+    // As 16 bit lanes a pixel is blue and red in the low bytes, green and alpha in the high ones
+    return _mm_packs_epi32(
+        _mm_add_epi32(_mm_madd_epi16(_mm_and_si128(left, even), cell->signs[0]),
+            _mm_madd_epi16(_mm_srli_epi16(left, 8), cell->signs[1])),
+        _mm_add_epi32(_mm_madd_epi16(_mm_and_si128(right, even), cell->signs[0]),
+            _mm_madd_epi16(_mm_srli_epi16(right, 8), cell->signs[1])));
+}
+
+// Converts a 256x192 target with DITHER_BAYER or DITHER_BLUE_NOISE, the matrix shifted by (dx, dy).
+void orderedScreen(const Image* target, Dither dither, int dx, int dy, u8* scr)
+{
+    bool blue = dither == DITHER_BLUE_NOISE;
+    int size = blue ? 16 : 8;
+    const u8* matrix = blue ? gBlueNoise : gBayer;
+    OrderedCell cells[32];
+
+    for (int cy = 0; cy < 24; ++cy)
+    {
+        for (int cx = 0; cx < 32; ++cx)
+        {
+            scr[6144 + cy * 32 + cx] = orderedAnalyse(target, cx, cy, &cells[cx]);
+        }
+
+        for (int y = cy * 8; y < cy * 8 + 8; ++y)
+        {
+            const u32* pixels = &target->pixels[y * 256];
+            u8* out = &scr[scrimOffset(0, y)];
+            __m128i thresholds[2];
+
+            // Thresholds in 512ths of the way from paper to ink, scaled up to use all 16 bits.  Even and odd cells
+            // differ for the 16 wide matrix.
+            for (int odd = 0; odd < 2; ++odd)
+            {
+                u16 t[8];
+                for (int i = 0; i < 8; ++i)
+                {
+                    int m = matrix[((y + dy) & (size - 1)) * size + ((odd * 8 + 7 - i + dx) & (size - 1))];
+                    t[i] = (u16)((blue ? m * 2 + 1 : m * 8 + 4) * 128);
+                }
+                thresholds[odd] = _mm_loadu_si128((const __m128i *)t);
+            }
+
+            for (int cx = 0; cx < 32; cx += 2, pixels += 16)
+            {
+                const OrderedCell* a = &cells[cx];
+                const OrderedCell* b = &cells[cx + 1];
+                __m128i inkA = _mm_cmpgt_epi16(orderedProject(pixels, a),
+                    _mm_add_epi16(a->offset, _mm_mulhi_epu16(a->length, thresholds[0])));
+                __m128i inkB = _mm_cmpgt_epi16(orderedProject(pixels + 8, b),
+                    _mm_add_epi16(b->offset, _mm_mulhi_epu16(b->length, thresholds[1])));
+                u16 bits = (u16)_mm_movemask_epi8(_mm_packs_epi16(inkA, inkB));
+                memcpy(out + cx, &bits, 2);
+            }
+        }
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
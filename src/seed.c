@@ -0,0 +1,325 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Seeded initialisation
+// A random population spends its first few thousand generations just climbing out of noise.  Seeding replaces part
+// of it with scrims made by quick conventional conversions, each a little different, and leaves the rest random so
+// the population doesn't start out collapsed.  Every seeded scrim gets its own generator, drawn from the converter's
+// before any work starts, so the result doesn't depend on how many threads made it.
+//----------------------------------------------------------------------------------------------------------------------
+
+#include "zximg.h"
+
+const char* gSeedMethodNames[SEED_COUNT] =
+{
+    "nearest", "ordered", "diffusion", "threshold", "bluenoise",
+};
+
+// 8x8 Bayer matrix
+const u8 gBayer[64] =
+{
+     0, 32,  8, 40,  2, 34, 10, 42,
+    48, 16, 56, 24, 50, 18, 58, 26,
+    12, 44,  4, 36, 14, 46,  6, 38,
+    60, 28, 52, 20, 62, 30, 54, 22,
+     3, 35, 11, 43,  1, 33,  9, 41,
+    51, 19, 59, 27, 49, 17, 57, 25,
+    15, 47,  7, 39, 13, 45,  5, 37,
+    63, 31, 55, 23, 61, 29, 53, 21,
+};
+
+typedef struct
+{
+    const Image*    target;
+    const u8*       attrs;          // Nearest two colours of every cell
+    SeedMethod      method;
+    u64             seed;
+    f32             mutationChance; // 0 for the exact conversion
+    u8*             scrim;
+}
+SeedTask;
+
+// Picks the ink, paper and brightness that best cover a cell, trying every pair
+u8 cellNearestTwo(const Image* target, int cx, int cy)
+{
+    int distance[64][16];
+    i64 bestError = -1;
+    u8 best = 0;
+
+    for (int p = 0; p < 64; ++p)
+    {
+        u32 c = target->pixels[(cy * 8 + p / 8) * 256 + cx * 8 + p % 8];
+        for (int i = 0; i < 16; ++i)
+        {
+            distance[p][i] = colourDistance(channelRed(c), channelGreen(c), channelBlue(c), gZxColours[i]);
+        }
+    }
+
+    for (int bright = 0; bright < 16; bright += 8)
+    {
+        for (int ink = 0; ink < 8; ++ink)
+        {
+            for (int paper = ink; paper < 8; ++paper)
+            {
+                i64 error = 0;
+                for (int p = 0; p < 64; ++p)
+                {
+                    int a = distance[p][bright + ink];
+                    int b = distance[p][bright + paper];
+                    error += a < b ? a : b;
+                }
+                if (bestError < 0 || error < bestError)
+                {
+                    bestError = error;
+                    best = (u8)((bright ? 0x40 : 0) | (paper << 3) | ink);
+                }
+            }
+        }
+    }
+
+    return best;
+}
+
+// Nearest colour to the average, within one brightness
+int nearestColour(int r, int g, int b, int bright, int* distance)
+{
+    int best = bright;
+    *distance = colourDistance(r, g, b, gZxColours[bright]);
+    for (int i = bright + 1; i < bright + 8; ++i)
+    {
+        int d = colourDistance(r, g, b, gZxColours[i]);
+        if (d < *distance)
+        {
+            *distance = d;
+            best = i;
+        }
+    }
+    return best & 7;
+}
+
+void seedNearest(const SeedTask* task)
+{
+    for (int y = 0; y < 192; ++y)
+    {
+        for (int x = 0; x < 256; ++x)
+        {
+            u32 c = task->target->pixels[y * 256 + x];
+            u8 attr = task->attrs[(y / 8) * 32 + x / 8];
+            int r = channelRed(c), g = channelGreen(c), b = channelBlue(c);
+            scrimSetPixel(task->scrim, x, y,
+                colourDistance(r, g, b, attrInk(attr)) < colourDistance(r, g, b, attrPaper(attr)));
+        }
+    }
+}
+
+// Thresholds how far each pixel lies from paper towards ink against a Bayer matrix, shifted by a random amount.
+void seedOrdered(const SeedTask* task, Rng* rng)
+{
+    int dx = rngRange(rng, 8);
+    int dy = rngRange(rng, 8);
+
+    for (int y = 0; y < 192; ++y)
+    {
+        for (int x = 0; x < 256; ++x)
+        {
+            u32 c = task->target->pixels[y * 256 + x];
+            u8 attr = task->attrs[(y / 8) * 32 + x / 8];
+            u32 ink = attrInk(attr), paper = attrPaper(attr);
+            int er = channelRed(ink) - channelRed(paper);
+            int eg = channelGreen(ink) - channelGreen(paper);
+            int eb = channelBlue(ink) - channelBlue(paper);
+            int length = er * er + eg * eg + eb * eb;
+            int along = (channelRed(c) - channelRed(paper)) * er + (channelGreen(c) - channelGreen(paper)) * eg +
+                (channelBlue(c) - channelBlue(paper)) * eb;
+
+            // along / length > (threshold + 0.5) / 64, kept in integers
+            int threshold = gBayer[((y + dy) & 7) * 8 + ((x + dx) & 7)];
+            scrimSetPixel(task->scrim, x, y, length && (i64)along * 128 > (i64)length * (threshold * 2 + 1));
+        }
+    }
+}
+
+// Floyd-Steinberg between each cell's two colours.  Random scan direction and strength give each scrim its own
+// pattern.
+void seedDiffusion(const SeedTask* task, Rng* rng)
+{
+    bool serpentine = rngRange(rng, 2) != 0;
+    int strength = 192 + rngRange(rng, 65);
+    ditherDiffuse(task->target, task->attrs, DITHER_FLOYD_STEINBERG, strength, serpentine, task->scrim);
+}
+
+// Splits each cell at its mean luminance, give or take a little, and colours each half with the nearest colour to
+// its average.  Unlike the others it chooses its own attributes.
+void seedThreshold(const SeedTask* task, Rng* rng)
+{
+    int bias = (int)rngRange(rng, 33) - 16;
+
+    for (int cy = 0; cy < 24; ++cy)
+    {
+        for (int cx = 0; cx < 32; ++cx)
+        {
+            int luma[64];
+            int sum[2][3] = { 0 };
+            int count[2] = { 0 };
+            int mean = 0;
+            int bestDistance = -1;
+            u8 attr = 0;
+
+            for (int p = 0; p < 64; ++p)
+            {
+                u32 c = task->target->pixels[(cy * 8 + p / 8) * 256 + cx * 8 + p % 8];
+                luma[p] = (channelRed(c) * 77 + channelGreen(c) * 150 + channelBlue(c) * 29) >> 8;
+                mean += luma[p];
+            }
+            mean = mean / 64 + bias;
+
+            for (int p = 0; p < 64; ++p)
+            {
+                u32 c = task->target->pixels[(cy * 8 + p / 8) * 256 + cx * 8 + p % 8];
+                int half = luma[p] > mean;
+                sum[half][0] += channelRed(c);
+                sum[half][1] += channelGreen(c);
+                sum[half][2] += channelBlue(c);
+                ++count[half];
+                scrimSetPixel(task->scrim, cx * 8 + p % 8, cy * 8 + p / 8, MAKE_BOOL(half));
+            }
+
+            for (int bright = 0; bright < 16; bright += 8)
+            {
+                int colour[2] = { 0, 0 };
+                int distance = 0;
+                for (int half = 0; half < 2; ++half)
+                {
+                    int d = 0;
+                    if (!count[half]) continue;
+                    colour[half] = nearestColour(sum[half][0] / count[half], sum[half][1] / count[half],
+                        sum[half][2] / count[half], bright, &d);
+                    distance += d * count[half];
+                }
+                if (bestDistance < 0 || distance < bestDistance)
+                {
+                    bestDistance = distance;
+                    attr = (u8)((bright ? 0x40 : 0) | (colour[0] << 3) | colour[1]);
+                }
+            }
+            task->scrim[6144 + cy * 32 + cx] = attr;
+        }
+    }
+}
+
+// The ordered engine's own attributes, with the matrix shifted by a random amount
+void seedBlueNoise(const SeedTask* task, Rng* rng)
+{
+    int dx = rngRange(rng, 16);
+    int dy = rngRange(rng, 16);
+    orderedScreen(task->target, DITHER_BLUE_NOISE, dx, dy, task->scrim);
+}
+
+void seedRun(void* arg)
+{
+    SeedTask* task = (SeedTask *)arg;
+    Rng rng;
+
+    rngSeed(&rng, task->seed);
+    if (task->method < SEED_THRESHOLD) memcpy(task->scrim + 6144, task->attrs, 768);
+
+    switch (task->method)
+    {
+    case SEED_NEAREST:      seedNearest(task);              break;
+    case SEED_ORDERED:      seedOrdered(task, &rng);        break;
+    case SEED_DIFFUSION:    seedDiffusion(task, &rng);      break;
+    case SEED_THRESHOLD:    seedThreshold(task, &rng);      break;
+    case SEED_BLUE_NOISE:   seedBlueNoise(task, &rng);      break;
+    default:                                                break;
+    }
+
+    if (task->mutationChance > 0)
+    {
+        for (int i = 0; i < 6912; ++i)
+        {
+            task->scrim[i] = mutate(&rng, task->scrim[i], task->mutationChance);
+        }
+    }
+}
+
+// Parses a comma separated list of method names into a mask, or returns 0 if any is unknown.
+u32 seedMethodsFromNames(const char* names)
+{
+    u32 methods = 0;
+
+    while (*names)
+    {
+        const char* end = strchr(names, ',');
+        size_t length = end ? (size_t)(end - names) : strlen(names);
+        int m = 0;
+
+        for (; m < SEED_COUNT; ++m)
+        {
+            if (strlen(gSeedMethodNames[m]) == length && !_strnicmp(names, gSeedMethodNames[m], length)) break;
+        }
+        if (m == SEED_COUNT) return 0;
+        methods |= 1 << m;
+        names += end ? length + 1 : length;
+    }
+
+    return methods;
+}
+
+// Replaces the first seeding->fraction of the unscored population with seeded scrims, taking turns between the
+// methods.  The first scrim from each method is the exact conversion; the rest are varied and mutated.  Call after
+// converterInit() and before the first step.
+void converterSeed(Converter* cv, const Seeding* seeding)
+{
+    u32 methods = seeding->methods ? seeding->methods : (1 << SEED_COUNT) - 1;
+    int count = (int)(seeding->fraction * POPULATION_SIZE + 0.5f);
+    int numThreads = seeding->numThreads > 0 ? seeding->numThreads : cpuCount();
+    SeedTask tasks[POPULATION_SIZE];
+    int numMethods = 0;
+    SeedMethod order[SEED_COUNT];
+    u8 attrs[768];
+
+    if (count <= 0) return;
+    if (count > POPULATION_SIZE) count = POPULATION_SIZE;
+    TRACE_BEGIN(seed);
+
+    for (int m = 0; m < SEED_COUNT; ++m)
+    {
+        if (methods & (1 << m)) order[numMethods++] = (SeedMethod)m;
+    }
+    for (int i = 0; i < 768; ++i)
+    {
+        attrs[i] = cellNearestTwo(cv->target, i % 32, i / 32);
+    }
+
+    for (int i = 0; i < count; ++i)
+    {
+        tasks[i].target = cv->target;
+        tasks[i].attrs = attrs;
+        tasks[i].method = order[i % numMethods];
+        tasks[i].seed = rngNext64(&cv->rng);
+        tasks[i].mutationChance = i < numMethods ? 0 : cv->mutationChance;
+        tasks[i].scrim = &cv->current->genomes[i * 6912];
+    }
+
+    if (numThreads > 1 && count > 1)
+    {
+        ThreadPool pool;
+        poolInit(&pool, numThreads < count ? numThreads : count, count);
+        for (int i = 0; i < count; ++i)
+        {
+            poolSubmit(&pool, &seedRun, &tasks[i]);
+        }
+        poolWait(&pool);
+        poolDone(&pool);
+    }
+    else
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            seedRun(&tasks[i]);
+        }
+    }
+
+    TRACE_END(seed);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
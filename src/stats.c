@@ -0,0 +1,156 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Instrumentation
+// Phases are timed with the time stamp counter, which costs a few cycles, into counters owned by the calling thread.
+// Snapshots add up every thread's counters and convert ticks to milliseconds using the rate measured since the
+// writer started, so nothing needs calibrating up front.
+//----------------------------------------------------------------------------------------------------------------------
+
+#include "zximg.h"
+
+#include <intrin.h>
+
+#define STATS_MAX_THREADS   64
+
+const char* gPhaseNames[PHASE_COUNT] =
+{
+    "score", "select", "crossover", "mutate", "display", "messages",
+};
+
+ThreadStats gThreadStats[STATS_MAX_THREADS];
+volatile LONG gNumThreadStats = 0;
+__declspec(thread) ThreadStats* tStats = 0;
+
+u64 statsTicks()
+{
+    return __rdtsc();
+}
+
+// Threads past the limit share the last slot; their figures get muddled but nothing breaks.
+ThreadStats* statsThread()
+{
+    if (!tStats)
+    {
+        LONG index = InterlockedIncrement(&gNumThreadStats) - 1;
+        tStats = &gThreadStats[index < STATS_MAX_THREADS ? index : STATS_MAX_THREADS - 1];
+    }
+    return tStats;
+}
+
+void statsWriterInit(StatsWriter* sw, FILE* file, bool json)
+{
+    sw->file = file;
+    sw->json = json;
+    sw->startTime = sw->lastTime = timeNow();
+    sw->startTicks = statsTicks();
+    sw->lastEvaluations = 0;
+
+    if (file && !json)
+    {
+        fprintf(file, "time,generation,evaluations,evals_per_sec,best,mean,worst,all_time_best,diversity");
+#ifdef ZXIMG_STATS
+        for (int p = 0; p < PHASE_COUNT; ++p)
+        {
+            fprintf(file, ",%s_ms,%s_calls", gPhaseNames[p], gPhaseNames[p]);
+        }
+#endif
+        fprintf(file, "\n");
+        fflush(file);
+    }
+}
+
+// Diversity is the mean fraction of bytes in which the scrims differ from the best one, so 0 when the population
+// has collapsed onto a single scrim and about 1 for a random one.
+f64 populationDiversity(const Population* pop)
+{
+    const u8* best = &pop->genomes[pop->indexBest * 6912];
+    i64 differ = 0;
+
+    for (int i = 0; i < POPULATION_SIZE; ++i)
+    {
+        const u8* genome = &pop->genomes[i * 6912];
+        for (int j = 0; j < 6912; ++j)
+        {
+            differ += genome[j] != best[j];
+        }
+    }
+
+    return (f64)differ / (f64)((POPULATION_SIZE - 1) * 6912);
+}
+
+// Writes one snapshot.  Population figures come from cv->future, the population scored by the last step.
+void statsWrite(StatsWriter* sw, const Converter* cv)
+{
+    const Population* pop = cv->future;
+    f64 now = timeNow();
+    f64 evalsPerSec = now > sw->lastTime ? (f64)(cv->evaluations - sw->lastEvaluations) / (now - sw->lastTime) : 0;
+    i64 best = 0, worst = 0;
+    f64 mean = 0, diversity = 0;
+
+    if (!sw->file) return;
+
+    if (cv->generation > 0)
+    {
+        best = pop->bestScore;
+        worst = pop->worseScore;
+        for (int i = 0; i < POPULATION_SIZE; ++i) mean += (f64)pop->errors[i];
+        mean /= POPULATION_SIZE;
+        diversity = populationDiversity(pop);
+    }
+
+    if (sw->json)
+    {
+        fprintf(sw->file, "{\"time\":%.3f,\"generation\":%lld,\"evaluations\":%lld,\"evals_per_sec\":%.1f,"
+            "\"best\":%lld,\"mean\":%.1f,\"worst\":%lld,\"all_time_best\":%lld,\"diversity\":%.4f",
+            now - sw->startTime, cv->generation, cv->evaluations, evalsPerSec, best, mean, worst, cv->bestError,
+            diversity);
+    }
+    else
+    {
+        fprintf(sw->file, "%.3f,%lld,%lld,%.1f,%lld,%.1f,%lld,%lld,%.4f",
+            now - sw->startTime, cv->generation, cv->evaluations, evalsPerSec, best, mean, worst, cv->bestError,
+            diversity);
+    }
+
+#ifdef ZXIMG_STATS
+    {
+        u64 ticks[PHASE_COUNT] = { 0 };
+        u64 calls[PHASE_COUNT] = { 0 };
+        int numThreads = gNumThreadStats < STATS_MAX_THREADS ? gNumThreadStats : STATS_MAX_THREADS;
+        f64 msPerTick = now > sw->startTime ? (now - sw->startTime) * 1000.0 / (f64)(statsTicks() - sw->startTicks) : 0;
+
+        // Other threads may be updating theirs as we read; a snapshot slightly out of date doesn't matter
+        for (int t = 0; t < numThreads; ++t)
+        {
+            for (int p = 0; p < PHASE_COUNT; ++p)
+            {
+                ticks[p] += gThreadStats[t].ticks[p];
+                calls[p] += gThreadStats[t].calls[p];
+            }
+        }
+
+        if (sw->json) fprintf(sw->file, ",\"phases\":{");
+        for (int p = 0; p < PHASE_COUNT; ++p)
+        {
+            if (sw->json)
+            {
+                fprintf(sw->file, "%s\"%s\":{\"ms\":%.3f,\"calls\":%llu}", p ? "," : "", gPhaseNames[p],
+                    (f64)ticks[p] * msPerTick, calls[p]);
+            }
+            else
+            {
+                fprintf(sw->file, ",%.3f,%llu", (f64)ticks[p] * msPerTick, calls[p]);
+            }
+        }
+        if (sw->json) fprintf(sw->file, "}");
+    }
+#endif
+
+    fprintf(sw->file, sw->json ? "}\n" : "\n");
+    fflush(sw->file);
+
+    sw->lastTime = now;
+    sw->lastEvaluations = cv->evaluations;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
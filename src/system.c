@@ -0,0 +1,176 @@
+//----------------------------------------------------------------------------------------------------------------------
+// System services
+// Timing, file mapping and threads
+//----------------------------------------------------------------------------------------------------------------------
+
+#include "zximg.h"
+
+#include <process.h>
+
+//----------------------------------------------------------------------------------------------------------------------
+// Timing
+//----------------------------------------------------------------------------------------------------------------------
+
+// Seconds since some fixed point in the past
+f64 timeNow()
+{
+    static f64 scale = 0;
+    LARGE_INTEGER t;
+    if (scale == 0)
+    {
+        LARGE_INTEGER freq;
+        QueryPerformanceFrequency(&freq);
+        scale = 1.0 / (f64)freq.QuadPart;
+    }
+    QueryPerformanceCounter(&t);
+    return (f64)t.QuadPart * scale;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Data loading
+//----------------------------------------------------------------------------------------------------------------------
+
+Data dataLoad(const char* fileName)
+{
+    Data d = { 0 };
+
+    d.file = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, 0, 0);
+    if (d.file != INVALID_HANDLE_VALUE)
+    {
+        DWORD fileSizeHigh, fileSizeLow;
+        fileSizeLow = GetFileSize(d.file, &fileSizeHigh);
+        d.fileMap = CreateFileMappingA(d.file, 0, PAGE_READONLY, fileSizeHigh, fileSizeLow, 0);
+
+        if (d.fileMap)
+        {
+            d.buffer = MapViewOfFile(d.fileMap, FILE_MAP_READ, 0, 0, 0);
+            d.size = ((i64)fileSizeHigh << 32) | fileSizeLow;
+        }
+        else
+        {
+            dataUnload(d);
+            memset(&d, 0, sizeof(d));
+        }
+    }
+    else
+    {
+        d.file = 0;
+    }
+
+    return d;
+}
+
+void dataUnload(Data data)
+{
+    if (data.buffer)    UnmapViewOfFile(data.buffer);
+    if (data.fileMap)   CloseHandle(data.fileMap);
+    if (data.file)      CloseHandle(data.file);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Thread pool
+// A fixed set of workers pulling tasks from a bounded queue.  Submitting blocks while the queue is full.
+//----------------------------------------------------------------------------------------------------------------------
+
+int cpuCount()
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (int)info.dwNumberOfProcessors : 1;
+}
+
+unsigned __stdcall poolWorker(void* arg)
+{
+    ThreadPool* pool = (ThreadPool *)arg;
+
+    traceThreadName("worker");
+    AcquireSRWLockExclusive(&pool->lock);
+    for (;;)
+    {
+        Task task;
+
+        while (!pool->count && !pool->quit)
+        {
+            SleepConditionVariableSRW(&pool->workReady, &pool->lock, INFINITE, 0);
+        }
+        if (!pool->count) break;
+
+        task = pool->tasks[pool->head];
+        pool->head = (pool->head + 1) % pool->capacity;
+        --pool->count;
+        ++pool->active;
+        WakeConditionVariable(&pool->spaceReady);
+        ReleaseSRWLockExclusive(&pool->lock);
+
+        task.func(task.arg);
+
+        AcquireSRWLockExclusive(&pool->lock);
+        --pool->active;
+        if (!pool->active && !pool->count) WakeAllConditionVariable(&pool->idle);
+    }
+    ReleaseSRWLockExclusive(&pool->lock);
+
+    return 0;
+}
+
+void poolInit(ThreadPool* pool, int numThreads, int capacity)
+{
+    memset(pool, 0, sizeof(ThreadPool));
+    InitializeSRWLock(&pool->lock);
+    InitializeConditionVariable(&pool->workReady);
+    InitializeConditionVariable(&pool->spaceReady);
+    InitializeConditionVariable(&pool->idle);
+
+    pool->capacity = capacity;
+    pool->tasks = (Task *)malloc(capacity * sizeof(Task));
+    pool->numThreads = numThreads;
+    pool->threads = (HANDLE *)malloc(numThreads * sizeof(HANDLE));
+    for (int i = 0; i < numThreads; ++i)
+    {
+        pool->threads[i] = (HANDLE)_beginthreadex(0, 0, &poolWorker, pool, 0, 0);
+    }
+}
+
+void poolSubmit(ThreadPool* pool, TaskFunc func, void* arg)
+{
+    AcquireSRWLockExclusive(&pool->lock);
+    while (pool->count == pool->capacity)
+    {
+        SleepConditionVariableSRW(&pool->spaceReady, &pool->lock, INFINITE, 0);
+    }
+    pool->tasks[(pool->head + pool->count) % pool->capacity].func = func;
+    pool->tasks[(pool->head + pool->count) % pool->capacity].arg = arg;
+    ++pool->count;
+    WakeConditionVariable(&pool->workReady);
+    ReleaseSRWLockExclusive(&pool->lock);
+}
+
+// Blocks until the queue is empty and no task is running.
+void poolWait(ThreadPool* pool)
+{
+    AcquireSRWLockExclusive(&pool->lock);
+    while (pool->count || pool->active)
+    {
+        SleepConditionVariableSRW(&pool->idle, &pool->lock, INFINITE, 0);
+    }
+    ReleaseSRWLockExclusive(&pool->lock);
+}
+
+void poolDone(ThreadPool* pool)
+{
+    AcquireSRWLockExclusive(&pool->lock);
+    pool->quit = YES;
+    WakeAllConditionVariable(&pool->workReady);
+    ReleaseSRWLockExclusive(&pool->lock);
+
+    for (int i = 0; i < pool->numThreads; ++i)
+    {
+        WaitForSingleObject(pool->threads[i], INFINITE);
+        CloseHandle(pool->threads[i]);
+    }
+    free(pool->threads);
+    free(pool->tasks);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,224 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Tracing
+// Every thread that records a zone gets its own ring of events, which it fills without locks or waiting.  A
+// background thread drains all the rings into the trace file every so often and once more at exit.  When a ring
+// is full the newest events are dropped and counted rather than stalling the thread being traced.
+//----------------------------------------------------------------------------------------------------------------------
+
+#include "zximg.h"
+
+#include <process.h>
+
+#define TRACE_MAX_THREADS   64
+#define TRACE_RING_SIZE     8192        // Events per thread; must be a power of two
+
+typedef struct
+{
+    const char* name;
+    i64         start;
+    i64         end;
+}
+TraceEvent;
+
+// Only the owning thread moves head and only the flusher moves tail
+typedef struct
+{
+    TraceEvent*     events;
+    volatile LONG   head;
+    volatile LONG   tail;
+    volatile LONG   dropped;
+    volatile LONG   ready;
+    const char*     threadName;
+    LONG            droppedReported;
+    bool            named;              // Thread name written to the file
+}
+TraceRing;
+
+typedef struct
+{
+    FILE*               file;
+    HANDLE              thread;
+    SRWLOCK             lock;
+    CONDITION_VARIABLE  wake;
+    i64                 flushMs;
+    bool                quit;
+    bool                first;          // Nothing written yet, so no comma
+    i64                 origin;
+    f64                 usPerTick;
+}
+Tracer;
+
+Tracer gTracer;
+volatile bool gTraceOn = NO;
+TraceRing gTraceRings[TRACE_MAX_THREADS];
+volatile LONG gTraceNumRings = 0;
+__declspec(thread) TraceRing* tTraceRing = 0;
+__declspec(thread) const char* tTraceName = 0;
+
+void traceThreadName(const char* name)
+{
+    tTraceName = name;
+    if (tTraceRing) tTraceRing->threadName = name;
+}
+
+// Returns 0 when there are no rings left, in which case the thread isn't traced.
+TraceRing* traceRing()
+{
+    if (!tTraceRing)
+    {
+        LONG index = InterlockedIncrement(&gTraceNumRings) - 1;
+        TraceRing* ring;
+        if (index >= TRACE_MAX_THREADS) return 0;
+
+        ring = &gTraceRings[index];
+        ring->events = (TraceEvent *)calloc(TRACE_RING_SIZE, sizeof(TraceEvent));
+        ring->threadName = tTraceName ? tTraceName : "thread";
+        InterlockedExchange(&ring->ready, 1);
+        tTraceRing = ring;
+    }
+    return tTraceRing;
+}
+
+i64 traceBegin()
+{
+    LARGE_INTEGER t;
+    if (!gTraceOn) return 0;
+    QueryPerformanceCounter(&t);
+    return t.QuadPart;
+}
+
+void traceEnd(const char* name, i64 start)
+{
+    LARGE_INTEGER t;
+    TraceRing* ring;
+    LONG head;
+
+    if (!start || !gTraceOn) return;
+    QueryPerformanceCounter(&t);
+    ring = traceRing();
+    if (!ring) return;
+
+    head = ring->head;
+    if (head - ring->tail >= TRACE_RING_SIZE)
+    {
+        InterlockedIncrement(&ring->dropped);
+        return;
+    }
+    ring->events[head & (TRACE_RING_SIZE - 1)].name = name;
+    ring->events[head & (TRACE_RING_SIZE - 1)].start = start;
+    ring->events[head & (TRACE_RING_SIZE - 1)].end = t.QuadPart;
+
+    // Publishes the event; the exchange is a full barrier so the flusher never sees head before the event
+    InterlockedExchange(&ring->head, head + 1);
+}
+
+void traceWriteSeparator()
+{
+    fprintf(gTracer.file, gTracer.first ? "\n" : ",\n");
+    gTracer.first = NO;
+}
+
+// Called from the flusher, or after it has stopped
+void traceFlush()
+{
+    int numRings = gTraceNumRings < TRACE_MAX_THREADS ? gTraceNumRings : TRACE_MAX_THREADS;
+
+    for (int r = 0; r < numRings; ++r)
+    {
+        TraceRing* ring = &gTraceRings[r];
+        LONG head, tail;
+        if (!ring->ready) continue;
+
+        if (!ring->named)
+        {
+            traceWriteSeparator();
+            fprintf(gTracer.file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                r + 1, ring->threadName);
+            ring->named = YES;
+        }
+
+        head = ring->head;
+        for (tail = ring->tail; tail != head; ++tail)
+        {
+            const TraceEvent* e = &ring->events[tail & (TRACE_RING_SIZE - 1)];
+            traceWriteSeparator();
+            fprintf(gTracer.file, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                e->name, r + 1, (f64)(e->start - gTracer.origin) * gTracer.usPerTick,
+                (f64)(e->end - e->start) * gTracer.usPerTick);
+        }
+        InterlockedExchange(&ring->tail, tail);
+
+        if (ring->dropped != ring->droppedReported)
+        {
+            LARGE_INTEGER t;
+            QueryPerformanceCounter(&t);
+            ring->droppedReported = ring->dropped;
+            traceWriteSeparator();
+            fprintf(gTracer.file, "{\"name\":\"dropped events\",\"ph\":\"C\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,"
+                "\"args\":{\"events\":%d}}", r + 1, (f64)(t.QuadPart - gTracer.origin) * gTracer.usPerTick,
+                (int)ring->droppedReported);
+        }
+    }
+
+    fflush(gTracer.file);
+}
+
+unsigned __stdcall traceWorker(void* arg)
+{
+    AcquireSRWLockExclusive(&gTracer.lock);
+    while (!gTracer.quit)
+    {
+        SleepConditionVariableSRW(&gTracer.wake, &gTracer.lock, (DWORD)gTracer.flushMs, 0);
+        ReleaseSRWLockExclusive(&gTracer.lock);
+        traceFlush();
+        AcquireSRWLockExclusive(&gTracer.lock);
+    }
+    ReleaseSRWLockExclusive(&gTracer.lock);
+
+    return 0;
+}
+
+// Starts recording zones into a new trace file, draining the rings every flushMs milliseconds.
+void traceInit(const char* fileName, i64 flushMs)
+{
+    LARGE_INTEGER t, freq;
+
+    memset(&gTracer, 0, sizeof(Tracer));
+    gTracer.file = fopen(fileName, "wt");
+    if (!gTracer.file) return;
+
+    InitializeSRWLock(&gTracer.lock);
+    InitializeConditionVariable(&gTracer.wake);
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&t);
+    gTracer.usPerTick = 1000000.0 / (f64)freq.QuadPart;
+    gTracer.origin = t.QuadPart;
+    gTracer.flushMs = flushMs > 0 ? flushMs : 1000;
+    gTracer.first = YES;
+    fprintf(gTracer.file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+    gTraceOn = YES;
+    gTracer.thread = (HANDLE)_beginthreadex(0, 0, &traceWorker, 0, 0, 0);
+}
+
+// Stops recording, writes whatever is left and closes the file
+void traceDone()
+{
+    if (!gTracer.file) return;
+
+    gTraceOn = NO;
+    AcquireSRWLockExclusive(&gTracer.lock);
+    gTracer.quit = YES;
+    WakeConditionVariable(&gTracer.wake);
+    ReleaseSRWLockExclusive(&gTracer.lock);
+    WaitForSingleObject(gTracer.thread, INFINITE);
+    CloseHandle(gTracer.thread);
+
+    traceFlush();
+    fprintf(gTracer.file, "\n]}\n");
+    fclose(gTracer.file);
+    gTracer.file = 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
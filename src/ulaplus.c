@@ -0,0 +1,209 @@
+//----------------------------------------------------------------------------------------------------------------------
+// ULAplus
+// A ULAplus machine keeps 64 palette entries, each a GGGRRRBB byte, in four CLUTs of 16: eight inks then eight
+// papers.  An attribute's FLASH and BRIGHT bits pick the CLUT instead of flashing and brightening.  In ULAplus mode
+// every scrim carries its own palette, which breeds along with it, and the screen is saved as a 6,976 byte .scr with
+// the palette after the attributes.
+//
+// A scrim's error is kept cell by cell, as blur mode keeps its scores.  A child starts from its parent's table and
+// only re-scores the cells whose bytes differ, plus those whose ink or paper entry differs in the palette, so a
+// palette change costs the cells of the CLUT that use it rather than the whole screen.
+//----------------------------------------------------------------------------------------------------------------------
+
+#include "zximg.h"
+
+#include <emmintrin.h>
+
+// A 3 bit level spread over 8 bits
+int ulaplusLevel(int v)
+{
+    return (v << 5) | (v << 2) | (v >> 1);
+}
+
+// Colour of a palette entry, in the layout of gZxColours.  Blue's missing low bit is the OR of the other two.
+u32 ulaplusColour(u8 entry)
+{
+    int g = entry >> 5;
+    int r = (entry >> 2) & 7;
+    int b = ((entry & 3) << 1) | ((entry & 1) | ((entry >> 1) & 1));
+    return (u32)((ulaplusLevel(r) << 16) | (ulaplusLevel(g) << 8) | ulaplusLevel(b));
+}
+
+// Palette entries of an attribute's ink and paper
+int ulaplusInk(u8 attr)     { return (attr >> 6) * 16 + (attr & 7); }
+int ulaplusPaper(u8 attr)   { return (attr >> 6) * 16 + 8 + ((attr >> 3) & 7); }
+
+// The palette closest to the standard colours, so a scrim shows as it would without ULAplus: BRIGHT picks the
+// bright CLUTs and FLASH makes no difference.
+void ulaplusDefault(u8* palette)
+{
+    u8 nearest[16];
+
+    for (int c = 0; c < 16; ++c)
+    {
+        int best = -1;
+        for (int e = 0; e < 256; ++e)
+        {
+            u32 colour = ulaplusColour((u8)e);
+            int d = colourDistance(channelRed(colour), channelGreen(colour), channelBlue(colour), gZxColours[c]);
+            if (best < 0 || d < best)
+            {
+                best = d;
+                nearest[c] = (u8)e;
+            }
+        }
+    }
+    for (int e = 0; e < 64; ++e)
+    {
+        palette[e] = nearest[(e & 7) + ((e >> 4) & 1) * 8];
+    }
+}
+
+// Turns a ULAplus scrim, palette included, into a 256x192 image
+Image* ulaplusConvert(Image* img, const u8* bytes)
+{
+    const __m128i bitsLeft = _mm_setr_epi32(0x80, 0x40, 0x20, 0x10);
+    const __m128i bitsRight = _mm_setr_epi32(0x08, 0x04, 0x02, 0x01);
+    const u8* palette = bytes + 6912;
+
+    for (int row = 0; row < 24; ++row)
+    {
+        for (int x = 0; x < 32; ++x)
+        {
+            u8 attr = bytes[6144 + row * 32 + x];
+            u32 ink = ulaplusColour(palette[ulaplusInk(attr)]);
+            u32 pap = ulaplusColour(palette[ulaplusPaper(attr)]);
+            __m128i paper = _mm_set1_epi32(pap);
+            __m128i diff = _mm_set1_epi32(ink ^ pap);
+            const u8* src = bytes + scrimOffset(x * 8, row * 8);
+            __m128i* dst = (__m128i *)(img->pixels + row * 8 * 256 + x * 8);
+
+            for (int line = 0; line < 8; ++line, src += 256, dst += 64)
+            {
+                __m128i b = _mm_set1_epi32(*src);
+                __m128i l = _mm_cmpeq_epi32(_mm_and_si128(b, bitsLeft), bitsLeft);
+                __m128i r = _mm_cmpeq_epi32(_mm_and_si128(b, bitsRight), bitsRight);
+                _mm_storeu_si128(dst, _mm_xor_si128(paper, _mm_and_si128(l, diff)));
+                _mm_storeu_si128(dst + 1, _mm_xor_si128(paper, _mm_and_si128(r, diff)));
+            }
+        }
+    }
+
+    return img;
+}
+
+// checkError() of one cell drawn in the given colours
+i64 ulaplusCellError(const Image* target, const u8* genome, int cell, u32 ink, u32 pap)
+{
+    const __m128i bitsLeft = _mm_setr_epi32(0x80, 0x40, 0x20, 0x10);
+    const __m128i bitsRight = _mm_setr_epi32(0x08, 0x04, 0x02, 0x01);
+    const __m128i zero = _mm_setzero_si128();
+    const u32* pixels = &target->pixels[(cell / 32) * 8 * 256 + (cell % 32) * 8];
+    const u8* src = genome + scrimOffset((cell % 32) * 8, (cell / 32) * 8);
+    __m128i paper = _mm_set1_epi32(pap);
+    __m128i diff = _mm_set1_epi32(ink ^ pap);
+    __m128i sum = zero;
+    i64 total[2];
+
+    for (int line = 0; line < 8; ++line, src += 256, pixels += 256)
+    {
+        __m128i b = _mm_set1_epi32(*src);
+        __m128i l = _mm_cmpeq_epi32(_mm_and_si128(b, bitsLeft), bitsLeft);
+        __m128i r = _mm_cmpeq_epi32(_mm_and_si128(b, bitsRight), bitsRight);
+        l = _mm_sub_epi32(_mm_xor_si128(paper, _mm_and_si128(l, diff)), _mm_loadu_si128((const __m128i *)pixels));
+        r = _mm_sub_epi32(_mm_xor_si128(paper, _mm_and_si128(r, diff)), _mm_loadu_si128((const __m128i *)(pixels + 4)));
+
+        // abs() as checkError() takes it, then widened to 64 bits by unpacking with zero
+        l = _mm_sub_epi32(_mm_xor_si128(l, _mm_srai_epi32(l, 31)), _mm_srai_epi32(l, 31));
+        r = _mm_sub_epi32(_mm_xor_si128(r, _mm_srai_epi32(r, 31)), _mm_srai_epi32(r, 31));
+        sum = _mm_add_epi64(sum, _mm_add_epi64(_mm_unpacklo_epi32(l, zero), _mm_unpackhi_epi32(l, zero)));
+        sum = _mm_add_epi64(sum, _mm_add_epi64(_mm_unpacklo_epi32(r, zero), _mm_unpackhi_epi32(r, zero)));
+    }
+    _mm_storeu_si128((__m128i *)total, sum);
+
+    return total[0] + total[1];
+}
+
+// Switches a converter that has just been initialised or resumed to ULAplus.  A fresh converter gives every scrim the
+// default palette; a resumed one's palettes are loaded afterwards.  Memory comes from the current arena.
+void converterUlaplus(Converter* cv, bool fresh)
+{
+    u8 palette[64];
+
+    cv->current->cellErrors = (i64 *)populationArray(768 * sizeof(i64));
+    cv->future->cellErrors = (i64 *)populationArray(768 * sizeof(i64));
+    cv->current->palettes = (u8 *)populationArray(64);
+    cv->future->palettes = (u8 *)populationArray(64);
+    cv->ulaplus = YES;
+    if (!fresh) return;
+
+    ulaplusDefault(palette);
+    for (int i = 0; i < POPULATION_SIZE; ++i)
+    {
+        memcpy(&cv->current->palettes[i * 64], palette, 64);
+    }
+    memcpy(cv->best + 6912, palette, 64);
+}
+
+// Scores scrim index of pop, re-scoring only the cells that changed since its parent in parents, the population it
+// was bred from.  Scrims without a parent are scored in full.
+i64 ulaplusError(const Converter* cv, Population* pop, int index, const Population* parents)
+{
+    const u8* genome = &pop->genomes[index * 6912];
+    const u8* palette = &pop->palettes[index * 64];
+    i64* errors = &pop->cellErrors[index * 768];
+    int parent = pop->parents[index];
+    bool dirty[768];
+    i64 total = 0;
+
+    if (parent < 0)
+    {
+        memset(dirty, YES, sizeof(dirty));
+    }
+    else
+    {
+        const u8* from = &parents->genomes[parent * 6912];
+        const u8* fromPalette = &parents->palettes[parent * 64];
+        u64 entries = 0;        // Palette entries that differ
+
+        memcpy(errors, &parents->cellErrors[parent * 768], 768 * sizeof(i64));
+        memset(dirty, NO, sizeof(dirty));
+        for (int i = 0; i < 6912; i += 8)
+        {
+            if (*(const u64 *)(genome + i) == *(const u64 *)(from + i)) continue;
+            for (int j = i; j < i + 8; ++j)
+            {
+                if (genome[j] != from[j]) dirty[blurCellOf(j)] = YES;
+            }
+        }
+        for (int e = 0; e < 64; ++e)
+        {
+            if (palette[e] != fromPalette[e]) entries |= 1ull << e;
+        }
+
+        if (entries)
+        {
+            for (int cell = 0; cell < 768; ++cell)
+            {
+                u8 attr = genome[6144 + cell];
+                if ((entries >> ulaplusInk(attr) | entries >> ulaplusPaper(attr)) & 1) dirty[cell] = YES;
+            }
+        }
+    }
+
+    for (int cell = 0; cell < 768; ++cell)
+    {
+        if (dirty[cell])
+        {
+            u8 attr = genome[6144 + cell];
+            errors[cell] = ulaplusCellError(cv->target, genome, cell, ulaplusColour(palette[ulaplusInk(attr)]),
+                ulaplusColour(palette[ulaplusPaper(attr)]));
+        }
+        total += errors[cell];
+    }
+
+    return total;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,387 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Video streaming
+// Converts a YUV4MPEG2 stream, from a file or stdin, into a stream of 6,912 byte screens, one per frame, to a file or
+// stdout.  Reading, converting and writing each have a thread, and pass frames round a small ring of slots: the
+// reader fills a slot with a frame resampled to 256x192, the converter gives it a screen within the per-frame budget,
+// and the writer sends the screen on and frees the slot.  A stage that gets ahead waits for the one behind, so memory
+// is fixed by the ring whatever the length of the clip.  As with an animation, every frame carries on from the one
+// before, frozen wherever its pixels are unchanged.
+//----------------------------------------------------------------------------------------------------------------------
+
+#include "zximg.h"
+
+#include <process.h>
+
+#define VIDEO_RING_SIZE     4
+#define VIDEO_BUFFER_SIZE   (64 << 10)
+#define VIDEO_ARENA_SIZE    (64 << 20)
+
+typedef struct
+{
+    Image*  target;
+    u8      scr[6912];
+}
+VideoSlot;
+
+typedef struct
+{
+    HANDLE              in;
+    HANDLE              out;
+    u8*                 buffer;             // Input read ahead
+    int                 bufferPos;
+    int                 bufferSize;
+    int                 width;
+    int                 height;
+    int                 chromaShiftX;       // Chroma subsampling across...
+    int                 chromaShiftY;       // ...and down
+    bool                mono;               // No chroma planes at all
+    u8*                 planes;             // One frame as it was read: Y, then U and V
+    u8*                 rgba;               // ...and converted for imagePrepareTarget()
+    VideoSlot           slots[VIDEO_RING_SIZE];
+    int                 decoded;            // Frames read into slots
+    int                 converted;          // ...then given screens
+    int                 written;            // ...then written, freeing their slots
+    bool                ended;              // The reader has read its last frame
+    bool                finished;           // ...and the converter has converted it
+    const char*         inputError;         // Why the input ended early, if it did; what was read still goes out
+    const char*         error;              // Set by a stage that failed, and the others stop
+    SRWLOCK             lock;
+    CONDITION_VARIABLE  changed;
+}
+Video;
+
+// Reads up to size bytes, fewer only at the end of the input.  Returns how many.
+int videoRead(Video* v, u8* dst, int size)
+{
+    int done = 0;
+
+    while (done < size)
+    {
+        DWORD got = 0;
+        int n;
+
+        if (v->bufferPos == v->bufferSize)
+        {
+            if (!ReadFile(v->in, v->buffer, VIDEO_BUFFER_SIZE, &got, 0) || !got) break;
+            v->bufferPos = 0;
+            v->bufferSize = (int)got;
+        }
+        n = v->bufferSize - v->bufferPos < size - done ? v->bufferSize - v->bufferPos : size - done;
+        memcpy(dst + done, v->buffer + v->bufferPos, n);
+        v->bufferPos += n;
+        done += n;
+    }
+
+    return done;
+}
+
+// Reads a header line without its newline, cut short at max - 1 characters.  Returns NO at the end of the input.
+bool videoReadLine(Video* v, char* line, int max)
+{
+    int length = 0;
+    u8 c;
+
+    for (;;)
+    {
+        if (!videoRead(v, &c, 1)) return MAKE_BOOL(length);
+        if (c == '\n') break;
+        if (length < max - 1) line[length++] = (char)c;
+    }
+    line[length] = 0;
+
+    return YES;
+}
+
+// Parses the stream header.  Returns a reason on failure, 0 on success.
+const char* videoHeader(Video* v)
+{
+    char line[1024];
+
+    if (!videoReadLine(v, line, sizeof(line)) || strncmp(line, "YUV4MPEG2", 9)) return "not a YUV4MPEG2 stream";
+
+    // 4:2:0 unless it says otherwise
+    v->chromaShiftX = v->chromaShiftY = 1;
+    for (char* token = strtok(line + 9, " "); token; token = strtok(0, " "))
+    {
+        if (token[0] == 'W')                v->width = atoi(token + 1);
+        else if (token[0] == 'H')           v->height = atoi(token + 1);
+        else if (!strcmp(token, "C444"))    v->chromaShiftX = v->chromaShiftY = 0;
+        else if (!strcmp(token, "C422"))    v->chromaShiftY = 0;
+        else if (!strcmp(token, "Cmono"))   v->mono = YES;
+        else if (token[0] == 'C' && strcmp(token, "C420") && strcmp(token, "C420jpeg") &&
+            strcmp(token, "C420paldv") && strcmp(token, "C420mpeg2"))
+        {
+            return "unsupported colour space";
+        }
+    }
+    if (v->width <= 0 || v->height <= 0 || v->width > 8192 || v->height > 8192) return "bad frame size";
+
+    return 0;
+}
+
+// Reads the next frame into a 256x192 target.  Returns NO at the end of the stream, setting *error if it ended part
+// way through a frame.  Colours are BT.601 with studio range, as YUV4MPEG2 streams almost always are.
+bool videoFrame(Video* v, Image* target, const char** error)
+{
+    int chromaWidth = (v->width + (1 << v->chromaShiftX) - 1) >> v->chromaShiftX;
+    int chromaHeight = (v->height + (1 << v->chromaShiftY) - 1) >> v->chromaShiftY;
+    int lumaSize = v->width * v->height;
+    int chromaSize = v->mono ? 0 : chromaWidth * chromaHeight;
+    const u8* lumaPlane = v->planes;
+    const u8* uPlane = v->planes + lumaSize;
+    const u8* vPlane = uPlane + chromaSize;
+    char line[256];
+    u8* out = v->rgba;
+
+    if (!videoReadLine(v, line, sizeof(line))) return NO;
+    if (strncmp(line, "FRAME", 5))
+    {
+        *error = "corrupt frame header";
+        return NO;
+    }
+    if (videoRead(v, v->planes, lumaSize + chromaSize * 2) < lumaSize + chromaSize * 2)
+    {
+        *error = "truncated frame";
+        return NO;
+    }
+
+    TRACE_BEGIN(decode);
+    for (int y = 0; y < v->height; ++y)
+    {
+        const u8* luma = lumaPlane + y * v->width;
+        int row = (y >> v->chromaShiftY) * chromaWidth;
+
+        for (int x = 0; x < v->width; ++x, out += 4)
+        {
+            int c = 298 * (luma[x] - 16) + 128;
+            int d = v->mono ? 0 : uPlane[row + (x >> v->chromaShiftX)] - 128;
+            int e = v->mono ? 0 : vPlane[row + (x >> v->chromaShiftX)] - 128;
+            int r = (c + 409 * e) >> 8;
+            int g = (c - 100 * d - 208 * e) >> 8;
+            int b = (c + 516 * d) >> 8;
+
+            out[0] = (u8)(r < 0 ? 0 : (r > 255 ? 255 : r));
+            out[1] = (u8)(g < 0 ? 0 : (g > 255 ? 255 : g));
+            out[2] = (u8)(b < 0 ? 0 : (b > 255 ? 255 : b));
+            out[3] = 255;
+        }
+    }
+    TRACE_END(decode);
+    imagePrepareTarget(target, v->rgba, v->width, v->height);
+
+    return YES;
+}
+
+unsigned __stdcall videoReader(void* arg)
+{
+    Video* v = (Video *)arg;
+    const char* error = 0;
+
+    traceThreadName("video reader");
+
+    for (;;)
+    {
+        int frame;
+        bool ok;
+
+        AcquireSRWLockExclusive(&v->lock);
+        while (!v->error && v->decoded - v->written >= VIDEO_RING_SIZE)
+        {
+            SleepConditionVariableSRW(&v->changed, &v->lock, INFINITE, 0);
+        }
+        frame = v->decoded;
+        ok = !v->error;
+        ReleaseSRWLockExclusive(&v->lock);
+        if (!ok) break;
+
+        ok = videoFrame(v, v->slots[frame % VIDEO_RING_SIZE].target, &error);
+
+        AcquireSRWLockExclusive(&v->lock);
+        if (ok) ++v->decoded;
+        else v->ended = YES;
+        v->inputError = error;
+        WakeAllConditionVariable(&v->changed);
+        ReleaseSRWLockExclusive(&v->lock);
+        if (!ok) break;
+    }
+
+    return 0;
+}
+
+unsigned __stdcall videoWriter(void* arg)
+{
+    Video* v = (Video *)arg;
+
+    traceThreadName("video writer");
+
+    for (;;)
+    {
+        DWORD written = 0;
+        int frame;
+        bool ok;
+
+        AcquireSRWLockExclusive(&v->lock);
+        while (!v->error && v->written == v->converted && !v->finished)
+        {
+            SleepConditionVariableSRW(&v->changed, &v->lock, INFINITE, 0);
+        }
+        frame = v->written;
+        ok = !v->error && v->written < v->converted;
+        ReleaseSRWLockExclusive(&v->lock);
+        if (!ok) break;
+
+        TRACE_BEGIN(export);
+        ok = MAKE_BOOL(WriteFile(v->out, v->slots[frame % VIDEO_RING_SIZE].scr, 6912, &written, 0) && written == 6912);
+        TRACE_END(export);
+
+        AcquireSRWLockExclusive(&v->lock);
+        if (ok) ++v->written;
+        else if (!v->error) v->error = "cannot write output";
+        WakeAllConditionVariable(&v->changed);
+        ReleaseSRWLockExclusive(&v->lock);
+    }
+
+    return 0;
+}
+
+// Converts one frame within the budget, carrying on from prev unless it's the first.  It stops when another generation
+// would overrun the deadline.
+void videoConvert(Converter* cv, const Converter* prev, Image* target, const BatchOptions* options, int frame)
+{
+    const Budget* budget = &options->budget;
+    f64 deadline = budgetDeadline(budget, timeNow(), 0);
+    f64 stepTime = 0;
+
+    converterInit(cv, target, options->seed + frame);
+    cv->stagnation = budget->stagnation;
+    if (!prev)
+    {
+        Seeding seeding = options->seeding;
+        seeding.numThreads = options->numThreads;
+        converterSeed(cv, &seeding);
+    }
+    else
+    {
+        converterAnimate(cv, prev);
+        if (!cv->numLive) return;
+    }
+
+    while (budgetCheck(budget, cv, deadline, stepTime) == STOP_NONE)
+    {
+        f64 t = timeNow();
+        converterStep(cv);
+        stepTime = budgetStepTime(stepTime, timeNow() - t);
+    }
+}
+
+// Converts a YUV4MPEG2 stream from source, or stdIn if it is "-", writing screens to options->outDir, or stdOut if
+// that is 0 or "-".  The standard handles are taken before the console is attached, which may replace them.  Messages
+// go to stderr, so they never end up in the stream.  Returns 0 on success.
+int videoRun(const char* source, const BatchOptions* options, HANDLE stdIn, HANDLE stdOut)
+{
+    const char* outName = options->outDir && strcmp(options->outDir, "-") ? options->outDir : 0;
+    Video* v = (Video *)calloc(1, sizeof(Video));
+    Arena* prevArena = arenaUse(0);
+    Arena arenas[2];
+    Converter converters[2];
+    HANDLE threads[2];
+    const char* error;
+    f64 start = timeNow();
+    i64 generations = 0;
+    int frame = 0;
+
+    v->in = strcmp(source, "-") ? CreateFileA(source, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING,
+        FILE_FLAG_SEQUENTIAL_SCAN, 0) : stdIn;
+    v->out = outName ? CreateFileA(outName, GENERIC_WRITE, 0, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0) : stdOut;
+    v->buffer = (u8 *)malloc(VIDEO_BUFFER_SIZE);
+    error = v->in == INVALID_HANDLE_VALUE ? "cannot open input" : v->out == INVALID_HANDLE_VALUE ?
+        "cannot open output" : videoHeader(v);
+    if (error)
+    {
+        fprintf(stderr, "%s: %s\n", source, error);
+        if (v->in != INVALID_HANDLE_VALUE && v->in != stdIn) CloseHandle(v->in);
+        if (v->out != INVALID_HANDLE_VALUE && v->out != stdOut) CloseHandle(v->out);
+        free(v->buffer);
+        free(v);
+        arenaUse(prevArena);
+        return 1;
+    }
+
+    v->planes = (u8 *)malloc((size_t)v->width * v->height * 3);
+    v->rgba = (u8 *)malloc((size_t)v->width * v->height * 4);
+    for (int i = 0; i < VIDEO_RING_SIZE; ++i)
+    {
+        v->slots[i].target = imageCreate(256, 192);
+    }
+    arenaInit(&arenas[0], VIDEO_ARENA_SIZE);
+    arenaInit(&arenas[1], VIDEO_ARENA_SIZE);
+    InitializeSRWLock(&v->lock);
+    InitializeConditionVariable(&v->changed);
+    threads[0] = (HANDLE)_beginthreadex(0, 0, &videoReader, v, 0, 0);
+    threads[1] = (HANDLE)_beginthreadex(0, 0, &videoWriter, v, 0, 0);
+
+    for (;; ++frame)
+    {
+        VideoSlot* slot = &v->slots[frame % VIDEO_RING_SIZE];
+        Converter* cv = &converters[frame & 1];
+        Image* target;
+        bool ok;
+
+        AcquireSRWLockExclusive(&v->lock);
+        while (!v->error && v->converted == v->decoded && !v->ended)
+        {
+            SleepConditionVariableSRW(&v->changed, &v->lock, INFINITE, 0);
+        }
+        ok = !v->error && v->converted < v->decoded;
+        ReleaseSRWLockExclusive(&v->lock);
+        if (!ok) break;
+
+        // The slot is reused once it's written, but the next frame still needs this one's target
+        arenaReset(&arenas[frame & 1]);
+        arenaUse(&arenas[frame & 1]);
+        target = imageCreate(256, 192);
+        memcpy(target->pixels, slot->target->pixels, 256 * 192 * sizeof(u32));
+        videoConvert(cv, frame ? &converters[(frame - 1) & 1] : 0, target, options, frame);
+        memcpy(slot->scr, cv->best, 6912);
+        generations += cv->generation;
+        arenaUse(0);
+
+        AcquireSRWLockExclusive(&v->lock);
+        ++v->converted;
+        WakeAllConditionVariable(&v->changed);
+        ReleaseSRWLockExclusive(&v->lock);
+    }
+
+    AcquireSRWLockExclusive(&v->lock);
+    v->finished = YES;
+    WakeAllConditionVariable(&v->changed);
+    ReleaseSRWLockExclusive(&v->lock);
+    WaitForMultipleObjects(2, threads, TRUE, INFINITE);
+    CloseHandle(threads[0]);
+    CloseHandle(threads[1]);
+
+    if (v->inputError) fprintf(stderr, "%s: frame %d: %s\n", source, v->decoded, v->inputError);
+    if (v->error) fprintf(stderr, "%s: frame %d: %s\n", source, v->written, v->error);
+    fprintf(stderr, "%d frames of %dx%d, %.2fs: %.1f frames/s, %.1f generations/s\n", v->written, v->width, v->height,
+        timeNow() - start, v->written / (timeNow() - start), (f64)generations / (timeNow() - start));
+    error = v->error;
+
+    for (int i = 0; i < VIDEO_RING_SIZE; ++i)
+    {
+        imageDestroy(v->slots[i].target);
+    }
+    arenaDone(&arenas[0]);
+    arenaDone(&arenas[1]);
+    if (v->in != stdIn) CloseHandle(v->in);
+    if (v->out != stdOut) CloseHandle(v->out);
+    free(v->planes);
+    free(v->rgba);
+    free(v->buffer);
+    free(v);
+    arenaUse(prevArena);
+
+    return error ? 1 : 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
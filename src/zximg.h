@@ -0,0 +1,636 @@
+//----------------------------------------------------------------------------------------------------------------------
+// GA-based image->ZX scr converter
+// Declarations shared by the converter, the tools and the benchmarks
+//----------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define POPULATION_SIZE     100
+#define CROSSOVER_CHANCE    0.7
+#define MUTATION_CHANCE     0.01
+#define SCREEN_MAX_SIZE     (6912 * 2)      // A pair of Gigascreen frames, the largest a converter makes
+
+//----------------------------------------------------------------------------------------------------------------------
+// Basic typedefs
+//----------------------------------------------------------------------------------------------------------------------
+
+typedef INT8    i8;
+typedef INT16   i16;
+typedef INT32   i32;
+typedef INT64   i64;
+
+typedef UINT8   u8;
+typedef UINT16  u16;
+typedef UINT32  u32;
+typedef UINT64  u64;
+
+typedef float   f32;
+typedef double  f64;
+
+typedef char    bool;
+
+#define YES 1
+#define NO 0
+#define MAKE_BOOL(x) ((x) ? YES : NO)
+
+//----------------------------------------------------------------------------------------------------------------------
+// Memory arenas (memory.c)
+//----------------------------------------------------------------------------------------------------------------------
+
+typedef struct
+{
+    u8*     base;
+    size_t  reserved;
+    size_t  committed;
+    size_t  used;
+    size_t  last;           // Offset of the most recent allocation, so it can be grown in place
+    size_t  peak;
+}
+Arena;
+
+void arenaInit(Arena* arena, size_t reserveSize);
+void arenaDone(Arena* arena);
+void* arenaAlloc(Arena* arena, size_t size);
+void* arenaRealloc(Arena* arena, void* ptr, size_t oldSize, size_t newSize);
+bool arenaOwns(Arena* arena, void* ptr);
+void arenaReset(Arena* arena);
+Arena* arenaUse(Arena* arena);
+
+void* memAlloc(size_t size);
+void* memRealloc(void* ptr, size_t oldSize, size_t newSize);
+void memFree(void* ptr);
+
+//----------------------------------------------------------------------------------------------------------------------
+// System services (system.c)
+//----------------------------------------------------------------------------------------------------------------------
+
+typedef struct Data
+{
+    u8*     buffer;
+    i64     size;
+    HANDLE  file;
+    HANDLE  fileMap;
+}
+Data;
+
+f64 timeNow();
+
+Data dataLoad(const char* fileName);
+void dataUnload(Data data);
+
+typedef void (*TaskFunc)(void* arg);
+
+typedef struct
+{
+    TaskFunc    func;
+    void*       arg;
+}
+Task;
+
+typedef struct
+{
+    HANDLE*             threads;
+    int                 numThreads;
+    Task*               tasks;
+    int                 capacity;
+    int                 head;
+    int                 count;
+    int                 active;
+    bool                quit;
+    SRWLOCK             lock;
+    CONDITION_VARIABLE  workReady;
+    CONDITION_VARIABLE  spaceReady;
+    CONDITION_VARIABLE  idle;
+}
+ThreadPool;
+
+int cpuCount();
+void poolInit(ThreadPool* pool, int numThreads, int capacity);
+void poolSubmit(ThreadPool* pool, TaskFunc func, void* arg);
+void poolWait(ThreadPool* pool);
+void poolDone(ThreadPool* pool);
+
+//----------------------------------------------------------------------------------------------------------------------
+// Image handling (image.c)
+//----------------------------------------------------------------------------------------------------------------------
+
+typedef struct
+{
+    int     width;
+    int     height;
+    u32     pixels[0];
+}
+Image;
+
+// The frames of an animated GIF, read one at a time
+typedef struct
+{
+    Data    file;
+    void*   decoder;        // stb_image's state, private to image.c
+    int     index;          // Frames read so far
+}
+FrameReader;
+
+extern const u32 gZxColours[16];
+
+int channelRed(u32 c);
+int channelGreen(u32 c);
+int channelBlue(u32 c);
+int colourDistance(int r, int g, int b, u32 c);
+int scrimOffset(int x, int y);
+void scrimSetPixel(u8* scrim, int x, int y, bool ink);
+u32 attrInk(u8 attr);
+u32 attrPaper(u8 attr);
+
+Image* imageCreate(int width, int height);
+void imageDestroy(Image* img);
+void imagePrepareTarget(Image* target, const u8* rgba, int width, int height);
+Image* imageZxConvertScalar(Image* img, const u8* bytes);
+Image* imageZxConvert(Image* img, const u8* bytes);
+Image* imageZxRender(Image* img, const u8* bytes, bool flashPhase, int border);
+Image* imageHicolourConvert(Image* img, const u8* bytes, int height);
+Image* imageScreenConvert(Image* img, const u8* bytes, int size);
+const char* targetLoad(Image* target, const char* fileName);
+const char* framesOpen(FrameReader* reader, const char* fileName);
+bool framesNext(FrameReader* reader, Image* target);
+void framesClose(FrameReader* reader);
+
+//----------------------------------------------------------------------------------------------------------------------
+// Genetic Algorithm (ga.c)
+//----------------------------------------------------------------------------------------------------------------------
+
+typedef struct
+{
+    u64     state;
+}
+Rng;
+
+typedef struct
+{
+    u8      genomes[6912 * POPULATION_SIZE];
+    i64     errors[POPULATION_SIZE];
+    i64     fitness[POPULATION_SIZE];   // Running total of fitness, used for roulette selection
+    i32     parents[POPULATION_SIZE];   // Scrim of the previous population each was copied from, -1 if none
+    i64     total;
+    i64     bestScore;
+    i64     worseScore;
+    i64     indexBest;
+
+    // Arrays only some modes need, 768 cells, 64 palette entries or a screen a scrim, allocated by the mode that
+    // switches them on and 0 otherwise
+    i32*    cellScores;                 // Blurred error of every cell, in blur mode
+    i64*    cellErrors;                 // Error of every cell, in ULAplus, Gigascreen and animation modes
+    u8*     palettes;                   // ULAplus palette
+    u8*     frames;                     // Second screen in Gigascreen mode
+}
+Population;
+
+// Bytes of a population before its mode arrays, which are the same in every mode
+#define POPULATION_FIXED_SIZE   offsetof(Population, cellScores)
+
+typedef enum
+{
+    STAGNATION_STOP,        // Give up and keep the best so far
+    STAGNATION_RESTART,     // Keep the elite and start the rest of the population again
+    STAGNATION_BOOST,       // Raise the mutation rate until things improve again
+}
+StagnationAction;
+
+// What to do when the best error hasn't improved by a fraction epsilon for a window of generations
+typedef struct
+{
+    i64                 window;     // Generations; 0 turns detection off
+    f64                 epsilon;
+    StagnationAction    action;
+    int                 elite;      // Scrims that survive a restart
+    f32                 boost;      // Mutation rate multiplier, applied again each time it stagnates
+}
+Stagnation;
+
+typedef enum
+{
+    EVENT_NONE,
+    EVENT_IMPROVED,         // Best error improved by at least epsilon
+    EVENT_STAGNATED,        // ...didn't for a whole window and the converter has stopped
+    EVENT_RESTARTED,
+    EVENT_BOOSTED,
+}
+ConverterEvent;
+
+extern const char* gEventNames[5];
+
+#define BLUR_MAX_RADIUS     8
+
+// Perceptual fitness, set up by converterBlur()
+typedef struct
+{
+    f32     sigma;                              // Standard deviation of the Gaussian, in pixels
+    int     radius;                             // Pixels either side of the centre of the kernel
+    i16     kernel[BLUR_MAX_RADIUS + 1];        // The centre and one side of it, in 1.15 fixed point
+    i16     palette[16][3];                     // gZxColours at the scale pixels are filtered at
+    i16*    target;                             // Blurred target, a plane each of red, green and blue
+}
+Blur;
+
+// Everything a single conversion needs.  Converters share nothing, so any number can run on different threads.
+typedef struct
+{
+    Image*      target;
+    Image*      scratch;
+    Population* current;
+    Population* future;
+    Rng         rng;
+    i64         generation;
+    i64         evaluations;            // Scrims scored so far
+    i64         bestError;              // Best error ever seen, -1 before the first generation
+    u8          best[SCREEN_MAX_SIZE];  // ...and the screen that had it, converterScreenSize() bytes of it
+    f32         mutationChance;
+    Stagnation  stagnation;             // Off after converterInit(); callers fill it in
+    i64         stagnationError;        // Error at the last improvement that counted
+    i64         stagnationGeneration;   // ...and when it was, or when stagnation was last acted on
+    bool        stagnated;              // Stopped on stagnation; further steps do nothing
+    i64*        cellErrors;             // Hybrid mode's error of every attribute in every cell, 0 otherwise
+    Blur*       blur;                   // Blurred error instead of checkError(), 0 otherwise
+    bool        ulaplus;                // Scrims carry a ULAplus palette
+    i64*        rowErrors;              // Error of every attribute on every hi-colour or multicolour block, 0 otherwise
+    int         blockHeight;            // ...and the lines in a block
+    u32*        blends;                 // Gigascreen mode's average of every pair of colours, 0 otherwise
+    u8*         still;                  // Animation mode's screen where the target hasn't changed, 0 otherwise
+    i16*        liveCells;              // ...the cells where it has, which are all that evolve, 9 genome bytes each
+    int         numLive;
+    i64         stillError;             // ...and the error of the cells that don't
+}
+Converter;
+
+// The best scrim so far, published by the thread running a converter for any number of readers.  Readers never
+// block the writer: they retry if it published while they were copying.
+typedef struct
+{
+    volatile LONG   sequence;               // Odd while a new scrim is being written
+    volatile i64    generation;             // Updated every step, outside the sequence
+    i64             error;
+    i64             evaluations;
+    u8              best[SCREEN_MAX_SIZE];
+}
+Snapshot;
+
+void rngSeed(Rng* rng, u64 seed);
+u64 rngNext64(Rng* rng);
+u32 rngNext(Rng* rng);
+u32 rngRange(Rng* rng, u32 n);
+f32 rngFloat(Rng* rng);
+
+void generateScrim(Rng* rng, u8* bytes);
+Population* populationCreate();
+void* populationArray(size_t size);
+void populationDestroy(Population* pop);
+void generatePopulation(Rng* rng, Population *pop);
+i64 checkError(Image* img, Image* targetImg, u8* genome);
+i64 chooseParent(Rng* rng, Population* pop);
+u8 mutate(Rng* rng, u8 b, f32 chance);
+int crossover(Rng* rng, const u8* mum, const u8* dad, u8* child, int size, f32 mutationChance);
+void generate(Converter* cv, Population* curPop, Population* futurePop);
+void converterInit(Converter* cv, Image* target, u64 seed);
+int converterScreenSize(const Converter* cv);
+ConverterEvent converterStep(Converter* cv);
+void converterRestart(Converter* cv);
+void converterLog(FILE* f, const char* name, const Converter* cv, ConverterEvent event, f64 time);
+void converterDone(Converter* cv);
+void snapshotInit(Snapshot* snap);
+void snapshotPublish(Snapshot* snap, const Converter* cv);
+bool snapshotRead(Snapshot* snap, LONG* lastSequence, u8* best, i64* error);
+
+//----------------------------------------------------------------------------------------------------------------------
+// Hybrid genomes, hi-colour and multicolour (hybrid.c)
+//----------------------------------------------------------------------------------------------------------------------
+
+void converterHybrid(Converter* cv);
+i64 hybridError(const Converter* cv, const u8* genome);
+void hybridBitmap(const Converter* cv, u8* scrim);
+void converterSolve(Converter* cv);
+int multicolourHeight(int size);
+void converterHicolour(Converter* cv, int height, bool fresh);
+i64 hicolourError(const Converter* cv, Population* pop, int index, const Population* parents);
+void hicolourBitmap(const Converter* cv, u8* scr);
+
+//----------------------------------------------------------------------------------------------------------------------
+// Perceptual fitness (blur.c)
+//----------------------------------------------------------------------------------------------------------------------
+
+extern const i16 gBlurWeights[3];
+
+void converterBlur(Converter* cv, f32 sigma);
+void blurScore(const Blur* blur, const u8* genome, const bool* dirty, i32* scores);
+int blurCellOf(int offset);
+i64 blurError(const Converter* cv, Population* pop, int index, const Population* parents);
+
+//----------------------------------------------------------------------------------------------------------------------
+// ULAplus (ulaplus.c)
+//----------------------------------------------------------------------------------------------------------------------
+
+u32 ulaplusColour(u8 entry);
+int ulaplusInk(u8 attr);
+int ulaplusPaper(u8 attr);
+void ulaplusDefault(u8* palette);
+Image* ulaplusConvert(Image* img, const u8* bytes);
+void converterUlaplus(Converter* cv, bool fresh);
+i64 ulaplusError(const Converter* cv, Population* pop, int index, const Population* parents);
+
+//----------------------------------------------------------------------------------------------------------------------
+// Gigascreen (gigascreen.c)
+//----------------------------------------------------------------------------------------------------------------------
+
+void gigascreenBlends(u32* blends);
+Image* gigascreenConvert(Image* img, const u8* bytes);
+void converterGigascreen(Converter* cv, bool fresh);
+i64 gigascreenError(const Converter* cv, Population* pop, int index, const Population* parents);
+
+//----------------------------------------------------------------------------------------------------------------------
+// Seeded initialisation (seed.c)
+//----------------------------------------------------------------------------------------------------------------------
+
+typedef enum
+{
+    SEED_NEAREST,           // Each pixel the nearer of its cell's best two colours
+    SEED_ORDERED,           // Bayer dither between them
+    SEED_DIFFUSION,         // Floyd-Steinberg between them
+    SEED_THRESHOLD,         // Each cell split at its mean luminance
+    SEED_BLUE_NOISE,        // orderedScreen() with a shifted blue noise matrix, attributes and all
+    SEED_COUNT,
+}
+SeedMethod;
+
+extern const char* gSeedMethodNames[SEED_COUNT];
+extern const u8 gBayer[64];
+
+typedef struct
+{
+    f32     fraction;       // Of the population; 0 leaves it all random
+    u32     methods;        // One bit per SeedMethod, 0 for all of them
+    int     numThreads;     // 0 for one per core
+}
+Seeding;
+
+u32 seedMethodsFromNames(const char* names);
+void converterSeed(Converter* cv, const Seeding* seeding);
+
+//----------------------------------------------------------------------------------------------------------------------
+// Error diffusion (dither.c)
+//----------------------------------------------------------------------------------------------------------------------
+
+typedef enum
+{
+    DITHER_NONE,
+    DITHER_FLOYD_STEINBERG,
+    DITHER_ATKINSON,
+    DITHER_SIERRA,
+    DITHER_BAYER,           // Ordered, see orderedScreen()
+    DITHER_BLUE_NOISE,
+    DITHER_COUNT,
+}
+Dither;
+
+extern const char* gDitherNames[DITHER_COUNT];
+
+Dither ditherFromName(const char* name);
+void ditherAnalyse(const Image* target, u8* attrs);
+void ditherDiffuse(const Image* target, const u8* attrs, Dither dither, int strength, bool serpentine, u8* scr);
+void ditherScreen(const Image* target, Dither dither, u8* scr);
+void converterDither(Converter* cv, Dither dither);
+
+//----------------------------------------------------------------------------------------------------------------------
+// Ordered dithering (ordered.c)
+//----------------------------------------------------------------------------------------------------------------------
+
+extern const u8 gBlueNoise[256];
+
+void orderedScreen(const Image* target, Dither dither, int dx, int dy, u8* scr);
+
+//----------------------------------------------------------------------------------------------------------------------
+// Beam search (beam.c)
+//----------------------------------------------------------------------------------------------------------------------
+
+#define BEAM_MAX_WIDTH      32
+
+void converterBeam(Converter* cv, int width, int numThreads);
+
+//----------------------------------------------------------------------------------------------------------------------
+// Instrumentation (stats.c)
+// Per-thread phase timers and call counters, only built when ZXIMG_STATS is defined; otherwise the macros compile to
+// nothing.  Snapshots always carry the figures that can be read off the converter itself.
+//----------------------------------------------------------------------------------------------------------------------
+
+typedef enum
+{
+    PHASE_SCORE,            // checkError() over the population
+    PHASE_SELECT,           // Fitness totals and chooseParent()
+    PHASE_CROSSOVER,        // crossover(), including the mutation done while copying
+    PHASE_MUTATE,           // Cloning a parent with mutation
+    PHASE_DISPLAY,          // Rendering the best scrim for the window
+    PHASE_MESSAGES,         // Windows message pump
+    PHASE_COUNT,
+}
+Phase;
+
+extern const char* gPhaseNames[PHASE_COUNT];
+
+// Each thread only writes its own, so they sit on separate cache lines
+typedef struct __declspec(align(64))
+{
+    u64     ticks[PHASE_COUNT];
+    u64     calls[PHASE_COUNT];
+}
+ThreadStats;
+
+typedef struct
+{
+    FILE*   file;
+    bool    json;           // JSON lines, otherwise CSV
+    f64     startTime;
+    u64     startTicks;
+    f64     lastTime;
+    i64     lastEvaluations;
+}
+StatsWriter;
+
+u64 statsTicks();
+ThreadStats* statsThread();
+void statsWriterInit(StatsWriter* sw, FILE* file, bool json);
+void statsWrite(StatsWriter* sw, const Converter* cv);
+
+#ifdef ZXIMG_STATS
+#   define STATS_BEGIN(phase)   u64 statsStart##phase = statsTicks()
+#   define STATS_END(phase)                                                     \
+    do {                                                                        \
+        ThreadStats* ts = statsThread();                                        \
+        ts->ticks[phase] += statsTicks() - statsStart##phase;                   \
+        ++ts->calls[phase];                                                     \
+    } while (0)
+#else
+#   define STATS_BEGIN(phase)
+#   define STATS_END(phase)
+#endif
+
+//----------------------------------------------------------------------------------------------------------------------
+// Tracing (trace.c)
+// Timeline zones written to a Chrome trace file (chrome://tracing, ui.perfetto.dev).  Only built when ZXIMG_TRACE is
+// defined, and only recorded once traceInit() has been called.
+//----------------------------------------------------------------------------------------------------------------------
+
+void traceInit(const char* fileName, i64 flushMs);
+void traceDone();
+void traceThreadName(const char* name);
+i64 traceBegin();
+void traceEnd(const char* name, i64 start);
+
+#ifdef ZXIMG_TRACE
+#   define TRACE_BEGIN(zone)    i64 traceStart_##zone = traceBegin()
+#   define TRACE_END(zone)      traceEnd(#zone, traceStart_##zone)
+#else
+#   define TRACE_BEGIN(zone)
+#   define TRACE_END(zone)
+#endif
+
+//----------------------------------------------------------------------------------------------------------------------
+// Screen export, population state and checkpoints (export.c)
+//----------------------------------------------------------------------------------------------------------------------
+
+#define EXPORT_MAX_SIZE     (30 + 49152 + 64)
+
+typedef enum
+{
+    FORMAT_SCR,
+    FORMAT_TAP,
+    FORMAT_TZX,
+    FORMAT_Z80,
+}
+ScrFormat;
+
+extern const char* gFormatExtensions[4];
+
+ScrFormat formatFromExtension(const char* ext);
+ScrFormat formatFromName(const char* fileName);
+size_t exportEncode(u8* out, ScrFormat format, const char* fileName, const u8* scr, int size);
+bool fileWriteAtomic(const char* fileName, const void* data, size_t size);
+bool exportScreen(const char* fileName, const u8* scr, int size);
+
+bool stateSave(const char* fileName, const Converter* cv, f64 elapsed);
+const char* converterResume(Converter* cv, Image* target, const char* fileName, f64* elapsed);
+
+typedef struct
+{
+    char    fileName[MAX_PATH];
+    u8      scr[SCREEN_MAX_SIZE];
+    int     size;
+    bool    pending;
+    char    stateName[MAX_PATH];
+    u8*     state;              // Encoded population state, allocated on first use
+    size_t  stateSize;
+    bool    statePending;
+}
+CheckpointSlot;
+
+typedef struct
+{
+    HANDLE              thread;
+    SRWLOCK             lock;
+    CONDITION_VARIABLE  wake;
+    CONDITION_VARIABLE  saved;
+    CheckpointSlot*     slots;
+    int                 numSlots;
+    int                 busySlot;   // Slot being saved right now, -1 if none
+    u8*                 stateBuffer;// State being written; swapped with a slot's so posting never waits for a write
+    bool                quit;
+}
+Checkpointer;
+
+void checkpointInit(Checkpointer* cp, int numSlots);
+void checkpointPost(Checkpointer* cp, int slot, const char* fileName, const u8* scr, int size);
+void checkpointPostState(Checkpointer* cp, int slot, const char* fileName, const Converter* cv, f64 elapsed);
+void checkpointCancel(Checkpointer* cp, int slot);
+void checkpointDone(Checkpointer* cp);
+
+//----------------------------------------------------------------------------------------------------------------------
+// Budgets (convert.c)
+//----------------------------------------------------------------------------------------------------------------------
+
+typedef struct
+{
+    i64         timeMs;         // Wall-clock budget for the optimisation, 0 for none
+    i64         targetError;    // Stop as soon as the best scrim is this good, 0 for none
+    i64         generations;    // Maximum number of generations, 0 for none
+    i64         evaluations;    // Maximum number of scrims scored, 0 for none
+    Stagnation  stagnation;     // Copied into the converter
+}
+Budget;
+
+typedef enum
+{
+    STOP_NONE,
+    STOP_TARGET,            // Reached the target error
+    STOP_DEADLINE,          // Out of time, or would have been after another generation
+    STOP_GENERATIONS,
+    STOP_EVALUATIONS,       // Another generation would have gone over the evaluation budget
+    STOP_STAGNATION,
+}
+StopReason;
+
+f64 budgetDeadline(const Budget* budget, f64 start, f64 deadline);
+StopReason budgetCheck(const Budget* budget, const Converter* cv, f64 deadline, f64 stepTime);
+f64 budgetStepTime(f64 stepTime, f64 t);
+
+//----------------------------------------------------------------------------------------------------------------------
+// Batch conversion (batch.c)
+//----------------------------------------------------------------------------------------------------------------------
+
+typedef struct
+{
+    const char* outDir;         // Where outputs go, next to the inputs if 0
+    ScrFormat   format;         // Format of outputs not named in a manifest
+    Budget      budget;         // Default budget for every image
+    int         numThreads;     // 0 for one per core
+    u64         seed;
+    i64         checkpointMs;   // Save the best screen so far this often while optimising, 0 for never
+    FILE*       log;            // Improvement and stagnation events, or 0
+    bool        resumable;      // Checkpoint population state next to each output and resume from it
+    Seeding     seeding;        // numThreads is ignored; images are already converted in parallel
+    Dither      dither;         // Convert by error diffusion instead of optimising, ignoring the budget
+    bool        hybrid;         // Evolve attributes only and derive the bitmaps
+    f32         blur;           // Score through a Gaussian blur of this sigma, 0 for plain error
+    int         beam;           // Convert by a beam search this wide instead of optimising, ignoring the budget
+    bool        ulaplus;        // Evolve a ULAplus palette with every scrim and save it after the screen
+    bool        hicolour;       // Evolve an attribute for every 8x1 row and save Timex hi-colour screens
+    int         multicolour;    // Lines per attribute, 2 or 4, to evolve for a multicolour player; 0 for neither
+    bool        gigascreen;     // Evolve pairs of screens shown on alternate frames and save both
+}
+BatchOptions;
+
+bool isImageFile(const char* fileName);
+int batchRun(const char* source, const BatchOptions* options);
+
+//----------------------------------------------------------------------------------------------------------------------
+// Animation (animation.c)
+//----------------------------------------------------------------------------------------------------------------------
+
+void converterAnimate(Converter* cv, const Converter* prev);
+i64 animationError(const Converter* cv, Population* pop, int index, const Population* parents);
+void animationScreen(const Converter* cv, u8* scr);
+int animationRun(const char* fileName, const BatchOptions* options);
+
+//----------------------------------------------------------------------------------------------------------------------
+// Video streaming (video.c)
+//----------------------------------------------------------------------------------------------------------------------
+
+int videoRun(const char* source, const BatchOptions* options, HANDLE stdIn, HANDLE stdOut);
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,410 @@
+//----------------------------------------------------------------------------------------------------------------------
+// scr2img
+// Bulk .scr -> .ppm/.png decoder for previewing archives of screens
+//----------------------------------------------------------------------------------------------------------------------
+
+#include "zximg.h"
+
+//----------------------------------------------------------------------------------------------------------------------
+// PNG writing
+// Truecolour, 8 bits per channel, with the image data in stored (uncompressed) deflate blocks.  Screens are tiny and
+// this keeps the writer trivial and fast; anything that needs smaller files can recompress them later.
+//----------------------------------------------------------------------------------------------------------------------
+
+u32 gCrcTable[256];
+
+void crcInit()
+{
+    for (u32 n = 0; n < 256; ++n)
+    {
+        u32 c = n;
+        for (int k = 0; k < 8; ++k)
+        {
+            c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+        }
+        gCrcTable[n] = c;
+    }
+}
+
+u32 crc(const u8* data, size_t size)
+{
+    u32 c = 0xffffffff;
+    for (size_t i = 0; i < size; ++i)
+    {
+        c = gCrcTable[(c ^ data[i]) & 0xff] ^ (c >> 8);
+    }
+    return c ^ 0xffffffff;
+}
+
+u8* putBigEndian(u8* out, u32 v)
+{
+    out[0] = (u8)(v >> 24);
+    out[1] = (u8)(v >> 16);
+    out[2] = (u8)(v >> 8);
+    out[3] = (u8)v;
+    return out + 4;
+}
+
+// Fills in the length and CRC of a chunk whose type and data start at 'chunk'.  Returns the end of the chunk.
+u8* pngChunkEnd(u8* chunk, size_t dataSize)
+{
+    putBigEndian(chunk - 4, (u32)dataSize);
+    return putBigEndian(chunk + 4 + dataSize, crc(chunk, dataSize + 4));
+}
+
+size_t pngMaxSize(int width, int height)
+{
+    size_t raw = (size_t)(width * 3 + 1) * height;
+    return raw + (raw / 65535 + 1) * 5 + 128;
+}
+
+u32 adler32(const u8* data, size_t size)
+{
+    u32 a = 1, b = 0;
+    while (size)
+    {
+        // 5552 is the most bytes that can be summed before b could overflow
+        size_t n = size < 5552 ? size : 5552;
+        size -= n;
+        while (n--)
+        {
+            a += *data++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return (b << 16) | a;
+}
+
+// 'raw' is scratch space for pngMaxSize() bytes
+size_t pngEncode(u8* out, u8* raw, const Image* img)
+{
+    static const u8 signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    size_t rawSize = 0;
+    u8* chunk;
+    u8* p;
+
+    // Scanlines with filter type 0 in front of each
+    for (int y = 0; y < img->height; ++y)
+    {
+        const u32* row = img->pixels + y * img->width;
+        raw[rawSize++] = 0;
+        for (int x = 0; x < img->width; ++x)
+        {
+            raw[rawSize++] = (u8)(row[x] >> 16);
+            raw[rawSize++] = (u8)(row[x] >> 8);
+            raw[rawSize++] = (u8)row[x];
+        }
+    }
+
+    memcpy(out, signature, 8);
+
+    chunk = out + 12;
+    memcpy(chunk, "IHDR", 4);
+    p = putBigEndian(chunk + 4, img->width);
+    p = putBigEndian(p, img->height);
+    p[0] = 8;           // Bit depth
+    p[1] = 2;           // Truecolour
+    p[2] = p[3] = p[4] = 0;
+    p = pngChunkEnd(chunk, 13);
+
+    chunk = p + 4;
+    memcpy(chunk, "IDAT", 4);
+    p = chunk + 4;
+    *p++ = 0x78;        // zlib header, no compression
+    *p++ = 0x01;
+    for (size_t done = 0; done < rawSize;)
+    {
+        size_t block = rawSize - done < 65535 ? rawSize - done : 65535;
+        *p++ = (done + block == rawSize) ? 1 : 0;
+        *p++ = (u8)block;
+        *p++ = (u8)(block >> 8);
+        *p++ = (u8)~block;
+        *p++ = (u8)(~block >> 8);
+        memcpy(p, raw + done, block);
+        p += block;
+        done += block;
+    }
+    p = putBigEndian(p, adler32(raw, rawSize));
+    p = pngChunkEnd(chunk, p - chunk - 4);
+
+    chunk = p + 4;
+    memcpy(chunk, "IEND", 4);
+    p = pngChunkEnd(chunk, 0);
+
+    return p - out;
+}
+
+size_t ppmEncode(u8* out, const Image* img)
+{
+    int header = sprintf((char *)out, "P6\n%d %d\n255\n", img->width, img->height);
+    u8* p = out + header;
+
+    for (int i = 0; i < img->width * img->height; ++i)
+    {
+        u32 pixel = img->pixels[i];
+        *p++ = (u8)(pixel >> 16);
+        *p++ = (u8)(pixel >> 8);
+        *p++ = (u8)pixel;
+    }
+
+    return p - out;
+}
+
+// Halves an image in both directions, averaging each 2x2 block
+void imageHalve(Image* dst, const Image* src)
+{
+    for (int y = 0; y < dst->height; ++y)
+    {
+        const u32* s0 = src->pixels + (y * 2) * src->width;
+        const u32* s1 = s0 + src->width;
+        u32* d = dst->pixels + y * dst->width;
+        for (int x = 0; x < dst->width; ++x, s0 += 2, s1 += 2)
+        {
+            u32 rb = (s0[0] & 0xff00ff) + (s0[1] & 0xff00ff) + (s1[0] & 0xff00ff) + (s1[1] & 0xff00ff);
+            u32 g = (s0[0] & 0xff00) + (s0[1] & 0xff00) + (s1[0] & 0xff00) + (s1[1] & 0xff00);
+            *d++ = ((rb >> 2) & 0xff00ff) | ((g >> 2) & 0xff00);
+        }
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Conversion
+// Files are split into chunks that run as thread pool tasks.  Each task maps its inputs one at a time, renders them
+// and writes the result.  Only the rendering is timed for the decode throughput figure.
+//----------------------------------------------------------------------------------------------------------------------
+
+#define CHUNK_SIZE      64
+#define BORDER_SIZE     32
+
+typedef struct
+{
+    const char* outDir;
+    bool        png;
+    bool        write;
+    bool        flash;
+    bool        half;
+    int         border;         // Border colour, -1 for none
+    int         repeat;         // Times to render each screen, for measuring the decoder
+}
+Options;
+
+typedef struct
+{
+    char**          files;
+    int             numFiles;
+    const Options*  options;
+    volatile LONG   numFailed;
+    volatile LONG64 decodeTicks;
+}
+Job;
+
+typedef struct
+{
+    Job*    job;
+    int     first;
+    int     count;
+}
+Chunk;
+
+void convertChunk(void* arg)
+{
+    Chunk* chunk = (Chunk *)arg;
+    Job* job = chunk->job;
+    const Options* options = job->options;
+    int border = options->border >= 0 ? BORDER_SIZE : 0;
+    Image* img = imageCreate(256 + border * 2, 192 + border * 2);
+    Image* half = imageCreate(img->width / 2, img->height / 2);
+    Image* out = options->half ? half : img;
+    u8* encoded = (u8 *)malloc(pngMaxSize(img->width, img->height));
+    u8* raw = (u8 *)malloc(pngMaxSize(img->width, img->height));
+    LARGE_INTEGER t0, t1;
+    i64 ticks = 0;
+
+    for (int i = chunk->first; i < chunk->first + chunk->count; ++i)
+    {
+        const char* input = job->files[i];
+        Data data = dataLoad(input);
+        char output[MAX_PATH];
+        const char* name = input;
+        const char* ext;
+        size_t size;
+
+        if (!data.buffer || data.size < 6912)
+        {
+            printf("%s: not a screen\n", input);
+            InterlockedIncrement(&job->numFailed);
+            dataUnload(data);
+            continue;
+        }
+
+        QueryPerformanceCounter(&t0);
+        for (int r = 0; r < options->repeat; ++r)
+        {
+            imageZxRender(img, data.buffer, options->flash, options->border);
+        }
+        QueryPerformanceCounter(&t1);
+        ticks += t1.QuadPart - t0.QuadPart;
+        dataUnload(data);
+
+        if (!options->write) continue;
+        if (options->half) imageHalve(half, img);
+        size = options->png ? pngEncode(encoded, raw, out) : ppmEncode(encoded, out);
+
+        if (options->outDir)
+        {
+            for (const char* s = input; *s; ++s)
+            {
+                if (*s == '\\' || *s == '/' || *s == ':') name = s + 1;
+            }
+        }
+        ext = strrchr(name, '.');
+        snprintf(output, MAX_PATH, "%s%s%.*s%s",
+            options->outDir ? options->outDir : "", options->outDir ? "\\" : "",
+            ext ? (int)(ext - name) : (int)strlen(name), name,
+            options->png ? ".png" : ".ppm");
+
+        if (!fileWriteAtomic(output, encoded, size))
+        {
+            printf("%s: cannot write %s\n", input, output);
+            InterlockedIncrement(&job->numFailed);
+        }
+    }
+
+    InterlockedExchangeAdd64(&job->decodeTicks, ticks);
+    free(raw);
+    free(encoded);
+    imageDestroy(half);
+    imageDestroy(img);
+}
+
+void addFile(Job* job, const char* fileName)
+{
+    job->files = (char **)realloc(job->files, (job->numFiles + 1) * sizeof(char *));
+    job->files[job->numFiles++] = _strdup(fileName);
+}
+
+void addDirectory(Job* job, const char* dir)
+{
+    WIN32_FIND_DATAA fd;
+    char path[MAX_PATH];
+    HANDLE find;
+
+    snprintf(path, MAX_PATH, "%s\\*.scr", dir);
+    find = FindFirstFileA(path, &fd);
+    if (find == INVALID_HANDLE_VALUE) return;
+
+    do
+    {
+        if (!(fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+        {
+            snprintf(path, MAX_PATH, "%s\\%s", dir, fd.cFileName);
+            addFile(job, path);
+        }
+    }
+    while (FindNextFileA(find, &fd));
+    FindClose(find);
+}
+
+// Usage:
+//
+//      scr2img [--png|--ppm] [--out <dir>] [--flash] [--border <0-7>] [--half] [--threads <n>]
+//              [--repeat <n>] [--no-output] <file.scr|directory>...
+//
+int main(int argc, char** argv)
+{
+    Options options = { 0 };
+    Job job = { 0 };
+    ThreadPool pool;
+    Chunk* chunks;
+    int numChunks;
+    int numThreads = 0;
+    LARGE_INTEGER freq;
+    f64 start, elapsed, decodeTime;
+
+    options.png = YES;
+    options.write = YES;
+    options.border = -1;
+    options.repeat = 1;
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+        const char* value = (i + 1 < argc) ? argv[i + 1] : 0;
+
+        if (!strcmp(arg, "--png"))                      options.png = YES;
+        else if (!strcmp(arg, "--ppm"))                 options.png = NO;
+        else if (!strcmp(arg, "--flash"))               options.flash = YES;
+        else if (!strcmp(arg, "--half"))                options.half = YES;
+        else if (!strcmp(arg, "--no-output"))           options.write = NO;
+        else if (!strcmp(arg, "--out") && value)        options.outDir = argv[++i];
+        else if (!strcmp(arg, "--border") && value)     options.border = atoi(argv[++i]) & 7;
+        else if (!strcmp(arg, "--threads") && value)    numThreads = atoi(argv[++i]);
+        else if (!strcmp(arg, "--repeat") && value)     options.repeat = atoi(argv[++i]);
+        else
+        {
+            DWORD attr = GetFileAttributesA(arg);
+            if (attr != INVALID_FILE_ATTRIBUTES && (attr & FILE_ATTRIBUTE_DIRECTORY))
+            {
+                addDirectory(&job, arg);
+            }
+            else
+            {
+                addFile(&job, arg);
+            }
+        }
+    }
+
+    if (!job.numFiles)
+    {
+        printf("Usage: scr2img [--png|--ppm] [--out <dir>] [--flash] [--border <0-7>] [--half] [--threads <n>]\n"
+               "               [--repeat <n>] [--no-output] <file.scr|directory>...\n");
+        return 1;
+    }
+    if (options.repeat < 1) options.repeat = 1;
+    if (numThreads <= 0) numThreads = cpuCount();
+    if (options.outDir) CreateDirectoryA(options.outDir, 0);
+    crcInit();
+
+    job.options = &options;
+    numChunks = (job.numFiles + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    chunks = (Chunk *)malloc(numChunks * sizeof(Chunk));
+
+    start = timeNow();
+    poolInit(&pool, numThreads, numChunks);
+    for (int i = 0; i < numChunks; ++i)
+    {
+        chunks[i].job = &job;
+        chunks[i].first = i * CHUNK_SIZE;
+        chunks[i].count = (job.numFiles - chunks[i].first < CHUNK_SIZE) ? job.numFiles - chunks[i].first : CHUNK_SIZE;
+        poolSubmit(&pool, &convertChunk, &chunks[i]);
+    }
+    poolWait(&pool);
+    poolDone(&pool);
+    elapsed = timeNow() - start;
+
+    QueryPerformanceFrequency(&freq);
+    decodeTime = (f64)job.decodeTicks / (f64)freq.QuadPart;
+    {
+        f64 screens = (f64)(job.numFiles - job.numFailed) * options.repeat;
+        printf("%d files, %d failed, %.3fs on %d threads: %.0f files/s\n",
+            job.numFiles, (int)job.numFailed, elapsed, numThreads, (f64)job.numFiles / elapsed);
+        if (decodeTime > 0)
+        {
+            printf("Decoding: %.0f screens/s per thread, %.1f MB/s of screen data\n",
+                screens / decodeTime, screens * 6912.0 / decodeTime / 1e6);
+        }
+    }
+
+    for (int i = 0; i < job.numFiles; ++i)
+    {
+        free(job.files[i]);
+    }
+    free(job.files);
+    free(chunks);
+
+    return job.numFailed ? 1 : 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------